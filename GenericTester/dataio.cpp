@@ -1,56 +1,120 @@
 #include "dataio.hpp"
 
 #include <limits>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cctype>
 
 
-logtime_t loadInputData(std::istream& sin, FunshieldSimulationController& funshield,
-    std::vector<std::shared_ptr<TimeSeries<bool>>>& buttonEvents, std::shared_ptr<TimeSeries<std::string>> serialEvents)
+/**
+ * Whitespace as recognized by stream extraction operators (in the classic locale).
+ */
+static inline bool isSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline const char* skipSpaces(const char* pos, const char* end)
+{
+    while (pos < end && isSpace(*pos)) ++pos;
+    return pos;
+}
+
+/**
+ * Parse unsigned decimal number the same way as `sin >> value` (including optional sign and handling of overflows).
+ * @return true if the number was parsed (false = failbit would be set)
+ */
+static bool parseTimestamp(const char*& pos, const char* end, logtime_t& value)
 {
-    std::string line;
-    std::size_t lineCount = 0;
-    logtime_t lastTime = 0;
-    bool buttonStates[] = { false, false, false };
+    value = 0;
+    pos = skipSpaces(pos, end);
+    bool negative = pos < end && *pos == '-';
+    if (pos < end && (*pos == '+' || *pos == '-')) ++pos;
+
+    auto res = std::from_chars(pos, end, value);
+    if (res.ec == std::errc::invalid_argument) {
+        value = 0;
+        return false;
+    }
+    pos = res.ptr;
+    if (res.ec == std::errc::result_out_of_range) {
+        value = std::numeric_limits<logtime_t>::max();
+        return false;
+    }
+    if (negative) {
+        value = (logtime_t)0 - value;
+    }
+    return true;
+}
 
-    while (std::getline(sin, line)) {
-        ++lineCount;
-        if (line.empty()) continue;
 
-        // parse the line
+FunshieldInputFeed::FunshieldInputFeed(const char* data, std::size_t size, FunshieldSimulationController& funshield)
+    : mFunshield(funshield), mStartTime(funshield.getArduino().getCurrentTime()), mPos(data), mEnd(data + size),
+    mLineCount(0), mLastTime(0), mButtonStates{ false, false, false }, mHasNext(false), mEndTime(0),
+    mSerialRecorder(nullptr), mRecordedTime(0)
+{
+    readNext();
+}
+
+
+void FunshieldInputFeed::readNext()
+{
+    mHasNext = false;
+    while (mPos < mEnd) {
+        const char* pos = mPos;
+        const char* eol = static_cast<const char*>(std::memchr(pos, '\n', mEnd - pos));
+        eol = eol != nullptr ? eol : mEnd;
+        mPos = eol < mEnd ? eol + 1 : mEnd;
+
+        ++mLineCount;
+        if (pos == eol) continue;
+
+        // parse the line (tokens are processed in place, the same way as `line >> time >> actionType >> newState`)
         logtime_t time = 0;
         char actionType = '\0';
         char newState = '\0';
-        std::stringstream ss(line);
-        ss >> time >> actionType >> newState;
+        if (parseTimestamp(pos, eol, time)) {
+            pos = skipSpaces(pos, eol);
+            if (pos < eol) {
+                actionType = *pos++;
+                pos = skipSpaces(pos, eol);
+                if (pos < eol) {
+                    newState = *pos++;
+                }
+            }
+        }
 
-        if (time < lastTime) {
-            throw std::runtime_error("Timestamps are not ordered on line " + std::to_string(lineCount)
-                + ". Timestamp " + std::to_string(time) + " is lower than the previous " + std::to_string(lastTime) + ".");
+        if (time < mLastTime) {
+            throw std::runtime_error("Timestamps are not ordered on line " + std::to_string(mLineCount)
+                + ". Timestamp " + std::to_string(time) + " is lower than the previous " + std::to_string(mLastTime) + ".");
         }
-        lastTime = time;
+        mLastTime = time;
 
         if (actionType == '\0') {
-            return lastTime; // the timestamp had no additional arguments, it must have been the last marker
+            mPos = mEnd;
+            mEndTime = mLastTime; // the timestamp had no additional arguments, it must have been the last marker
+            return;
         }
 
 
         if (actionType == 'S') {
             // serial input
-            std::string serialInput;
+            mNext.serial.clear();
             if (newState != '\0') {
-                std::getline(ss, serialInput, '\0');
-                serialInput = newState + serialInput;
-
-                // trim whitespace at the end (may be \r or extra trailing spaces)
-                serialInput.erase(std::find_if(serialInput.rbegin(), serialInput.rend(), [](unsigned char ch) {
-                    return !std::isspace(ch);
-                }).base(), serialInput.end());
+                // the rest of the line (up to a null char) without trailing whitespace (may be \r or extra trailing spaces)
+                const char* last = static_cast<const char*>(std::memchr(pos, '\0', eol - pos));
+                last = last != nullptr ? last : eol;
+                while (last > pos && std::isspace((unsigned char)last[-1])) --last;
+                mNext.serial.reserve(last - pos + 1);
+                mNext.serial += newState;
+                mNext.serial.append(pos, last);
             }
 
-            funshield.getArduino().enqueueSerialInputEvent(serialInput, time);
-
-            if (serialEvents) {
-                serialEvents->addEvent(time, serialInput);
-            }
+            mNext.time = time;
+            mNext.button = -1;
+            mHasNext = true;
+            return;
         }
         else {
             /*
@@ -59,108 +123,332 @@ logtime_t loadInputData(std::istream& sin, FunshieldSimulationController& funshi
 
             if (actionType < '1' || actionType > '3' || (newState != 'u' && newState != 'd')) {
                 throw std::runtime_error("Invalid operation (button #" + std::to_string(actionType) + " action " + newState
-                    + ") found at line " + std::to_string(lineCount));
+                    + ") found at line " + std::to_string(mLineCount));
             }
             int button = (int)actionType - (int)'1'; // normalize to 0-based int
 
             bool newButtonState = newState == 'd'; // down = true
-            if (buttonStates[button] == newButtonState) {
+            if (mButtonStates[button] == newButtonState) {
                 continue; // no change in state
             }
-            buttonStates[button] = newButtonState;
+            mButtonStates[button] = newButtonState;
+
+            mNext.time = time;
+            mNext.button = button;
+            mNext.pressed = newButtonState;
+            mHasNext = true;
+            return;
+        }
+    }
+
+    mEndTime = mLastTime + 100000; // add 100ms after last button event
+}
 
-            // enqueue the event into funshield emulator
-            if (newButtonState) {
-                funshield.buttonDown(button, time);
+
+void FunshieldInputFeed::recordButton(std::size_t button, EventConsumer<bool>& recorder)
+{
+    if (mButtonRecorders.size() <= button) {
+        mButtonRecorders.resize(button + 1, nullptr);
+    }
+    mButtonRecorders[button] = &recorder;
+}
+
+
+void FunshieldInputFeed::recordSerial(EventConsumer<std::string>& recorder)
+{
+    mSerialRecorder = &recorder;
+}
+
+
+logtime_t FunshieldInputFeed::scanDuration() const
+{
+    FunshieldInputFeed scan(*this);
+    while (scan.mHasNext) {
+        scan.readNext();
+    }
+    return scan.mEndTime;
+}
+
+
+logtime_t FunshieldInputFeed::nextEventTime() const
+{
+    return mHasNext ? mStartTime + mNext.time : std::numeric_limits<logtime_t>::max();
+}
+
+
+void FunshieldInputFeed::feed(logtime_t time)
+{
+    while (mHasNext && mStartTime + mNext.time <= time) {
+        if (mNext.button < 0) {
+            mFunshield.getArduino().scheduleSerialInputEvent(mNext.serial, mStartTime + mNext.time);
+            if (mSerialRecorder != nullptr) {
+                mSerialRecorder->addEvent(mNext.time, std::move(mNext.serial));
             }
-            else {
-                funshield.buttonUp(button, time);
+        }
+        else {
+            // enqueue the event into funshield emulator and record it for the output events
+            mFunshield.scheduleButtonChange(mNext.button, mNext.pressed, mStartTime + mNext.time);
+            if (mNext.button < (int)mButtonRecorders.size() && mButtonRecorders[mNext.button] != nullptr) {
+                mButtonRecorders[mNext.button]->addEvent(mNext.time, mNext.pressed);
             }
+        }
+        mRecordedTime = mNext.time;
+        readNext();
+    }
+
+    // the recorders will not receive any events up to the current time (the next one is later or the input is exhausted)
+    logtime_t recorded = time - std::min(time, mStartTime);
+    if (recorded > mRecordedTime) {
+        mRecordedTime = recorded;
+        for (auto recorder : mButtonRecorders) {
+            if (recorder != nullptr) {
+                recorder->advanceTime(recorded);
+            }
+        }
+        if (mSerialRecorder != nullptr) {
+            mSerialRecorder->advanceTime(recorded);
+        }
+    }
+}
+
+
+logtime_t loadInputData(const char* data, std::size_t size, FunshieldSimulationController& funshield,
+    std::vector<std::shared_ptr<TimeSeries<bool>>>& buttonEvents, std::shared_ptr<TimeSeries<std::string>> serialEvents)
+{
+    FunshieldInputFeed input(data, size, funshield);
+    for (std::size_t i = 0; i < buttonEvents.size(); ++i) {
+        input.recordButton(i, *buttonEvents[i]);
+    }
+    if (serialEvents) {
+        input.recordSerial(*serialEvents);
+    }
+
+    // schedule all events at once
+    input.feed(std::numeric_limits<logtime_t>::max());
+    return input.scanDuration();
+}
+
+
+logtime_t loadInputData(std::istream& sin, FunshieldSimulationController& funshield,
+    std::vector<std::shared_ptr<TimeSeries<bool>>>& buttonEvents, std::shared_ptr<TimeSeries<std::string>> serialEvents)
+{
+    MappedFile input;
+    if (!input.read(sin)) {
+        throw std::runtime_error("Failed to read input data.");
+    }
+    return loadInputData(input.data(), input.size(), funshield, buttonEvents, serialEvents);
+}
+
+namespace
+{
+    /**
+     * Head of one series in the merge -- timestamp of the first unprocessed event of the series.
+     */
+    struct MergeHead
+    {
+        logtime_t time;
+        std::size_t series;
 
-            // record it for the output events
-            if (button < (int)buttonEvents.size()) {
-                buttonEvents[button]->addEvent(time, newButtonState);
+        // inverted, so the heap (std::*_heap functions build max-heaps) yields the earliest event first
+        bool operator<(const MergeHead& head) const
+        {
+            return time > head.time || (time == head.time && series > head.series);
+        }
+    };
+}
+
+
+static std::size_t printEventRows(std::ostream& sout, std::string& buffer, const std::vector<const TimeSeriesBase<>*>& series,
+    std::vector<std::size_t>& indices, logtime_t limit, char delimiter)
+{
+    constexpr std::size_t FLUSH_SIZE = 64 * 1024;
+    std::vector<MergeHead> heap;
+    for (std::size_t s = 0; s < series.size(); ++s) {
+        if (indices[s] < series[s]->size()) {
+            heap.push_back({ series[s]->getEventTime(indices[s]), s });
+        }
+    }
+    std::make_heap(heap.begin(), heap.end());
+
+    // process the time series one timestamp at a time (all series with events at that time are taken from the heap)
+    std::size_t rows = 0;
+    std::vector<bool> present(series.size(), false);
+    while (!heap.empty() && (heap.front().time < limit || limit == std::numeric_limits<logtime_t>::max())) {
+        logtime_t ts = heap.front().time;
+        while (!heap.empty() && heap.front().time == ts) {
+            present[heap.front().series] = true;
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+        }
+
+        char digits[24];
+        buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), ts).ptr);
+        for (std::size_t s = 0; s < series.size(); ++s) {
+            buffer += delimiter;
+            if (present[s]) {
+                present[s] = false;
+                series[s]->appendEventAsString(indices[s]++, buffer);
+                if (indices[s] < series[s]->size()) {
+                    heap.push_back({ series[s]->getEventTime(indices[s]), s });
+                    std::push_heap(heap.begin(), heap.end());
+                }
             }
+        }
+        buffer += '\n';
+        ++rows;
 
+        if (buffer.size() >= FLUSH_SIZE) {
+            sout.write(buffer.data(), buffer.size());
+            buffer.clear();
         }
+    }
+    return rows;
+}
 
+
+static void printEventsHeader(std::string& buffer, const std::vector<std::string>& names, char delimiter)
+{
+    buffer += "timestamp";
+    for (auto const& name : names) {
+        buffer += delimiter;
+        buffer += name;
     }
+    buffer += '\n';
+}
+
+
+void printEvents(std::ostream& sout, const std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>& events, char delimiter)
+{
+    std::string buffer;
+    std::vector<std::string> names;
+    std::vector<const TimeSeriesBase<>*> series;
+    for (auto const& it : events) {
+        names.push_back(it.first);
+        series.push_back(it.second.get());
+    }
+    std::vector<std::size_t> indices(series.size(), 0);
 
-    return lastTime + 100000; // add 100ms after last button event
+    printEventsHeader(buffer, names, delimiter);
+    printEventRows(sout, buffer, series, indices, std::numeric_limits<logtime_t>::max(), delimiter);
+    sout.write(buffer.data(), buffer.size());
 }
 
-/**
- * Helper structure that holds series of events with current index to the first unprocessed event and its timestamp.
- */
-struct SeriesWrapper
+
+void StreamingEventsWriter::insertColumn(const std::string& name, std::unique_ptr<Column> column)
 {
-	std::size_t index;
-	logtime_t time;
-	std::shared_ptr<TimeSeriesBase<>> events;
+    if (mStarted) {
+        throw std::runtime_error("Column " + name + " cannot be added after the output has started.");
+    }
+    std::size_t size = column->size();
+    if (!mColumns.emplace(name, std::move(column)).second) {
+        throw std::runtime_error("Column " + name + " is already streamed.");
+    }
+    mPending += size;
+}
+
+
+void StreamingEventsWriter::addColumn(const std::string& name, std::shared_ptr<TimeSeriesBase<>> events)
+{
+    insertColumn(name, std::make_unique<CompleteColumn>(events));
+}
 
-	SeriesWrapper(std::shared_ptr<TimeSeriesBase<>> _events)
-		: index(0), time(_events->empty() ? std::numeric_limits<logtime_t>::max() : _events->getEventTime(0)), events(_events)
-	{}
 
-	void advanceIndex()
-	{
-		++index;
-		if (index < events->size()) {
-			time = events->getEventTime(index);
-		}
-		else {
-			time = std::numeric_limits<logtime_t>::max();
-		}
-	}
+void StreamingEventsWriter::write(logtime_t limit)
+{
+    if (!mStarted) {
+        // columns are fixed from now on
+        mStarted = true;
+        std::vector<std::string> names;
+        for (auto const& it : mColumns) {
+            names.push_back(it.first);
+            mSeries.push_back(it.second.get());
+        }
+        mBuffer.reserve(64 * 1024 + 1024);
+        printEventsHeader(mBuffer, names, mDelimiter);
+    }
 
-	bool isDone() const
-	{
-        return index >= events->size();
-	}
-};
+    std::vector<const TimeSeriesBase<>*> series(mSeries.begin(), mSeries.end());
+    std::vector<std::size_t> indices(series.size(), 0);
+    printEventRows(mOutput, mBuffer, series, indices, limit, mDelimiter);
 
+    // written events are no longer needed
+    for (std::size_t s = 0; s < mSeries.size(); ++s) {
+        mPending -= indices[s];
+        mSeries[s]->discard(indices[s]);
+    }
+}
 
-bool allDone(const std::vector<SeriesWrapper>& series)
+
+void StreamingEventsWriter::writeComplete()
 {
-    for (auto& s : series) {
-        if (!s.isDone()) return false;
+    // all columns have been notified up to the watermark, so rows before the watermark are complete
+    logtime_t watermark = std::numeric_limits<logtime_t>::max();
+    for (auto const& it : mColumns) {
+        watermark = std::min(watermark, it.second->watermark());
+    }
+    if (watermark > mWritten || !mStarted) {
+        mWritten = watermark;
+        write(watermark);
     }
-    return true;
 }
 
 
-logtime_t getMinTimestamp(const std::vector<SeriesWrapper>& series)
+void StreamingEventsWriter::update()
 {
-    logtime_t t = std::numeric_limits<logtime_t>::max();
-    for (auto& s : series) {
-        t = std::min(t, s.time);
+    if (mPending < mNextWrite) {
+        return;
     }
-    return t;
+
+    writeComplete();
+
+    // wait for another batch of events (the rest is still waiting for the slowest column)
+    mNextWrite = mPending + BATCH_SIZE;
 }
 
 
-void printEvents(std::ostream& sout, const std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>& events, char delimiter)
+void StreamingEventsWriter::finish()
 {
-    // print header and prepare series wrappers
-	std::vector<SeriesWrapper> series;
-    sout << "timestamp";
+    write(std::numeric_limits<logtime_t>::max());
+    mOutput.write(mBuffer.data(), mBuffer.size());
+    mBuffer.clear();
+    mOutput.flush();
+}
+
+
+void StreamingEventsWriter::abort()
+{
+    writeComplete();
+    mOutput.write(mBuffer.data(), mBuffer.size());
+    mBuffer.clear();
+    mOutput.flush();
+}
+
+/**
+ * Add the series as a typed column if it has given value type.
+ */
+template<typename VALUE>
+static bool addTypedColumn(EventLogWriter& writer, const std::string& name, const TimeSeriesBase<>& series)
+{
+    auto typed = dynamic_cast<const TimeSeries<VALUE>*>(&series);
+    if (typed != nullptr) {
+        writer.addColumn(name, *typed);
+    }
+    return typed != nullptr;
+}
+
+
+void saveEventsBinary(std::ostream& sout, const std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>& events)
+{
+    EventLogWriter writer;
     for (auto const& it : events) {
-        sout << delimiter << it.first;
-        series.emplace_back(it.second);
-    }
-    sout << "\n";
-
-    // process the time series one timestamp at a time
-    while (!allDone(series)) {
-        logtime_t ts = getMinTimestamp(series);
-        sout << ts;
-        for (auto& s : series) {
-            sout << delimiter;
-            if (!s.isDone() && s.time == ts) {
-                sout << s.events->getEventAsString(s.index);
-                s.advanceIndex();
-            }
+        const TimeSeriesBase<>& series = *it.second;
+        bool added = addTypedColumn<bool>(writer, it.first, series)
+            || addTypedColumn<std::string>(writer, it.first, series)
+            || addTypedColumn<FunshieldSimulationController::leds_display_t::state_t>(writer, it.first, series)
+            || addTypedColumn<FunshieldSimulationController::seg_display_t::state_t>(writer, it.first, series);
+        if (!added) {
+            writer.addColumn(it.first, series);
         }
-        sout << "\n";
     }
+    writer.write(sout);
 }
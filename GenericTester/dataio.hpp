@@ -2,12 +2,16 @@
 #define MOCCARDUINO_GENERIC_TESTER_OUTPUT_HPP
 
 #include "time_series.hpp"
+#include "event_log.hpp"
+#include "mapped_file.hpp"
 #include "simulation_funshield.hpp"
 
 #include <iostream>
 #include <map>
 #include <string>
 #include <memory>
+#include <deque>
+#include <limits>
 
 /**
  * Load input text file (stream) with button events. Fill them into funshield emulator and record them in output time series.
@@ -20,6 +24,88 @@
 logtime_t loadInputData(std::istream& sin, FunshieldSimulationController& funshield,
 	std::vector<std::shared_ptr<TimeSeries<bool>>>& buttonEvents, std::shared_ptr<TimeSeries<std::string>> serialEvents);
 
+/**
+ * Load input data (the same format as above) which are already in memory (e.g., a mapped file).
+ * The data are tokenized in place, so no allocations are made except for the recorded events.
+ * All events are scheduled at once (see FunshieldInputFeed for lazy loading).
+ * @param data contents of the input file
+ * @param size length of the data in bytes
+ */
+logtime_t loadInputData(const char* data, std::size_t size, FunshieldSimulationController& funshield,
+	std::vector<std::shared_ptr<TimeSeries<bool>>>& buttonEvents, std::shared_ptr<TimeSeries<std::string>> serialEvents);
+
+/**
+ * Input file (the same format as loadInputData) which is fed into the simulation lazily (see ArduinoInputSource).
+ * The lines are parsed as the simulation time approaches their timestamps and only the next event is held in memory,
+ * so the memory does not depend on the length of the input. Timestamps are relative to the time when the feed
+ * was created.
+ */
+class FunshieldInputFeed : public ArduinoInputSource
+{
+private:
+	/**
+	 * Parsed input line (a button change or serial data).
+	 */
+	struct Event
+	{
+		logtime_t time;
+		int button; // zero-based index of the button (negative for serial data)
+		bool pressed;
+		std::string serial;
+	};
+
+	FunshieldSimulationController& mFunshield;
+	logtime_t mStartTime;
+
+	const char* mPos;
+	const char* mEnd;
+	std::size_t mLineCount;
+	logtime_t mLastTime;
+	bool mButtonStates[3];
+
+	bool mHasNext;
+	Event mNext;	///< the next event (valid if mHasNext)
+	logtime_t mEndTime;	///< duration of the emulation (valid once the whole input is read)
+
+	std::vector<EventConsumer<bool>*> mButtonRecorders;
+	EventConsumer<std::string>* mSerialRecorder;
+	logtime_t mRecordedTime;
+
+	/**
+	 * Parse the input up to the next event (skipping lines that change nothing).
+	 */
+	void readNext();
+
+public:
+	/**
+	 * @param data contents of the input file (must stay valid while the feed is used)
+	 * @param size length of the data in bytes
+	 * @param funshield simulation where the events are scheduled
+	 */
+	FunshieldInputFeed(const char* data, std::size_t size, FunshieldSimulationController& funshield);
+
+	/**
+	 * Record the changes of given button (in the time of the input file) when they are fed into the simulation.
+	 * The recorder is also notified that time advances, so it can be a streamed column.
+	 */
+	void recordButton(std::size_t button, EventConsumer<bool>& recorder);
+
+	/**
+	 * Record serial input data when they are fed into the simulation (see recordButton()).
+	 */
+	void recordSerial(EventConsumer<std::string>& recorder);
+
+	/**
+	 * Read the rest of the input (without scheduling the events) to get the duration of the emulation
+	 * as loadInputData() would. This also verifies the whole input before the simulation starts.
+	 */
+	logtime_t scanDuration() const;
+
+	logtime_t nextEventTime() const override;
+
+	void feed(logtime_t time) override;
+};
+
 /**
  * Print out formatted CSV composed of multiple time series (collecting events).
  * First col of the CSV is always the `timestamp`
@@ -29,5 +115,219 @@ logtime_t loadInputData(std::istream& sin, FunshieldSimulationController& funshi
  */
 void printEvents(std::ostream& sout, const std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>& events, char delimiter = ',');
 
+/**
+ * Save multiple time series (collecting events) as a binary event log (see EventLogWriter).
+ * Series of known types (buttons, serial, LEDs, 7-seg display) are packed, others are stored as strings.
+ * @param sout where the log is written (must be opened in binary mode)
+ * @param events map of time series, key in the map denotes name of the column
+ */
+void saveEventsBinary(std::ostream& sout, const std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>& events);
+
+
+/**
+ * Writes CSV (in the same format as printEvents) while the simulation is running. Each column buffers only events
+ * which were not written yet; a row is written once all columns have advanced past its timestamp (the time of the last
+ * event or time notification of a column is its watermark, since the column cannot receive older events).
+ * So the memory is bounded by the window between the slowest column and the current time.
+ */
+class StreamingEventsWriter
+{
+private:
+	/**
+	 * Streamed column -- a time series of the events which were not written yet.
+	 */
+	class Column : public TimeSeriesBase<>
+	{
+	public:
+		/**
+		 * Time before which the column will not receive any more events.
+		 */
+		virtual logtime_t watermark() const = 0;
+
+		/**
+		 * Remove given number of the first events (they have been written).
+		 */
+		virtual void discard(std::size_t count) = 0;
+	};
+
+	/**
+	 * Column fed by events of the simulation.
+	 */
+	template<typename VALUE>
+	class ConsumerColumn : public Column, public EventConsumer<VALUE>
+	{
+	private:
+		StreamingEventsWriter& mWriter;
+		std::deque<TimedEvent<VALUE>> mEvents;
+		logtime_t mWatermark;
+
+	protected:
+		void doAddEvent(logtime_t time, VALUE value) override
+		{
+			mEvents.emplace_back(time, value);
+			mWatermark = time;
+			++mWriter.mPending;
+			EventConsumer<VALUE>::doAddEvent(time, value);
+			mWriter.update();
+		}
+
+		void doAdvanceTime(logtime_t time) override
+		{
+			mWatermark = time;
+			EventConsumer<VALUE>::doAdvanceTime(time);
+			mWriter.update();
+		}
+
+		void doClear() override
+		{
+			throw std::runtime_error("Streamed events cannot be cleared.");
+		}
+
+	public:
+		ConsumerColumn(StreamingEventsWriter& writer) : mWriter(writer), mWatermark(0) {}
+
+		std::size_t size() const override
+		{
+			return mEvents.size();
+		}
+
+		bool empty() const override
+		{
+			return mEvents.empty();
+		}
+
+		logtime_t getEventTime(std::size_t idx) const override
+		{
+			return mEvents[idx].time;
+		}
+
+		std::string getEventAsString(std::size_t idx) const override
+		{
+			return convert(mEvents[idx].value);
+		}
+
+		void appendEventAsString(std::size_t idx, std::string& buffer) const override
+		{
+			appendConverted(mEvents[idx].value, buffer);
+		}
+
+		logtime_t watermark() const override
+		{
+			return mWatermark;
+		}
+
+		void discard(std::size_t count) override
+		{
+			mEvents.erase(mEvents.begin(), mEvents.begin() + count);
+		}
+	};
+
+	/**
+	 * Column of a series which is complete before the simulation starts (e.g., input events).
+	 */
+	class CompleteColumn : public Column
+	{
+	private:
+		std::shared_ptr<TimeSeriesBase<>> mEvents;
+		std::size_t mOffset;
+
+	public:
+		CompleteColumn(std::shared_ptr<TimeSeriesBase<>> events) : mEvents(events), mOffset(0) {}
+
+		std::size_t size() const override
+		{
+			return mEvents->size() - mOffset;
+		}
+
+		bool empty() const override
+		{
+			return size() == 0;
+		}
+
+		logtime_t getEventTime(std::size_t idx) const override
+		{
+			return mEvents->getEventTime(mOffset + idx);
+		}
+
+		std::string getEventAsString(std::size_t idx) const override
+		{
+			return mEvents->getEventAsString(mOffset + idx);
+		}
+
+		void appendEventAsString(std::size_t idx, std::string& buffer) const override
+		{
+			mEvents->appendEventAsString(mOffset + idx, buffer);
+		}
+
+		logtime_t watermark() const override
+		{
+			return std::numeric_limits<logtime_t>::max();
+		}
+
+		void discard(std::size_t count) override
+		{
+			mOffset += count;
+		}
+	};
+
+	/**
+	 * Rows are merged and written after every batch of this number of new events.
+	 */
+	static constexpr std::size_t BATCH_SIZE = 4096;
+
+	std::ostream& mOutput;
+	char mDelimiter;
+	std::map<std::string, std::unique_ptr<Column>> mColumns;
+	std::vector<Column*> mSeries;	///< columns in the order of the output (filled when the output starts)
+	std::string mBuffer;
+	std::size_t mPending;	///< number of buffered events
+	std::size_t mNextWrite;	///< rows are merged when the number of buffered events reaches this value
+	logtime_t mWritten;		///< all rows before this time were written
+	bool mStarted;			///< whether the header was written
+
+	void insertColumn(const std::string& name, std::unique_ptr<Column> column);
+	void write(logtime_t limit);
+	void writeComplete();
+	void update();
+
+public:
+	StreamingEventsWriter(std::ostream& sout, char delimiter = ',')
+		: mOutput(sout), mDelimiter(delimiter), mPending(0), mNextWrite(BATCH_SIZE), mWritten(0), mStarted(false) {}
+
+	/**
+	 * Add a column fed by simulation events (the returned consumer needs to be attached to the events source).
+	 * All columns must be added before the simulation starts.
+	 */
+	template<typename VALUE>
+	EventConsumer<VALUE>& addColumn(const std::string& name)
+	{
+		auto column = std::make_unique<ConsumerColumn<VALUE>>(*this);
+		EventConsumer<VALUE>& consumer = *column;
+		insertColumn(name, std::move(column));
+		return consumer;
+	}
+
+	/**
+	 * Add a column with events which are all known before the simulation starts.
+	 */
+	void addColumn(const std::string& name, std::shared_ptr<TimeSeriesBase<>> events);
+
+	std::size_t columns() const
+	{
+		return mColumns.size();
+	}
+
+	/**
+	 * Write all remaining rows (the simulation has ended).
+	 */
+	void finish();
+
+	/**
+	 * Write the rows which are already complete and flush the output (the simulation has failed).
+	 * Buffered events after the watermark are dropped, so the log is cut at the point of the failure.
+	 */
+	void abort();
+};
+
 
 #endif
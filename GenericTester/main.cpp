@@ -13,19 +13,30 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <cerrno>
+#endif
 
 #ifdef RECODEX
-#define CERR std::cout // only stdout is collected in ReCodEx
+#define CERR(out, err) out // only stdout is collected in ReCodEx
 constexpr int error_res = 0; // error code other than 0 prevents executing the judge
 constexpr int error_internal = 0; // error code other than 0 prevents executing the judge
-#define PRINT_ERROR_HEADER std::cout << "ERROR" << std::endl;
-#define PRINT_INTERNAL_ERROR_HEAD std::cout << "INTERNAL ERROR" << std::endl;
+#define PRINT_ERROR_HEADER(out) out << "ERROR" << std::endl;
+#define PRINT_INTERNAL_ERROR_HEAD(out) out << "INTERNAL ERROR" << std::endl;
 #else
-#define CERR std::cerr
+#define CERR(out, err) err
 constexpr int error_res = 1;
 constexpr int error_internal = 2;
-#define PRINT_ERROR_HEADER
-#define PRINT_INTERNAL_ERROR_HEAD
+#define PRINT_ERROR_HEADER(out)
+#define PRINT_INTERNAL_ERROR_HEAD(out)
 #endif
 
 
@@ -36,38 +47,43 @@ using leds_state_t = FunshieldSimulationController::leds_display_t::state_t;
 using display_state_t = FunshieldSimulationController::seg_display_t::state_t;
 using output_events_t = std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>;
 
+// statically composed smoothing pipelines (demultiplexer -> aggregator -> collected series)
+using leds_pipeline_t = EventPipeline<LedsEventsDemultiplexer<4>, LedsEventsAggregator<4>, TimeSeries<leds_state_t>>;
+using seg_pipeline_t = EventPipeline<LedsEventsDemultiplexer<32>, LedsEventsAggregator<32>, TimeSeries<display_state_t>>;
+
+// the same pipelines for the streaming mode (the last stage only passes the events to the attached stream column)
+using leds_stream_pipeline_t = EventPipeline<LedsEventsDemultiplexer<4>, LedsEventsAggregator<4>, EventConsumer<leds_state_t>>;
+using seg_stream_pipeline_t = EventPipeline<LedsEventsDemultiplexer<32>, LedsEventsAggregator<32>, EventConsumer<display_state_t>>;
+
 
 /**
- * Load button events from input file (or stdin), feed them to funshield, and prepare output events series for logging.
+ * Open input file (or stdin) with button events and prepare their feed into funshield (the events are read lazily
+ * while the simulation is running).
+ * @param inputFile path to the input file ("-" for stdin, empty if no input file is given)
+ * @param input holds the contents of the input file (must outlive the feed)
+ * @param inputFeed the created feed (remains null if no input file is given)
+ * @return duration of the simulation
  */
-logtime_t processInput(bpp::ProgramArguments &args, FunshieldSimulationController &funshield, output_events_t &outputEvents)
+logtime_t processInput(bpp::ProgramArguments &args, const std::string &inputFile, FunshieldSimulationController &funshield,
+    MappedFile &input, std::unique_ptr<FunshieldInputFeed> &inputFeed)
 {
-    std::vector<std::shared_ptr<TimeSeries<bool>>> buttonEvents;
-    if (args.getArgBool("log-buttons").getValue()) {
-        buttonEvents.emplace_back(std::make_shared<TimeSeries<bool>>());
-        buttonEvents.emplace_back(std::make_shared<TimeSeries<bool>>());
-        buttonEvents.emplace_back(std::make_shared<TimeSeries<bool>>());
-    }
-    std::shared_ptr<TimeSeries<std::string>> serialEvents;
-    if (args.getArgBool("log-serial").getValue()) {
-        serialEvents = std::make_shared<TimeSeries<std::string>>();
-    }
-
     logtime_t simulationTime = 0;
 
-    if (args.namelessCount() > 0) {
-        if (args[0] != "-") {
-            // load events from a file
-            std::ifstream sin(args[0], std::ios::binary);
-            if (!sin.is_open()) {
-                throw std::runtime_error("Failed to open input file " + args[0]);
+    if (!inputFile.empty()) {
+        if (inputFile != "-") {
+            // load events from a file (mapped into memory)
+            if (!input.open(inputFile)) {
+                throw std::runtime_error("Failed to open input file " + inputFile);
             }
-            simulationTime = loadInputData(sin, funshield, buttonEvents, serialEvents);
         }
         else {
             // load events from stdin
-            simulationTime = loadInputData(std::cin, funshield, buttonEvents, serialEvents);
+            if (!input.read(std::cin)) {
+                throw std::runtime_error("Failed to read input data.");
+            }
         }
+        inputFeed = std::make_unique<FunshieldInputFeed>(input.data(), input.size(), funshield);
+        simulationTime = inputFeed->scanDuration(); // the whole input is verified before the simulation starts
     }
     else {
         if (!args.getArgInt("simulation-length").isPresent()) {
@@ -79,74 +95,117 @@ logtime_t processInput(bpp::ProgramArguments &args, FunshieldSimulationControlle
         // possibly override simulation time
         simulationTime = (logtime_t)args.getArgInt("simulation-length").getValue() * 1000;
     }
-    
-    if (args.getArgBool("log-buttons").getValue()) {
-        outputEvents["b1"] = buttonEvents[0];
-        outputEvents["b2"] = buttonEvents[1];
-        outputEvents["b3"] = buttonEvents[2];
-    }
-
-    if (args.getArgBool("log-serial").getValue()) {
-        outputEvents["serial"] = serialEvents;
-    }
 
     return simulationTime;
 }
 
 
 /**
- * Merge all output series together and format them in CSV.
+ * Prepare logging of one input column -- the events are recorded by the input feed (if there is any)
+ * either into a streamed column or into a series which is printed after the simulation.
  */
-void processOutput(bpp::ProgramArguments& args, output_events_t& outputEvents)
+template<typename VALUE, typename RECORD>
+void recordInputColumn(const std::string &name, FunshieldInputFeed *inputFeed, StreamingEventsWriter *stream,
+    output_events_t &outputEvents, RECORD record)
 {
-    if (args.getArgString("save").isPresent()) {
-        std::ofstream sout(args.getArgString("save").getValue(), std::ios::binary);
-        printEvents(sout, outputEvents);
+    if (stream && inputFeed) {
+        record(stream->addColumn<VALUE>(name));
+        return;
+    }
+
+    auto events = std::make_shared<TimeSeries<VALUE>>();
+    if (inputFeed) {
+        record(*events);
+    }
+    if (stream) {
+        stream->addColumn(name, events); // there is no input, so the column remains empty
     }
     else {
-        printEvents(std::cout, outputEvents);
+        outputEvents[name] = events;
     }
 }
 
-int main(int argc, char* argv[])
+
+/**
+ * Prepare logging of the input events (buttons and serial data) selected by the arguments.
+ */
+void recordInput(bpp::ProgramArguments &args, FunshieldInputFeed *inputFeed, StreamingEventsWriter *stream, output_events_t &outputEvents)
 {
-    bpp::ProgramArguments args(0, 1);
-    args.setNamelessCaption(0, "Input file with button events.");
+    if (args.getArgBool("log-buttons").getValue()) {
+        for (std::size_t button = 0; button < 3; ++button) {
+            recordInputColumn<bool>("b" + std::to_string(button + 1), inputFeed, stream, outputEvents,
+                [&](EventConsumer<bool> &recorder) { inputFeed->recordButton(button, recorder); });
+        }
+    }
 
-    try {
-        args.registerArg<bpp::ProgramArguments::ArgString>("save", "Path to a file to which the simulation log (as CSV) is saved (stdout is used, if no file is given).", false);
+    if (args.getArgBool("log-serial").getValue()) {
+        recordInputColumn<std::string>("serial", inputFeed, stream, outputEvents,
+            [&](EventConsumer<std::string> &recorder) { inputFeed->recordSerial(recorder); });
+    }
+}
 
-        args.registerArg<bpp::ProgramArguments::ArgInt>("simulation-length", "Length of the simulation in ms (overrides value from input file, required if no input file is provided).", false, 0, 0);
-        args.registerArg<bpp::ProgramArguments::ArgInt>("loop-delay", "Delay between two loop invocations [us].", false, 100, 1);
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-buttons", "Add button events into output log.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-serial", "Add serial-link input events into output log.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-leds", "Add LED events into output log.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("log-7seg", "Add events of the 7-segment display into output log.");
 
-        args.registerArg<bpp::ProgramArguments::ArgBool>("raw-leds", "Deactivate LEDs event smoothing by demultiplexer and aggregator.");
-        args.registerArg<bpp::ProgramArguments::ArgInt>("leds-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 10, 0);
-        args.registerArg<bpp::ProgramArguments::ArgInt>("leds-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 50, 0);
+/**
+ * Write the rows which were completed before the simulation failed into the streamed log (if streaming).
+ * The error itself is reported the same way as without streaming.
+ */
+void abortStream(StreamingEventsWriter* stream)
+{
+    if (stream == nullptr) return;
+    try {
+        stream->abort();
+    }
+    catch (std::exception&) {
+        // the original error is more important (and it is reported by the caller)
+    }
+}
 
-        args.registerArg<bpp::ProgramArguments::ArgBool>("raw-7seg", "Deactivate 7-seg display event smoothing by demultiplexer and aggregator.");
-        args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 15, 0);
-        args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 30, 0);
 
-        args.registerArg<bpp::ProgramArguments::ArgBool>("enable-delay", "If set, builtin functions delay() and delayMicroseconds() are enabled.");
-        args.registerArg<bpp::ProgramArguments::ArgBool>("one-latch-loop", "Limit only one 7seg latch activation in each loop.");
+/**
+ * Merge all output series together and format them in CSV (or save them as a binary event log).
+ * @param outputFile path where the log is saved (if empty, the log is printed to out)
+ */
+void processOutput(bpp::ProgramArguments& args, const std::string& outputFile, std::ostream& out, output_events_t& outputEvents)
+{
+    bool binary = args.getArgEnum("format").is("binary");
+    std::ofstream fout;
+    if (!outputFile.empty()) {
+        fout.open(outputFile, std::ios::binary);
+    }
+    std::ostream& sout = outputFile.empty() ? out : fout;
 
-        // Process the arguments ...
-        args.process(argc, argv);
+    if (binary) {
+        saveEventsBinary(sout, outputEvents);
     }
-    catch (bpp::ArgumentException& e) {
-        std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
-        args.printUsage(std::cout);
-        return 100;
+    else {
+        printEvents(sout, outputEvents);
     }
+}
+
 
+/**
+ * Run one complete simulation of the tested program.
+ * @param emulator a fresh emulator instance used for this simulation
+ * @param inputFile path to the input file ("-" for stdin, empty if no input file is given)
+ * @param outputFile path where the CSV log is saved (if empty, the log is printed to out)
+ * @param out stream that replaces stdout
+ * @param err stream that replaces stderr
+ * @param isolated whether a private copy of the tested program should be loaded
+ *                 (required when more simulations run concurrently in one process)
+ * @param pristine if not null, the simulation (with the tested program already loaded) is restored to this state
+ *                 before it starts, so the loaded program may be reused by consecutive simulations
+ * @return exit code of the simulation
+ */
+int runSimulation(bpp::ProgramArguments& args, ArduinoEmulator& emulator, const std::string& inputFile, const std::string& outputFile,
+    std::ostream& out, std::ostream& err, bool isolated = false, const ArduinoSimulationController::Snapshot* pristine = nullptr)
+{
     output_events_t outputEvents;
 
     // initialize simulation
-    ArduinoSimulationController arduino(get_arduino_emulator_instance());
+    ArduinoSimulationController arduino(emulator);
+    if (pristine != nullptr) {
+        arduino.restoreSnapshot(*pristine); // no pins are registered yet (as when the snapshot was taken)
+    }
     FunshieldSimulationController funshield(arduino);
 
     if (!args.getArgBool("enable-delay").getValue()) {
@@ -154,47 +213,101 @@ int main(int argc, char* argv[])
         arduino.disableMethod("delayMicroseconds");
     }
 
+    if (args.getArgBool("fast-forward").getValue()) {
+        arduino.setFastForward();
+    }
+
+    // in the streaming mode, the log is written while the simulation is running (errors cut the log, see abortStream)
+    std::ofstream streamFile;
+    std::unique_ptr<StreamingEventsWriter> stream;
+
     try {
-        logtime_t simulationTime = processInput(args, funshield, outputEvents);
+        MappedFile input;
+        std::unique_ptr<FunshieldInputFeed> inputFeed;
+        logtime_t simulationTime = processInput(args, inputFile, funshield, input, inputFeed);
+
+        std::vector<std::shared_ptr<void>> streamPipelines; // keeps the pipelines alive
+        if (args.getArgBool("stream").getValue()) {
+            if (args.getArgEnum("format").is("binary")) {
+                throw std::runtime_error("Only the CSV log can be streamed.");
+            }
+            if (!outputFile.empty()) {
+                streamFile.open(outputFile, std::ios::binary);
+            }
+            stream = std::make_unique<StreamingEventsWriter>(outputFile.empty() ? out : streamFile);
+        }
+
+        recordInput(args, inputFeed.get(), stream.get(), outputEvents);
+        if (inputFeed) {
+            arduino.attachInputSource(*inputFeed);
+        }
 
         // LEDs
-        LedsEventsDemultiplexer<4> ledDemuxer(args.getArgInt("leds-demuxer-window").getValue() * 1000);
-        LedsEventsAggregator<4> ledAggregator(args.getArgInt("leds-aggregator-window").getValue() * 1000);
-        auto ledEvents = std::make_shared<TimeSeries<leds_state_t>>();
+        auto ledPipeline = std::make_shared<leds_pipeline_t>(
+            std::make_tuple(args.getArgInt("leds-demuxer-window").getValue() * 1000),
+            std::make_tuple(args.getArgInt("leds-aggregator-window").getValue() * 1000),
+            std::make_tuple());
         if (args.getArgBool("log-leds").getValue()) {
-            if (args.getArgBool("raw-leds").getValue()) {
+            if (stream && args.getArgBool("raw-leds").getValue()) {
+                funshield.getLeds().attachSproutConsumer(stream->addColumn<leds_state_t>("leds"));
+            }
+            else if (stream) {
+                auto streamPipeline = std::make_shared<leds_stream_pipeline_t>(
+                    std::make_tuple(args.getArgInt("leds-demuxer-window").getValue() * 1000),
+                    std::make_tuple(args.getArgInt("leds-aggregator-window").getValue() * 1000),
+                    std::make_tuple());
+                streamPipeline->tail().attachNextConsumer(stream->addColumn<leds_state_t>("leds"));
+                funshield.getLeds().attachSproutConsumer(streamPipeline->head());
+                streamPipelines.push_back(streamPipeline);
+            }
+            else if (args.getArgBool("raw-leds").getValue()) {
                 // collecting raw LED events
+                auto ledEvents = std::make_shared<TimeSeries<leds_state_t>>();
                 funshield.getLeds().attachSproutConsumer(*ledEvents);
+                outputEvents["leds"] = ledEvents;
             }
             else {
-                // LED events smoothing using demuxer and aggregator
-                funshield.getLeds().attachSproutConsumer(ledDemuxer);
-                ledDemuxer.attachNextConsumer(ledAggregator);
-                ledAggregator.attachNextConsumer(*ledEvents);
+                // LED events smoothing using demuxer and aggregator (the result is collected by the last stage)
+                funshield.getLeds().attachSproutConsumer(ledPipeline->head());
+                outputEvents["leds"] = std::shared_ptr<TimeSeriesBase<>>(ledPipeline, &ledPipeline->tail());
             }
-            outputEvents["leds"] = ledEvents;
         }
 
         // 7-seg display
-        LedsEventsDemultiplexer<32> segDemuxer(args.getArgInt("7seg-demuxer-window").getValue() * 1000);
-        LedsEventsAggregator<32> segAggregator(args.getArgInt("7seg-aggregator-window").getValue() * 1000);
-        auto segEvents = std::make_shared<TimeSeries<display_state_t>>();
+        auto segPipeline = std::make_shared<seg_pipeline_t>(
+            std::make_tuple(args.getArgInt("7seg-demuxer-window").getValue() * 1000),
+            std::make_tuple(args.getArgInt("7seg-aggregator-window").getValue() * 1000),
+            std::make_tuple());
         if (args.getArgBool("log-7seg").getValue()) {
-            if (args.getArgBool("raw-7seg").getValue()) {
+            if (stream && args.getArgBool("raw-7seg").getValue()) {
+                funshield.getSegDisplay().attachSproutConsumer(stream->addColumn<display_state_t>("7seg"));
+            }
+            else if (stream) {
+                auto streamPipeline = std::make_shared<seg_stream_pipeline_t>(
+                    std::make_tuple(args.getArgInt("7seg-demuxer-window").getValue() * 1000),
+                    std::make_tuple(args.getArgInt("7seg-aggregator-window").getValue() * 1000),
+                    std::make_tuple());
+                streamPipeline->tail().attachNextConsumer(stream->addColumn<display_state_t>("7seg"));
+                funshield.getSegDisplay().attachSproutConsumer(streamPipeline->head());
+                streamPipelines.push_back(streamPipeline);
+            }
+            else if (args.getArgBool("raw-7seg").getValue()) {
                 // collecting raw LED events
+                auto segEvents = std::make_shared<TimeSeries<display_state_t>>();
                 funshield.getSegDisplay().attachSproutConsumer(*segEvents);
+                outputEvents["7seg"] = segEvents;
             }
             else {
-                // LED events smoothing using demuxer and aggregator
-                funshield.getSegDisplay().attachSproutConsumer(segDemuxer);
-                segDemuxer.attachNextConsumer(segAggregator);
-                segAggregator.attachNextConsumer(*segEvents);
+                // LED events smoothing using demuxer and aggregator (the result is collected by the last stage)
+                funshield.getSegDisplay().attachSproutConsumer(segPipeline->head());
+                outputEvents["7seg"] = std::shared_ptr<TimeSeriesBase<>>(segPipeline, &segPipeline->tail());
             }
-            outputEvents["7seg"] = segEvents;
         }
 
         // run simulation
-        arduino.loadTestedCode(ARDUINO_PROGRAM);
+        if (!arduino.isTestedCodeLoaded()) { // the server mode preloads the code
+            arduino.loadTestedCode(ARDUINO_PROGRAM, isolated);
+        }
         arduino.runSetup();
 
         // This analysis is performed to ensure that in one loop is only one display change (latch activation)
@@ -228,29 +341,347 @@ int main(int argc, char* argv[])
         );
 
         if (args.getArgBool("one-latch-loop").getValue() && violatedLoopsCount > 0) {
-            PRINT_ERROR_HEADER
-            CERR << "The single-latch-activation rule was violated in " << violatedLoopsCount << " loop() invocations." << std::endl;
+            abortStream(stream.get());
+            PRINT_ERROR_HEADER(out)
+            CERR(out, err) << "The single-latch-activation rule was violated in " << violatedLoopsCount << " loop() invocations." << std::endl;
             return error_res;
         }
 
         // make sure 
-        if (outputEvents.empty()) {
-            std::cout << "Simulation ended successfully, but no event logging was selected." << std::endl;
+        if (stream && stream->columns() > 0) {
+            stream->finish();
+        }
+        else if (stream || outputEvents.empty()) {
+            out << "Simulation ended successfully, but no event logging was selected." << std::endl;
         }
         else {
-            processOutput(args, outputEvents);
+            processOutput(args, outputFile, out, outputEvents);
         }
     }
     catch (ArduinoEmulatorException& e) {
-        PRINT_ERROR_HEADER
-        CERR << "Arduino Emulator Exception: " << e.what() << std::endl;
+        abortStream(stream.get());
+        PRINT_ERROR_HEADER(out)
+        CERR(out, err) << "Arduino Emulator Exception: " << e.what() << std::endl;
         return error_res;
     }
     catch (std::exception& e) {
-        PRINT_INTERNAL_ERROR_HEAD
-        CERR << "Exception: " << e.what() << std::endl;
+        abortStream(stream.get());
+        PRINT_INTERNAL_ERROR_HEAD(out)
+        CERR(out, err) << "Exception: " << e.what() << std::endl;
         return error_internal;
     }
 
     return 0;
 }
+
+
+/**
+ * Register all command line arguments of the tester.
+ */
+void registerArguments(bpp::ProgramArguments& args)
+{
+    args.registerArg<bpp::ProgramArguments::ArgString>("save", "Path to a file to which the simulation log (as CSV) is saved (stdout is used, if no file is given).", false);
+    args.registerArg<bpp::ProgramArguments::ArgEnum>("format", "Format of the simulation log (csv or binary event log).", false, false, "csv");
+    args.getArgEnum("format").addOptions({ "csv", "binary" });
+
+    args.registerArg<bpp::ProgramArguments::ArgInt>("simulation-length", "Length of the simulation in ms (overrides value from input file, required if no input file is provided).", false, 0, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("loop-delay", "Delay between two loop invocations [us].", false, 100, 1);
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-buttons", "Add button events into output log.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-serial", "Add serial-link input events into output log.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-leds", "Add LED events into output log.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("log-7seg", "Add events of the 7-segment display into output log.");
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("raw-leds", "Deactivate LEDs event smoothing by demultiplexer and aggregator.");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("leds-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 10, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("leds-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 50, 0);
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("raw-7seg", "Deactivate 7-seg display event smoothing by demultiplexer and aggregator.");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-demuxer-window", "Size of the LEDs demultiplexing window [ms].", false, 15, 0);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("7seg-aggregator-window", "Size of the LEDs demultiplexing window [ms].", false, 30, 0);
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("stream", "Write the CSV log while the simulation is running (only a small window of events is kept in memory).");
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("enable-delay", "If set, builtin functions delay() and delayMicroseconds() are enabled.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("one-latch-loop", "Limit only one 7seg latch activation in each loop.");
+    args.registerArg<bpp::ProgramArguments::ArgBool>("fast-forward", "Skip idle loop() invocations (no writes, no serial I/O) up to the next input event.");
+
+    args.registerArg<bpp::ProgramArguments::ArgString>("batch", "Path to a file with a list of simulations (one 'input output' pair of paths per line) which are executed concurrently.", false);
+    args.registerArg<bpp::ProgramArguments::ArgInt>("jobs", "Number of worker threads for the batch mode (0 = number of CPU cores).", false, 0, 0);
+    args.getArgString("batch").conflictsWith("save");
+
+    args.registerArg<bpp::ProgramArguments::ArgBool>("server", "Preload the tested program once and run simulations (read from stdin, one per line) in forked processes.");
+    args.registerArg<bpp::ProgramArguments::ArgInt>("job-timeout", "Time limit of one simulation in the server mode [s] (jobs are executed one by one, so the limit cannot be turned off).", false, 10, 1);
+    args.getArgBool("server").conflictsWith("save");
+    args.getArgBool("server").conflictsWith("batch");
+}
+
+
+/**
+ * One simulation of the batch (input and output paths with captured results).
+ */
+struct BatchJob
+{
+    std::string inputFile;
+    std::string outputFile;
+    std::ostringstream out;
+    std::ostringstream err;
+    int exitCode = 0;
+};
+
+
+/**
+ * Load batch jobs from a list file. Each non-empty line holds an input file path and an output file path separated by whitespace.
+ */
+std::vector<std::unique_ptr<BatchJob>> loadBatchJobs(const std::string& listFile)
+{
+    std::ifstream sin(listFile);
+    if (!sin.is_open()) {
+        throw std::runtime_error("Failed to open batch list file " + listFile);
+    }
+
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+    std::string line;
+    std::size_t lineNumber = 0;
+    while (std::getline(sin, line)) {
+        ++lineNumber;
+        std::istringstream sline(line);
+        std::string inputFile, outputFile, rest;
+        if (!(sline >> inputFile)) {
+            continue; // empty line
+        }
+        if (!(sline >> outputFile) || (sline >> rest)) {
+            throw std::runtime_error("Batch list file " + listFile + " line " + std::to_string(lineNumber) + ": input and output paths expected.");
+        }
+        jobs.emplace_back(std::make_unique<BatchJob>());
+        jobs.back()->inputFile = inputFile;
+        jobs.back()->outputFile = outputFile;
+    }
+    return jobs;
+}
+
+
+/**
+ * Run all simulations from the batch list on a fixed pool of worker threads. Each worker has its own emulator
+ * and loads its private copy of the tested program only once. The global variables of the program are saved right
+ * after the program is loaded and restored before every simulation, so the results are the same as if
+ * the simulations were executed one by one (as long as the program does not keep state in dynamically allocated memory).
+ * Captured outputs are relayed (in the order of the list) once all simulations are completed.
+ * @return the highest exit code of all simulations
+ */
+int runBatch(bpp::ProgramArguments& args)
+{
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+    try {
+        jobs = loadBatchJobs(args.getArgString("batch").getValue());
+    }
+    catch (std::exception& e) {
+        PRINT_INTERNAL_ERROR_HEAD(std::cout)
+        CERR(std::cout, std::cerr) << "Exception: " << e.what() << std::endl;
+        return error_internal;
+    }
+
+    std::size_t workersCount = (std::size_t)args.getArgInt("jobs").getValue();
+    if (workersCount == 0) {
+        workersCount = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    workersCount = std::min(workersCount, jobs.size());
+
+    std::atomic<std::size_t> nextJob(0);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < workersCount; ++i) {
+        workers.emplace_back([&]()
+            {
+                auto emulator = std::make_unique<ArduinoEmulator>();
+                std::unique_ptr<ArduinoSimulationController::Snapshot> pristine;
+                for (std::size_t idx = nextJob++; idx < jobs.size(); idx = nextJob++) {
+                    if (!pristine) {
+                        try {
+                            ArduinoSimulationController preloader(*emulator);
+                            preloader.loadTestedCode(ARDUINO_PROGRAM, true);
+                            pristine = std::make_unique<ArduinoSimulationController::Snapshot>(preloader.createSnapshot());
+                        }
+                        catch (std::exception&) {
+                            // the simulation tries to load the program again and reports the error
+                        }
+                    }
+
+                    auto& job = *jobs[idx];
+                    job.exitCode = runSimulation(args, *emulator, job.inputFile, job.outputFile, job.out, job.err, true, pristine.get());
+                }
+            }
+        );
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    int exitCode = 0;
+    for (auto& job : jobs) {
+        std::cout << job->out.str();
+        std::cerr << job->err.str();
+        std::cerr << "[" << job->exitCode << "] " << job->inputFile << " -> " << job->outputFile << std::endl;
+        exitCode = std::max(exitCode, job->exitCode);
+    }
+    return exitCode;
+}
+
+
+#ifdef __linux__
+
+/**
+ * Executed in a forked process of the server. Parses the job arguments and runs the simulation (output goes to stdout).
+ * @param job tokens of the job line (input path, output path, and the arguments of the simulation)
+ */
+int runServerJob(ArduinoEmulator& emulator, const std::vector<std::string>& job)
+{
+    std::vector<const char*> argv;
+    argv.push_back("generic_tester");
+    for (std::size_t i = 2; i < job.size(); ++i) {
+        argv.push_back(job[i].c_str());
+    }
+    argv.push_back(job[0].c_str());
+
+    bpp::ProgramArguments args(0, 1);
+    try {
+        registerArguments(args);
+        args.process((int)argv.size(), argv.data());
+        if (args.getArgString("save").isPresent() || args.getArgString("batch").isPresent() || args.getArgBool("server").getValue()) {
+            throw bpp::ArgumentException("Arguments save, batch, and server are not allowed in server jobs.");
+        }
+    }
+    catch (bpp::ArgumentException& e) {
+        std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
+        args.printUsage(std::cout);
+        return 100;
+    }
+
+    return runSimulation(args, emulator, job[0], std::string(), std::cout, std::cerr);
+}
+
+
+/**
+ * Server mode. The tested program is loaded (and its globals initialized) only once, then the jobs are read from stdin.
+ * Each job is a line with an input path, an output path, and the arguments of the simulation. The job is executed
+ * in a forked (copy-on-write) process, so it starts from a pristine state and its crash (or time limit) does not affect
+ * other jobs. The exit code of each job (128 + signal number if it was killed) is written to stdout on a separate line.
+ */
+int runServer(bpp::ProgramArguments& args)
+{
+    ArduinoEmulator& emulator = get_arduino_emulator_instance();
+    try {
+        ArduinoSimulationController preloader(emulator);
+        preloader.loadTestedCode(ARDUINO_PROGRAM);
+    }
+    catch (std::exception& e) {
+        PRINT_INTERNAL_ERROR_HEAD(std::cout)
+        CERR(std::cout, std::cerr) << "Exception: " << e.what() << std::endl;
+        return error_internal;
+    }
+
+    unsigned timeout = (unsigned)args.getArgInt("job-timeout").getValue();
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream sline(line);
+        std::vector<std::string> job;
+        std::string token;
+        while (sline >> token) {
+            job.push_back(token);
+        }
+
+        if (job.empty()) {
+            continue;
+        }
+        if (job.size() < 2) {
+            std::cerr << "Server job must have an input and an output path: " << line << std::endl;
+            std::cout << 100 << std::endl;
+            continue;
+        }
+        if (job[0] == "-") {
+            std::cerr << "Server job must not read its input from stdin (it holds the jobs): " << line << std::endl;
+            std::cout << 100 << std::endl;
+            continue;
+        }
+
+        std::cout.flush(); // the child would inherit the buffers
+        std::cerr.flush();
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "Unable to fork the simulation process." << std::endl;
+            std::cout << error_internal << std::endl;
+            continue;
+        }
+
+        if (pid == 0) {
+            int fd = open(job[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            int nullFd = open("/dev/null", O_RDONLY); // jobs must not consume other jobs from stdin
+            if (fd < 0 || nullFd < 0 || dup2(fd, STDOUT_FILENO) < 0 || dup2(nullFd, STDIN_FILENO) < 0) {
+                std::cerr << "Unable to open output file " << job[1] << std::endl;
+                _exit(error_internal);
+            }
+            close(fd);
+            close(nullFd);
+
+            alarm(timeout); // SIGALRM terminates the process (an infinite loop must not block the following jobs)
+            int res = runServerJob(emulator, job);
+            std::cout.flush();
+            std::exit(res);
+        }
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+        std::cout << (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)) << std::endl;
+    }
+
+    return 0;
+}
+
+#else
+
+int runServer(bpp::ProgramArguments& args)
+{
+    std::cerr << "The server mode is not supported on this platform." << std::endl;
+    return error_internal;
+}
+
+#endif
+
+
+int main(int argc, char* argv[])
+{
+    bpp::ProgramArguments args(0, 1);
+    args.setNamelessCaption(0, "Input file with button events.");
+
+    try {
+        registerArguments(args);
+
+        // Process the arguments ...
+        args.process(argc, argv);
+
+        if ((args.getArgString("batch").isPresent() || args.getArgBool("server").getValue()) && args.namelessCount() > 0) {
+            throw bpp::ArgumentException("Input file must not be given in the batch or server mode.");
+        }
+#ifdef RECODEX
+        if (args.getArgBool("stream").getValue()) {
+            // the judge expects errors to be announced on the first line, but streamed rows are written before the error is known
+            throw bpp::ArgumentException("The log cannot be streamed in ReCodEx.");
+        }
+#endif
+    }
+    catch (bpp::ArgumentException& e) {
+        std::cout << "Invalid arguments: " << e.what() << std::endl << std::endl;
+        args.printUsage(std::cout);
+        return 100;
+    }
+
+    if (args.getArgString("batch").isPresent()) {
+        return runBatch(args);
+    }
+
+    if (args.getArgBool("server").getValue()) {
+        return runServer(args);
+    }
+
+    std::string inputFile = args.namelessCount() > 0 ? args[0] : std::string();
+    std::string outputFile = args.getArgString("save").isPresent() ? args.getArgString("save").getValue() : std::string();
+    return runSimulation(args, get_arduino_emulator_instance(), inputFile, outputFile, std::cout, std::cerr);
+}
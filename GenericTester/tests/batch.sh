@@ -0,0 +1,59 @@
+#!/bin/bash
+# Checks that simulations executed in the batch mode produce the same logs and exit codes as separate invocations.
+# Usage: tests/batch.sh [tester arguments] (run after make, the tester and the tested program must be built)
+
+cd "$(dirname "$0")/.." || exit 1
+ARGS=("$@")
+if [ ${#ARGS[@]} -eq 0 ]; then
+	ARGS=(--log-buttons --log-serial --log-leds --log-7seg)
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# valid inputs, an input with events out of order, and a missing input
+cp data/test1.in "$TMP/valid1.in"
+sed 's/^\([0-9]*\)00000 /\100001 /' data/test1.in > "$TMP/valid2.in"
+printf '2000 1 d\n1000 1 u\n' > "$TMP/invalid.in"
+INPUTS=("$TMP/valid1.in" "$TMP/valid2.in" "$TMP/invalid.in" "$TMP/missing.in" "$TMP/valid1.in")
+
+for i in "${!INPUTS[@]}"; do
+	echo "${INPUTS[$i]} $TMP/batch$i.csv" >> "$TMP/batch.lst"
+	./generic_tester "${ARGS[@]}" --save "$TMP/single$i.csv" "${INPUTS[$i]}" > /dev/null 2>&1
+	echo $? > "$TMP/single$i.code"
+done
+
+FAILED=0
+# one worker reuses its loaded program for all jobs, more workers run the jobs concurrently
+for WORKERS in 1 3; do
+	rm -f "$TMP"/batch*.csv
+	./generic_tester "${ARGS[@]}" --batch "$TMP/batch.lst" --jobs $WORKERS > /dev/null 2> "$TMP/batch.err"
+	BATCH_CODE=$?
+
+	MAX_CODE=0
+	for i in "${!INPUTS[@]}"; do
+		CODE=$(cat "$TMP/single$i.code")
+		BATCH_JOB_CODE=$(grep -F "] ${INPUTS[$i]} -> $TMP/batch$i.csv" "$TMP/batch.err" | sed 's/^\[\([0-9]*\)\].*$/\1/')
+		if [ "$CODE" != "$BATCH_JOB_CODE" ]; then
+			echo "Job $i (${INPUTS[$i]}, $WORKERS workers): exit code $BATCH_JOB_CODE in the batch, but $CODE when executed separately."
+			FAILED=1
+		fi
+		if [ -f "$TMP/single$i.csv" ] || [ -f "$TMP/batch$i.csv" ]; then
+			if ! cmp -s "$TMP/single$i.csv" "$TMP/batch$i.csv"; then
+				echo "Job $i (${INPUTS[$i]}, $WORKERS workers): the batch log differs from the log of a separate invocation."
+				FAILED=1
+			fi
+		fi
+		MAX_CODE=$(( CODE > MAX_CODE ? CODE : MAX_CODE ))
+	done
+
+	if [ "$BATCH_CODE" != "$MAX_CODE" ]; then
+		echo "Batch exit code $BATCH_CODE ($WORKERS workers), the highest exit code of separate invocations is $MAX_CODE."
+		FAILED=1
+	fi
+done
+
+if [ $FAILED -eq 0 ]; then
+	echo "Batch mode check passed (${#INPUTS[@]} jobs)."
+fi
+exit $FAILED
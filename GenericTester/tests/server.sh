@@ -0,0 +1,46 @@
+#!/bin/bash
+# Smoke test of the server mode -- runs a regular job, a job that exceeds the time limit, and an invalid job
+# (and checks that the time limit cannot be turned off).
+# Usage: tests/server.sh (run after make, the tester and the tested program must be built)
+
+cd "$(dirname "$0")/.." || exit 1
+ARGS=(--log-buttons --log-serial --log-leds --log-7seg)
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+./generic_tester "${ARGS[@]}" --save "$TMP/expected.csv" data/test1.in > /dev/null 2>&1
+
+# the second job simulates days, so it is killed by the timeout (SIGALRM)
+{
+	echo "data/test1.in $TMP/job1.csv ${ARGS[*]}"
+	echo "data/test1.in $TMP/job2.csv ${ARGS[*]} --simulation-length 1000000000"
+	echo "- $TMP/job3.csv ${ARGS[*]}"
+	echo "data/test1.in $TMP/job4.csv ${ARGS[*]}"
+} | ./generic_tester --server --job-timeout 1 > "$TMP/codes" 2> /dev/null
+SERVER_CODE=$?
+
+FAILED=0
+if ./generic_tester --server --job-timeout 0 < /dev/null > /dev/null 2>&1; then
+	echo "Server without a job time limit was started."
+	FAILED=1
+fi
+if [ "$SERVER_CODE" != "0" ]; then
+	echo "Server exited with code $SERVER_CODE."
+	FAILED=1
+fi
+if [ "$(cat "$TMP/codes" | tr '\n' ' ')" != "0 142 100 0 " ]; then
+	echo "Unexpected exit codes of the jobs: $(cat "$TMP/codes" | tr '\n' ' ')(expected 0 142 100 0)."
+	FAILED=1
+fi
+for i in 1 4; do
+	if ! cmp -s "$TMP/expected.csv" "$TMP/job$i.csv"; then
+		echo "Log of server job $i differs from the log of a separate invocation."
+		FAILED=1
+	fi
+done
+
+if [ $FAILED -eq 0 ]; then
+	echo "Server mode check passed."
+fi
+exit $FAILED
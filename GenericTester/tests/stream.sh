@@ -0,0 +1,52 @@
+#!/bin/bash
+# Checks that a failed simulation in the streaming mode keeps the rows completed before the failure
+# (the single-latch rule is checked after the simulation, so the whole log has been streamed by then).
+# Usage: tests/stream.sh (run after make, the tester and the tested program must be built)
+
+cd "$(dirname "$0")/.." || exit 1
+ARGS=(--log-buttons --log-leds --log-7seg --raw-7seg --stream --simulation-length 3000)
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# the tested program activates the latch four times per loop while the digits are shown (toggled by button 2)
+printf '1000 2 d\n2000 2 u\n' > "$TMP/digits.in"
+
+./generic_tester "${ARGS[@]}" --save "$TMP/passed.csv" "$TMP/digits.in" > /dev/null 2>&1
+./generic_tester "${ARGS[@]}" --one-latch-loop --save "$TMP/failed.csv" "$TMP/digits.in" > "$TMP/failed.out" 2> "$TMP/failed.err"
+SAVE_CODE=$?
+./generic_tester "${ARGS[@]}" --one-latch-loop "$TMP/digits.in" > "$TMP/stdout.csv" 2> /dev/null
+STDOUT_CODE=$?
+
+FAILED=0
+if [ "$SAVE_CODE" != "1" ] || [ "$STDOUT_CODE" != "1" ]; then
+	echo "Failed streamed simulations exited with codes $SAVE_CODE (--save) and $STDOUT_CODE (stdout), expected 1."
+	FAILED=1
+fi
+if ! grep -q "single-latch-activation" "$TMP/failed.err" || [ -s "$TMP/failed.out" ]; then
+	echo "The error of a streamed simulation is not reported on stderr."
+	FAILED=1
+fi
+
+PASSED_ROWS=$(wc -l < "$TMP/passed.csv")
+FAILED_ROWS=$(wc -l < "$TMP/failed.csv")
+if [ "$PASSED_ROWS" -lt 1000 ]; then
+	echo "The streamed log has only $PASSED_ROWS rows, it does not span multiple batches."
+	FAILED=1
+elif [ $(( FAILED_ROWS * 10 )) -lt $(( PASSED_ROWS * 9 )) ]; then
+	echo "The log of the failed simulation has $FAILED_ROWS rows, the completed ones were dropped ($PASSED_ROWS rows without the failure)."
+	FAILED=1
+fi
+if ! cmp -s -n "$(stat -c %s "$TMP/failed.csv")" "$TMP/passed.csv" "$TMP/failed.csv"; then
+	echo "The log of the failed simulation is not a prefix of the complete log."
+	FAILED=1
+fi
+if ! cmp -s "$TMP/failed.csv" "$TMP/stdout.csv"; then
+	echo "The log of the failed simulation differs when it is streamed to stdout."
+	FAILED=1
+fi
+
+if [ $FAILED -eq 0 ]; then
+	echo "Streaming failure check passed."
+fi
+exit $FAILED
@@ -0,0 +1,43 @@
+/*
+ * Tested program with global variables in all writable sections (.data, .bss, and the RELRO part).
+ * It is built as a shared library by the Makefile and loaded by the simulation/program-snapshot test.
+ * Every loop() reports the values of the counters on pins 2-9 (one byte after another, LSB first).
+ */
+#include "interface.hpp"
+
+extern "C" {
+	void setup();
+	void loop();
+}
+
+constexpr int firstPin = 2;
+
+unsigned char counter = 42; // .data
+unsigned char steps; // .bss
+unsigned char history[4096]; // .bss (more than one page)
+const unsigned char* const counters[] = { &counter, &steps }; // RELRO (relocated pointers)
+
+void report(unsigned char value)
+{
+	for (int i = 0; i < 8; ++i) {
+		digitalWrite(firstPin + i, (value >> i) & 1 ? HIGH : LOW);
+	}
+}
+
+void setup()
+{
+	for (int i = 0; i < 8; ++i) {
+		pinMode(firstPin + i, OUTPUT);
+	}
+}
+
+void loop()
+{
+	++counter;
+	++steps;
+	history[(steps * 1021) % sizeof(history)] = steps;
+	for (auto value : counters) {
+		report(*value);
+	}
+	report(history[(steps * 1021) % sizeof(history)]);
+}
@@ -0,0 +1,274 @@
+#include "../../GenericTester/dataio.hpp"
+
+#include "../test.hpp"
+
+#include <sstream>
+#include <stdexcept>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+
+class StreamingEventsWriterTest : public MoccarduinoTest
+{
+private:
+	using events_t = std::map<std::string, std::shared_ptr<TimeSeriesBase<>>>;
+
+	/**
+	 * Split CSV output into lines.
+	 */
+	static std::vector<std::string> lines(const std::string& csv)
+	{
+		std::vector<std::string> res;
+		std::istringstream sin(csv);
+		std::string line;
+		while (std::getline(sin, line)) {
+			res.push_back(line);
+		}
+		return res;
+	}
+
+	void checkOutput(const std::string& csv, const events_t& events, const std::string& comment) const
+	{
+		std::ostringstream expectedOut;
+		printEvents(expectedOut, events);
+		auto output = lines(csv);
+		auto expected = lines(expectedOut.str());
+		ASSERT_EQ(output.size(), expected.size(), comment + " (number of CSV lines)");
+		for (std::size_t i = 0; i < output.size(); ++i) {
+			ASSERT_EQ(output[i], expected[i], comment + " (CSV line " + std::to_string(i) + ")");
+		}
+	}
+
+	/**
+	 * A batch of rows is written while the slowest column has been notified exactly up to the time of its next event.
+	 */
+	void checkWatermark() const
+	{
+		auto numbers = std::make_shared<TimeSeries<int>>();
+		auto strings = std::make_shared<TimeSeries<std::string>>();
+		auto input = std::make_shared<TimeSeries<bool>>();
+		input->addEvent(100, true);
+
+		std::ostringstream sout;
+		StreamingEventsWriter writer(sout);
+		auto& numbersColumn = writer.addColumn<int>("numbers");
+		auto& stringsColumn = writer.addColumn<std::string>("strings");
+		writer.addColumn("input", input);
+
+		stringsColumn.addEvent(50, "before");
+		stringsColumn.advanceTime(100);
+		strings->addEvent(50, "before");
+		for (int i = 0; i < 5000; ++i) { // the batch is written in the middle (the watermark is 100)
+			numbersColumn.addEvent(i / 25, i);
+			numbers->addEvent(i / 25, i);
+		}
+		stringsColumn.addEvent(100, "at watermark");
+		strings->addEvent(100, "at watermark");
+		writer.finish();
+
+		checkOutput(sout.str(), { { "numbers", numbers }, { "strings", strings }, { "input", input } }, "watermark");
+	}
+
+	/**
+	 * Recorded inputs do not hold back the output once the input is exhausted (the rows are written before finish()).
+	 */
+	void checkInputFeed() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController arduino(emulator);
+		FunshieldSimulationController funshield(arduino);
+		std::string data = "1000 1 d\n1500 S hi\n2000 1 u\n";
+		FunshieldInputFeed feed(data.data(), data.size(), funshield);
+
+		std::ostringstream sout;
+		StreamingEventsWriter writer(sout);
+		auto& buttonColumn = writer.addColumn<bool>("button1");
+		auto& serialColumn = writer.addColumn<std::string>("serial");
+		auto& outputColumn = writer.addColumn<int>("output");
+		feed.recordButton(0, buttonColumn);
+		feed.recordSerial(serialColumn);
+
+		auto button = std::make_shared<TimeSeries<bool>>();
+		button->addEvent(1000, true);
+		button->addEvent(2000, false);
+		auto serial = std::make_shared<TimeSeries<std::string>>();
+		serial->addEvent(1500, "hi");
+		auto output = std::make_shared<TimeSeries<int>>();
+
+		logtime_t end = feed.scanDuration();
+		for (logtime_t time = 0; time < 4 * end; time += 10) {
+			feed.feed(time);
+			outputColumn.addEvent(time, (int)(time % 7));
+			output->addEvent(time, (int)(time % 7));
+		}
+		ASSERT_GT(lines(sout.str()).size(), (std::size_t)(2 * end / 10), "rows after the end of the input are written before finish()");
+
+		writer.finish();
+		checkOutput(sout.str(), { { "button1", button }, { "serial", serial }, { "output", output } }, "input feed");
+	}
+
+public:
+	StreamingEventsWriterTest() : MoccarduinoTest("dataio/streaming-writer") {}
+
+	virtual void run() const
+	{
+		checkWatermark();
+		checkInputFeed();
+
+		auto numbers = std::make_shared<TimeSeries<int>>();
+		auto strings = std::make_shared<TimeSeries<std::string>>();
+		auto idle = std::make_shared<TimeSeries<int>>(); // receives only time notifications
+		auto input = std::make_shared<TimeSeries<bool>>(); // complete before the streaming starts
+
+		std::mt19937 random(42);
+		logtime_t inputTime = 0;
+		for (std::size_t i = 0; i < 3000; ++i) {
+			inputTime += random() % 5;
+			input->addEvent(inputTime, i % 2 == 0);
+		}
+
+		std::ostringstream sout;
+		StreamingEventsWriter writer(sout);
+		auto& numbersColumn = writer.addColumn<int>("numbers");
+		auto& stringsColumn = writer.addColumn<std::string>("strings");
+		auto& idleColumn = writer.addColumn<int>("idle");
+		writer.addColumn("input", input);
+		ASSERT_EQ(writer.columns(), 4, "number of columns");
+
+		// the columns advance independently, events often share the timestamp with the watermark or with other columns
+		logtime_t numbersTime = 0, stringsTime = 0, idleTime = 0;
+		for (int i = 0; i < 20000; ++i) {
+			switch (random() % 4) {
+			case 0:
+				numbersTime += random() % 3;
+				numbersColumn.addEvent(numbersTime, i);
+				numbers->addEvent(numbersTime, i);
+				break;
+			case 1:
+				numbersTime += random() % 3;
+				numbersColumn.advanceTime(numbersTime);
+				break;
+			case 2:
+				stringsTime += random() % 2;
+				stringsColumn.addEvent(stringsTime, "s" + std::to_string(i));
+				strings->addEvent(stringsTime, "s" + std::to_string(i));
+				break;
+			default:
+				idleTime += random() % 5;
+				idleColumn.advanceTime(idleTime);
+				break;
+			}
+		}
+		writer.finish();
+
+		ASSERT_GT(numbers->size() + strings->size(), 4096, "more than one batch of events is written");
+		checkOutput(sout.str(), { { "numbers", numbers }, { "strings", strings }, { "idle", idle }, { "input", input } }, "random");
+	}
+};
+
+
+StreamingEventsWriterTest _streamingEventsWriterTest;
+
+
+class FunshieldInputParserTest : public MoccarduinoTest
+{
+private:
+	struct Loaded
+	{
+		logtime_t duration = 0;
+		std::vector<std::shared_ptr<TimeSeries<bool>>> buttons;
+		std::shared_ptr<TimeSeries<std::string>> serial = std::make_shared<TimeSeries<std::string>>();
+	};
+
+	/**
+	 * Parse the input (given as raw data, so it may contain null chars) and record the events.
+	 */
+	static Loaded load(const std::string& data)
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController arduino(emulator);
+		FunshieldSimulationController funshield(arduino);
+
+		Loaded res;
+		for (std::size_t i = 0; i < 3; ++i) {
+			res.buttons.push_back(std::make_shared<TimeSeries<bool>>());
+		}
+		res.duration = loadInputData(data.data(), data.size(), funshield, res.buttons, res.serial);
+		return res;
+	}
+
+	/**
+	 * Return the message of the exception thrown when the input is parsed (empty string if the input is valid).
+	 */
+	static std::string error(const std::string& data)
+	{
+		try {
+			load(data);
+		}
+		catch (std::runtime_error& e) {
+			return e.what();
+		}
+		return std::string();
+	}
+
+public:
+	FunshieldInputParserTest() : MoccarduinoTest("dataio/input-parser") {}
+
+	virtual void run() const
+	{
+		// timestamps are parsed the same way as `sin >> time` parses an unsigned number
+		auto input = load("+1500 1 d\n2000 1 u\n");
+		ASSERT_EQ(input.buttons[0]->size(), 2, "leading plus sign");
+		ASSERT_EQ((*input.buttons[0])[0].time, 1500, "leading plus sign");
+		ASSERT_EQ(input.duration, 102000, "duration is extended after the last event");
+
+		input = load("-5\n");
+		ASSERT_EQ(input.duration, (logtime_t)0 - 5, "negative number wraps around");
+
+		input = load("1000 1 d\n99999999999999999999 1 u\n");
+		ASSERT_EQ(input.buttons[0]->size(), 1, "overflow makes the line an end marker");
+		ASSERT_EQ(input.duration, std::numeric_limits<logtime_t>::max(), "overflow saturates");
+
+		input = load("abc 1 d\n2000 1 d\n");
+		ASSERT_EQ(input.buttons[0]->size(), 0, "non-numeric timestamp makes the line an end marker");
+		ASSERT_EQ(input.duration, 0, "non-numeric timestamp is zero");
+
+		// line endings and serial data
+		input = load("1000 1 d\n2000 S hello");
+		ASSERT_EQ(input.serial->size(), 1, "missing trailing newline");
+		ASSERT_EQ((*input.serial)[0].value, "hello", "missing trailing newline");
+		ASSERT_EQ(input.duration, 102000, "missing trailing newline");
+
+		input = load("1000 1 d\r\n2000 S hi there \r\n3000\r\n");
+		ASSERT_EQ(input.buttons[0]->size(), 1, "CRLF line endings");
+		ASSERT_EQ((*input.serial)[0].value, "hi there", "trailing whitespace of serial data is removed");
+		ASSERT_EQ(input.duration, 3000, "end marker with CRLF");
+
+		const char withNull[] = "1000 S ab\0cd\n2000 S \n";
+		input = load(std::string(withNull, sizeof(withNull) - 1));
+		ASSERT_EQ(input.serial->size(), 2, "embedded null char");
+		ASSERT_EQ((*input.serial)[0].value, "ab", "serial data end at a null char");
+		ASSERT_EQ((*input.serial)[1].value, "", "empty serial data");
+
+		input = load("\n1000 2 d\n1500 2 d\n2000 2 u\n");
+		ASSERT_EQ(input.buttons[1]->size(), 2, "lines which do not change the button state are skipped");
+		ASSERT_EQ((*input.buttons[1])[1].time, 2000, "lines which do not change the button state are skipped");
+
+		// errors
+		ASSERT_EQ(error("2000 1 d\n1000 1 u\n"),
+			"Timestamps are not ordered on line 2. Timestamp 1000 is lower than the previous 2000.", "timestamps out of order");
+		ASSERT_EQ(error("1000 1 d\nabc\n"),
+			"Timestamps are not ordered on line 2. Timestamp 0 is lower than the previous 1000.", "non-numeric timestamp after an event");
+		ASSERT_EQ(error("1000 1 d\r\n\r\n2000 1 u\r\n"),
+			"Timestamps are not ordered on line 2. Timestamp 0 is lower than the previous 1000.", "empty CRLF line is not skipped");
+		ASSERT_EQ(error("\n\n1000 4 d\n"), "Invalid operation (button #52 action d) found at line 3", "invalid button");
+		ASSERT_EQ(error("1000 1 x\n"), "Invalid operation (button #49 action x) found at line 1", "invalid button action");
+	}
+};
+
+
+FunshieldInputParserTest _funshieldInputParserTest;
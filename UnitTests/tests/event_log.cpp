@@ -0,0 +1,120 @@
+#include "event_log.hpp"
+
+#include "../test.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <cstdint>
+
+class EventLogTest : public MoccarduinoTest
+{
+private:
+	static void checkColumn(const EventLogColumn& column, const TimeSeriesBase<>& series, const std::string& name)
+	{
+		ASSERT_EQ(column.size(), series.size(), name + " size");
+		for (std::size_t i = 0; i < series.size(); ++i) {
+			ASSERT_EQ(column.getEventTime(i), series.getEventTime(i), name + " time #" + std::to_string(i));
+			ASSERT_EQ(column.getEventAsString(i), series.getEventAsString(i), name + " value #" + std::to_string(i));
+		}
+
+		// random access (restarting from checkpoints)
+		std::mt19937 random(3);
+		for (std::size_t i = 0; i < 100 && !series.empty(); ++i) {
+			std::size_t idx = random() % series.size();
+			ASSERT_EQ(column.getEventTime(idx), series.getEventTime(idx), name + " random access time #" + std::to_string(idx));
+		}
+	}
+
+public:
+	EventLogTest() : MoccarduinoTest("event-log/binary") {}
+
+	virtual void run() const
+	{
+		std::mt19937 random(42);
+		TimeSeries<bool> buttons;
+		TimeSeries<std::string> serial;
+		TimeSeries<BitArray<4>> leds;
+		TimeSeries<BitArray<32>> display;
+		TimeSeries<int> numbers;
+		TimeSeries<bool> nothing;
+		logtime_t time = 0;
+		for (int i = 0; i < 500; ++i) {
+			time += (i % 50 == 0) ? (logtime_t)1 << 40 : random() % 3000; // some deltas need many bytes
+			buttons.addEvent(time, random() % 2);
+			serial.addEvent(time + 1, i % 7 ? "msg " + std::to_string(i) : "say \"hi\"");
+			BitArray<4> ledsState;
+			ledsState.set<unsigned>(random(), 0, 4);
+			leds.addEvent(time, ledsState);
+			BitArray<32> displayState;
+			displayState.set<std::uint32_t>(random());
+			display.addEvent(time + 2, displayState);
+			numbers.addEvent(time, -i);
+		}
+
+		std::stringstream sout;
+		EventLogWriter writer;
+		writer.addColumn("b", buttons);
+		writer.addColumn("serial", serial);
+		writer.addColumn("leds", leds);
+		writer.addColumn("7seg", display);
+		writer.addColumn("numbers", numbers);
+		writer.addColumn("nothing", nothing);
+		writer.write(sout);
+
+		// the view requires aligned data
+		std::string data = sout.str();
+		std::vector<std::uint64_t> buffer((data.size() + 7) / 8);
+		std::memcpy(buffer.data(), data.data(), data.size());
+		EventLogView log(buffer.data(), data.size());
+
+		ASSERT_EQ(log.columns().size(), 6, "number of columns");
+		ASSERT_TRUE(log.column("b").type() == EventLogType::BOOL, "bool column type");
+		ASSERT_TRUE(log.column("7seg").type() == EventLogType::BITS, "bits column type");
+		ASSERT_TRUE(log.column("numbers").type() == EventLogType::TEXT, "generic column type");
+		checkColumn(log.column("b"), buttons, "buttons");
+		checkColumn(log.column("serial"), serial, "serial");
+		checkColumn(log.column("leds"), leds, "leds");
+		checkColumn(log.column("7seg"), display, "7seg");
+		checkColumn(log.column("numbers"), numbers, "numbers");
+		checkColumn(log.column("nothing"), nothing, "empty");
+
+		auto loadedDisplay = log.column("7seg").toTimeSeries<BitArray<32>>();
+		ASSERT_EQ(loadedDisplay.compare(display, TimeSeries<BitArray<32>>::Range(), BitArray<32>()), 0, "typed copy of a column");
+		ASSERT_EQ(log.column("serial").getValue<std::string>(7), "say \"hi\"", "typed string value");
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { log.column("b").getValue<std::string>(0); }, "value type mismatch");
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { log.column("missing"); }, "missing column");
+		ASSERT_EXCEPTION(std::out_of_range, [&]() { log.column("b").getEventTime(log.column("b").size()); }, "event time out of range");
+		ASSERT_EXCEPTION(std::out_of_range, [&]() { log.column("nothing").getEventAsString(0); }, "event of an empty column");
+		ASSERT_EXCEPTION(std::out_of_range, [&]() { log.column("serial").getValue<std::string>(serial.size()); }, "value out of range");
+
+		// the binary log is much smaller than CSV
+		std::stringstream csv;
+		for (std::size_t i = 0; i < display.size(); ++i) {
+			csv << display.getEventTime(i) << ',' << display.getEventAsString(i) << '\n';
+		}
+		ASSERT_TRUE(log.column("7seg").size() * 4 * 2 < csv.str().size(), "packed values");
+
+		// corrupted logs are rejected
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { EventLogView(buffer.data(), 20); }, "truncated log");
+		buffer[0] = 0;
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { EventLogView(buffer.data(), data.size()); }, "invalid magic");
+
+		// mapped file
+		auto path = std::filesystem::temp_directory_path() / ("moccarduino-event-log-" + std::to_string(random()) + ".bin");
+		{
+			std::ofstream fout(path, std::ios::binary);
+			fout << data;
+		}
+		{
+			EventLogFile file(path.string());
+			checkColumn(file.column("serial"), serial, "mapped serial");
+			checkColumn(file.column("leds"), leds, "mapped leds");
+		}
+		std::filesystem::remove(path);
+	}
+};
+
+
+EventLogTest _eventLogTest;
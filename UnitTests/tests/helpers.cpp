@@ -2,6 +2,7 @@
 
 #include "../test.hpp"
 
+#include <string>
 #include <cstdint>
 
 class BitArrayTest : public MoccarduinoTest
@@ -22,6 +23,18 @@ public:
 		ASSERT_EQ((int)ba.get<std::uint8_t>(8), 0xbe, "bit array does not hold, what we previously set");
 		ASSERT_EQ((int)ba.get<std::uint8_t>(16), 0xad, "bit array does not hold, what we previously set");
 		ASSERT_EQ((int)ba.get<std::uint8_t>(24), 0xde & 0x3f, "bit array does not hold, what we previously set");
+
+		ASSERT_EQ(std::string(ba), "efbead1e", "hex string of the bit array");
+		ASSERT_EQ(std::string(BitArray<30>(true)), "ffffff3f", "hex string ignores unused bits");
+		ASSERT_EQ(std::string(BitArray<3>(true)), "7", "hex string of a short bit array");
+
+		ASSERT_EQ(ba.getWord(), magic, "word holds all bits of the array");
+		ASSERT_EQ(BitArray<30>(true).getWord(), 0x3fffffff, "word ignores unused bits");
+		BitArray<30> fromWord;
+		fromWord.setWord(magic);
+		ASSERT_TRUE(fromWord == ba, "bit array set from a word");
+		ASSERT_EQ(lowestBitIndex(0x80), 7, "index of the lowest set bit");
+		ASSERT_EQ(lowestBitIndex(0x8000000000000000), 63, "index of the highest bit");
 	}
 };
 
@@ -0,0 +1,139 @@
+#include "input_generators.hpp"
+#include "simulation.hpp"
+
+#include "../test.hpp"
+
+#include <vector>
+#include <string>
+#include <limits>
+
+
+class InputGeneratorsTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Drain the generator (up to given time) into a time series.
+	 */
+	static TimeSeries<ArduinoPinState> collect(InputGenerator& generator, logtime_t time)
+	{
+		TimeSeries<ArduinoPinState> events;
+		generator.attachNextConsumer(events);
+		generator.advanceTime(time);
+		generator.detachNextConsumer();
+		return events;
+	}
+
+	void checkEvents(const TimeSeries<ArduinoPinState>& events, const std::vector<TimedEvent<int>>& expected, const std::string& comment) const
+	{
+		ASSERT_EQ(events.size(), expected.size(), comment + " (number of events)");
+		for (std::size_t i = 0; i < expected.size(); ++i) {
+			ASSERT_EQ(events[i].time, expected[i].time, comment + " (time of event " + std::to_string(i) + ")");
+			ASSERT_EQ(events[i].value.value, expected[i].value, comment + " (value of event " + std::to_string(i) + ")");
+		}
+	}
+
+public:
+	InputGeneratorsTest() : MoccarduinoTest("input-generators/sequences") {}
+
+	virtual void run() const
+	{
+		PeriodicInputGenerator periodic(1, 100, 250, 50, LOW, 3);
+		checkEvents(collect(periodic, 10000), {
+			{ 100, LOW }, { 150, HIGH }, { 350, LOW }, { 400, HIGH }, { 600, LOW }, { 650, HIGH } }, "periodic");
+		ASSERT_EQ(periodic.nextEventTime(), std::numeric_limits<logtime_t>::max(), "periodic generator is exhausted");
+
+		PeriodicInputGenerator clock(1, 0, 10, 5, HIGH);
+		auto wave = collect(clock, 999999);
+		ASSERT_EQ(wave.size(), 200000, "unlimited square wave");
+		ASSERT_EQ(clock.nextEventTime(), 1000000, "square wave continues");
+
+		BurstInputGenerator burst(1, 1000, 1000, 2, 100, 30, LOW, 2);
+		checkEvents(collect(burst, 10000), {
+			{ 1000, LOW }, { 1030, HIGH }, { 1100, LOW }, { 1130, HIGH },
+			{ 2000, LOW }, { 2030, HIGH }, { 2100, LOW }, { 2130, HIGH } }, "burst");
+
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { PeriodicInputGenerator(1, 0, 100, 100); }, "pulse longer than period");
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { BurstInputGenerator(1, 0, 150, 2, 100, 50); }, "burst longer than period");
+
+		RandomInputGenerator random1(1, 42, 500, 10, 100, 1, 50, LOW, 1000);
+		RandomInputGenerator random2(1, 42, 500, 10, 100, 1, 50, LOW, 1000);
+		auto events1 = collect(random1, std::numeric_limits<logtime_t>::max() - 1);
+		auto events2 = collect(random2, std::numeric_limits<logtime_t>::max() - 1);
+		ASSERT_EQ(events1.size(), 2000, "random pulses");
+		ASSERT_EQ(events1[0].time, 500, "first random pulse");
+		for (std::size_t i = 0; i < events1.size(); ++i) {
+			ASSERT_EQ(events1[i].time, events2[i].time, "the same seed produces the same events");
+			ASSERT_EQ(events1[i].value.value, i % 2 ? HIGH : LOW, "random pulses alternate");
+			if (i > 0) {
+				logtime_t gap = events1[i].time - events1[i - 1].time;
+				ASSERT_GE(gap, i % 2 ? 1 : 10, "random gap in range");
+				ASSERT_LE(gap, i % 2 ? 50 : 100, "random gap in range");
+			}
+		}
+
+		PeriodicInputGenerator clicks(1, 1000, 1000, 100, LOW, 2);
+		BouncingInputGenerator bouncing(clicks, 10);
+		checkEvents(collect(bouncing, 10000), {
+			{ 1000, LOW }, { 1010, HIGH }, { 1020, LOW }, { 1030, HIGH }, { 1040, LOW }, { 1050, HIGH }, { 1060, LOW },
+			{ 1100, HIGH }, { 1110, LOW }, { 1120, HIGH }, { 1130, LOW }, { 1140, HIGH }, { 1150, LOW }, { 1160, HIGH },
+			{ 2000, LOW }, { 2010, HIGH }, { 2020, LOW }, { 2030, HIGH }, { 2040, LOW }, { 2050, HIGH }, { 2060, LOW },
+			{ 2100, HIGH }, { 2110, LOW }, { 2120, HIGH }, { 2130, LOW }, { 2140, HIGH }, { 2150, LOW }, { 2160, HIGH } }, "bouncing");
+
+		PeriodicInputGenerator shortClicks(1, 1000, 1000, 25, LOW, 1);
+		BouncingInputGenerator cutBouncing(shortClicks, 10);
+		checkEvents(collect(cutBouncing, 10000), {
+			{ 1000, LOW }, { 1010, HIGH }, { 1020, LOW },
+			{ 1025, HIGH }, { 1035, LOW }, { 1045, HIGH }, { 1055, LOW }, { 1065, HIGH }, { 1075, LOW }, { 1085, HIGH } },
+			"bouncing is cut short by the next change");
+	}
+};
+
+
+InputGeneratorsTest _inputGeneratorsTest;
+
+
+class InputGeneratorsSimulationTest : public MoccarduinoTest
+{
+public:
+	InputGeneratorsSimulationTest() : MoccarduinoTest("input-generators/simulation") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		simulation.registerPin(2, OUTPUT);
+		TimeSeries<ArduinoPinState> events;
+		simulation.attachPinEventsConsumer(1, events);
+		emulator.pinMode(1, INPUT);
+
+		PeriodicInputGenerator clicks(1, 1000, 1000, 500, LOW);
+		simulation.registerPinInput(1, clicks);
+		simulation.schedulePinValueChange(1, LOW, 1800);
+		int value = emulator.digitalRead(1);
+		ASSERT_EQ(value, HIGH, "no event before the first click");
+
+		emulator.delayMicroseconds(1000);
+		value = emulator.digitalRead(1);
+		ASSERT_EQ(value, LOW, "first click is down");
+		emulator.delayMicroseconds(600);
+		value = emulator.digitalRead(1);
+		ASSERT_EQ(value, HIGH, "first click is up");
+		emulator.delayMicroseconds(150);
+		value = emulator.digitalRead(1);
+		ASSERT_EQ(value, LOW, "scheduled event is interleaved with the generated ones");
+
+		emulator.delayMicroseconds(10200);
+		ASSERT_EQ(events.size(), 1 + 12 + 11, "generated and scheduled events are delivered");
+		ASSERT_EQ(events[2].time, 1800, "time of the scheduled event");
+		ASSERT_EQ(clicks.nextEventTime(), 12500, "generator is advanced only up to the current time");
+
+		ASSERT_EXCEPTION(ArduinoEmulatorException, [&]() { simulation.createSnapshot(); }, "snapshot with a generator");
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { simulation.registerPinInput(2, clicks); }, "generator on an output pin");
+		PeriodicInputGenerator late(1, 0, 1000, 500);
+		ASSERT_EXCEPTION(ArduinoEmulatorException, [&]() { simulation.registerPinInput(1, late); }, "generator in the past");
+	}
+};
+
+
+InputGeneratorsSimulationTest _inputGeneratorsSimulationTest;
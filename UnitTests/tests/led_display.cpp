@@ -202,3 +202,199 @@ public:
 };
 
 DemultiplexingTest2 _demultiplexingTest2;
+
+
+
+class StaticPipelineTest : public MoccarduinoTest
+{
+public:
+	using leds_t = BitArray<4>;
+	using pipeline_t = EventPipeline<LedsEventsDemultiplexer<4>, LedsEventsAggregator<4>, TimeSeries<leds_t>>;
+
+	StaticPipelineTest() : MoccarduinoTest("led_display/static-pipeline") {}
+
+	virtual void run() const
+	{
+		FutureTimeSeries<leds_t> input, pipelineInput;
+		LedsEventsDemultiplexer<4> demuxer(10000);
+		LedsEventsAggregator<4> aggregator(50000);
+		TimeSeries<leds_t> output;
+		pipeline_t pipeline(std::make_tuple(10000), std::make_tuple(50000), std::make_tuple());
+
+		// the same events go through the runtime-linked chain and the pipeline
+		input.attachNextConsumer(demuxer);
+		pipelineInput.attachNextConsumer(pipeline.head());
+		demuxer.attachNextConsumer(aggregator);
+		aggregator.attachNextConsumer(output);
+
+		logtime_t ts = 49000;
+		leds_t leds(OFF);
+		for (std::size_t activeLed = 0; activeLed < 8; ++activeLed) {
+			while (ts < (activeLed + 1) * 1000000) {
+				leds.set<int>(OFF, (activeLed + 3) % 4, 1);
+				input.addFutureEvent(ts, leds);
+				pipelineInput.addFutureEvent(ts, leds);
+				ts += 100;
+				leds.set<int>(ON, activeLed % 4, 1);
+				input.addFutureEvent(ts, leds);
+				pipelineInput.addFutureEvent(ts, leds);
+				ts += 3000;
+			}
+		}
+		input.advanceTime(ts);
+		pipelineInput.advanceTime(ts);
+
+		ASSERT_EQ(output.size(), 8, "output size of the runtime-linked chain");
+		auto& pipelineOutput = pipeline.tail();
+		ASSERT_EQ(pipelineOutput.size(), output.size(), "pipeline output size");
+		for (std::size_t i = 0; i < output.size(); ++i) {
+			ASSERT_EQ(pipelineOutput[i].time, output[i].time, "pipeline event time");
+			ASSERT_EQ(pipelineOutput[i].value.get<unsigned>(0), output[i].value.get<unsigned>(0), "pipeline event value");
+		}
+
+		TimeSeries<leds_t> other;
+		pipeline.get<1>().detachNextConsumer();
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { pipeline.get<1>().attachNextConsumer(other); }, "attaching a consumer of a different type");
+	}
+};
+
+StaticPipelineTest _staticPipelineTest;
+
+
+class ShiftOutTransactionsTest : public MoccarduinoTest
+{
+private:
+	using display_t = SerialSegLedDisplay<4>;
+
+	/**
+	 * Display a few digits using shiftOut() and record the display states and all the pin events passed through the display.
+	 * @param inputEvents if not null, it is subscribed for the shiftOut() pins and a frequently changing input pin
+	 */
+	static logtime_t displayDigits(bool transactions, TimeSeries<display_t::state_t>& states, TimeSeries<ArduinoPinState>& pinEvents,
+		TimeSeries<ArduinoPinState>* inputEvents = nullptr)
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.setShiftOutTransactions(transactions);
+		simulation.registerPin(latch_pin, OUTPUT);
+		simulation.registerPin(clock_pin, OUTPUT);
+		simulation.registerPin(data_pin, OUTPUT);
+
+		display_t display;
+		display.attachToSimulation(simulation);
+		display.attachSproutConsumer(states);
+		display.attachNextConsumer(pinEvents);
+
+		if (inputEvents) {
+			// the inputs change in the middle of shiftOut() calls
+			simulation.registerPin(button1_pin, INPUT);
+			simulation.attachPinEventsConsumer(button1_pin, *inputEvents);
+			simulation.attachPinEventsConsumer(clock_pin, *inputEvents);
+			simulation.attachPinEventsConsumer(data_pin, *inputEvents);
+			for (logtime_t time = 13; time < 1000; time += 13) {
+				simulation.schedulePinValueChange(button1_pin, (time / 13) % 2 ? LOW : HIGH, time);
+			}
+		}
+
+		emulator.pinMode(latch_pin, OUTPUT);
+		emulator.pinMode(clock_pin, OUTPUT);
+		emulator.pinMode(data_pin, OUTPUT);
+		emulator.digitalWrite(clock_pin, HIGH); // the first clock edge of the transaction is not a transition
+
+		std::uint8_t glyphs[] = { 0xc0, 0xf9, 0xa4, 0xb0 };
+		for (std::uint8_t d = 0; d < 4; ++d) {
+			emulator.digitalWrite(latch_pin, LOW);
+			emulator.shiftOut(data_pin, clock_pin, LSBFIRST, glyphs[d]);
+			emulator.shiftOut(data_pin, clock_pin, MSBFIRST, 1 << d);
+			emulator.digitalWrite(latch_pin, HIGH);
+		}
+		return simulation.getCurrentTime();
+	}
+
+public:
+	ShiftOutTransactionsTest() : MoccarduinoTest("led_display/shift-out-transactions") {}
+
+	virtual void run() const
+	{
+		TimeSeries<display_t::state_t> states, expectedStates;
+		TimeSeries<ArduinoPinState> pinEvents, expectedPinEvents;
+		logtime_t time = displayDigits(true, states, pinEvents);
+		logtime_t expectedTime = displayDigits(false, expectedStates, expectedPinEvents);
+		ASSERT_EQ(time, expectedTime, "time after the simulation");
+
+		ASSERT_EQ(states.size(), 4, "number of display states");
+		ASSERT_EQ(states.size(), expectedStates.size(), "number of display states");
+		for (std::size_t i = 0; i < states.size(); ++i) {
+			ASSERT_TRUE(states[i] == expectedStates[i], "display state #" + std::to_string(i));
+		}
+
+		ASSERT_EQ(pinEvents.size(), expectedPinEvents.size(), "number of pin events");
+		for (std::size_t i = 0; i < pinEvents.size(); ++i) {
+			ASSERT_TRUE(pinEvents[i] == expectedPinEvents[i], "pin event #" + std::to_string(i));
+		}
+
+		// subscribers of the shiftOut() pins and an input pin must not be moved past the inputs delivered during the transaction
+		TimeSeries<display_t::state_t> states2, expectedStates2;
+		TimeSeries<ArduinoPinState> pinEvents2, expectedPinEvents2, inputEvents, expectedInputEvents;
+		time = displayDigits(true, states2, pinEvents2, &inputEvents);
+		expectedTime = displayDigits(false, expectedStates2, expectedPinEvents2, &expectedInputEvents);
+		ASSERT_EQ(time, expectedTime, "time after the simulation with inputs");
+		ASSERT_EQ(inputEvents.size(), expectedInputEvents.size(), "number of subscribed pin events");
+		for (std::size_t i = 0; i < inputEvents.size(); ++i) {
+			ASSERT_TRUE(inputEvents[i] == expectedInputEvents[i], "subscribed pin event #" + std::to_string(i));
+		}
+	}
+};
+
+ShiftOutTransactionsTest _shiftOutTransactionsTest;
+
+
+class BatchDeliveryTest : public MoccarduinoTest
+{
+public:
+	using leds_t = BitArray<4>;
+
+	BatchDeliveryTest() : MoccarduinoTest("led_display/batch-delivery") {}
+
+	virtual void run() const
+	{
+		// recorded multiplexed states
+		TimeSeries<leds_t> log;
+		logtime_t ts = 1000;
+		for (std::size_t step = 0; step < 20; ++step) {
+			for (std::size_t i = 0; i < 50; ++i, ts += 1000) {
+				leds_t leds(OFF);
+				leds.set<int>(ON, (step + i % 2) % 4, 1);
+				log.addEvent(ts, leds);
+			}
+		}
+
+		LedsEventsDemultiplexer<4> demuxer(10000), batchDemuxer(10000);
+		LedsEventsAggregator<4> aggregator(30000), batchAggregator(30000);
+		TimeSeries<leds_t> output, batchOutput;
+		demuxer.attachNextConsumer(aggregator);
+		aggregator.attachNextConsumer(output);
+		batchDemuxer.attachNextConsumer(batchAggregator);
+		batchAggregator.attachNextConsumer(batchOutput);
+
+		for (std::size_t i = 0; i < log.size(); ++i) {
+			demuxer.addEvent(log[i].time, log[i].value);
+		}
+		log.replay(batchDemuxer);
+		demuxer.advanceTime(ts);
+		batchDemuxer.advanceTime(ts);
+
+		ASSERT_GT(output.size(), 1, "demultiplexed events");
+		ASSERT_EQ(batchOutput.size(), output.size(), "batch output size");
+		for (std::size_t i = 0; i < output.size(); ++i) {
+			ASSERT_EQ(batchOutput[i].time, output[i].time, "batch event time");
+			ASSERT_EQ(batchOutput[i].value.get<unsigned>(0), output[i].value.get<unsigned>(0), "batch event value");
+		}
+
+		std::vector<TimedEvent<leds_t>> unordered = { { ts + 2, leds_t(OFF) }, { ts + 1, leds_t(ON) } };
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { batchDemuxer.addEvents(unordered); }, "unordered batch");
+		ASSERT_EQ(batchOutput.size(), output.size(), "unordered batch is rejected as a whole");
+	}
+};
+
+BatchDeliveryTest _batchDeliveryTest;
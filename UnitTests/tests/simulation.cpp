@@ -1,9 +1,14 @@
 #include "simulation.hpp"
+#include "interface.hpp"
 
 #include "../test.hpp"
 
 #include <functional>
+#include <thread>
+#include <stdexcept>
 #include <cstdint>
+#include <limits>
+#include <algorithm>
 
 class DisableFunctionsTest : public MoccarduinoTest
 {
@@ -56,3 +61,603 @@ public:
 
 
 DisableFunctionsTest _disableFunctionsTest;
+
+
+class EmulatorBindingTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Write given number of values to an output pin using the Arduino API and return the number of recorded events.
+	 */
+	static std::size_t writeValues(std::size_t count)
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(2, OUTPUT);
+		TimeSeries<ArduinoPinState> events;
+		simulation.attachPinEventsConsumer(2, events);
+
+		ArduinoEmulatorBinding binding(&emulator);
+		pinMode(2, OUTPUT);
+		for (std::size_t i = 0; i < count; ++i) {
+			digitalWrite(2, i % 2);
+		}
+		return events.size();
+	}
+
+public:
+	EmulatorBindingTest() : MoccarduinoTest("simulation/emulator-binding") {}
+
+	virtual void run() const
+	{
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { millis(); }, "API invoked without bound emulator");
+
+		std::size_t counts[] = { 0, 0 };
+		std::thread t1([&]() { counts[0] = writeValues(100); });
+		std::thread t2([&]() { counts[1] = writeValues(42); });
+		t1.join();
+		t2.join();
+		ASSERT_EQ(counts[0], 100, "events recorded by the first emulator");
+		ASSERT_EQ(counts[1], 42, "events recorded by the second emulator");
+	}
+};
+
+
+EmulatorBindingTest _emulatorBindingTest;
+
+
+class SimulationSnapshotTest : public MoccarduinoTest
+{
+public:
+	SimulationSnapshotTest() : MoccarduinoTest("simulation/snapshot") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		simulation.registerPin(2, OUTPUT);
+		TimeSeries<ArduinoPinState> events;
+		simulation.attachPinEventsConsumer(2, events);
+
+		emulator.pinMode(1, INPUT);
+		emulator.pinMode(2, OUTPUT);
+		emulator.digitalWrite(2, HIGH);
+		simulation.enqueuePinValueChange(1, LOW, 5000);
+
+		auto snapshot = simulation.createSnapshot();
+		auto savedEvents = events;
+		logtime_t savedTime = simulation.getCurrentTime();
+
+		for (std::size_t branch = 0; branch < 2; ++branch) {
+			simulation.restoreSnapshot(snapshot);
+			events = savedEvents;
+			ASSERT_EQ(simulation.getCurrentTime(), savedTime, "time restored in branch " + std::to_string(branch));
+			ASSERT_EQ(emulator.digitalRead(1), HIGH, "input value restored in branch " + std::to_string(branch));
+
+			emulator.delay(10);
+			ASSERT_EQ(emulator.digitalRead(1), LOW, "scheduled input restored in branch " + std::to_string(branch));
+			emulator.digitalWrite(2, LOW);
+			simulation.enqueuePinValueChange(1, HIGH, 1000 * branch);
+			ASSERT_EQ(events.size(), 2, "output events in branch " + std::to_string(branch));
+		}
+	}
+};
+
+
+SimulationSnapshotTest _simulationSnapshotTest;
+
+
+#ifdef __linux__
+
+/**
+ * Saves and restores global variables of a loaded program (fixtures/snapshot_program.cpp built by the Makefile).
+ */
+class ProgramSnapshotTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Bytes reported by the last loop() of the program (the counter, the number of steps, and the last history item).
+	 */
+	static std::vector<int> reported(const TimeSeries<ArduinoPinState>& events)
+	{
+		std::vector<int> bytes(3, 0);
+		std::size_t first = events.size() - 24;
+		for (std::size_t i = 0; i < 24; ++i) {
+			if (events[first + i].value.value == HIGH) {
+				bytes[i / 8] |= 1 << (i % 8);
+			}
+		}
+		return bytes;
+	}
+
+	static void loadProgram(ArduinoSimulationController& simulation, TimeSeries<ArduinoPinState>& events)
+	{
+		for (pin_t pin = 2; pin < 10; ++pin) {
+			simulation.registerPin(pin, OUTPUT);
+			simulation.attachPinEventsConsumer(pin, events);
+		}
+		simulation.loadTestedCode("snapshot_program.so", true);
+		simulation.runSetup();
+	}
+
+	void checkReported(const TimeSeries<ArduinoPinState>& events, int counter, int steps, const std::string& comment) const
+	{
+		auto bytes = reported(events);
+		ASSERT_EQ(bytes[0], counter, comment + " (initialized global variable)");
+		ASSERT_EQ(bytes[1], steps, comment + " (zero-initialized global variable)");
+		ASSERT_EQ(bytes[2], steps, comment + " (zero-initialized array)");
+	}
+
+public:
+	ProgramSnapshotTest() : MoccarduinoTest("simulation/program-snapshot") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		TimeSeries<ArduinoPinState> events;
+		loadProgram(simulation, events);
+
+		simulation.runSingleLoop();
+		checkReported(events, 43, 1, "first loop");
+		auto snapshot = simulation.createSnapshot();
+		auto savedEvents = events;
+		ASSERT_FALSE(snapshot.emulator.program.segments.empty(), "writable segments of the program are saved");
+
+		for (std::size_t i = 0; i < 3; ++i) {
+			simulation.runSingleLoop();
+		}
+		checkReported(events, 46, 4, "before restore");
+
+		for (std::size_t branch = 0; branch < 2; ++branch) {
+			simulation.restoreSnapshot(snapshot);
+			events = savedEvents;
+			simulation.runSingleLoop();
+			checkReported(events, 44, 2, "after restore in branch " + std::to_string(branch));
+		}
+
+		// another isolated instance has its own globals and it does not accept the snapshot
+		ArduinoEmulator emulator2;
+		ArduinoSimulationController simulation2(emulator2);
+		TimeSeries<ArduinoPinState> events2;
+		loadProgram(simulation2, events2);
+		simulation2.runSingleLoop();
+		checkReported(events2, 43, 1, "another instance");
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { simulation2.restoreSnapshot(snapshot); }, "snapshot of a different instance");
+
+		simulation.runSingleLoop();
+		checkReported(events, 45, 3, "the first instance is not affected by the other one");
+	}
+};
+
+
+ProgramSnapshotTest _programSnapshotTest;
+
+#endif
+
+
+class SimulationInputSourceTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Toggles pin 1 every millisecond (the events are generated on demand).
+	 */
+	class ToggleSource : public ArduinoInputSource
+	{
+	public:
+		ArduinoSimulationController& simulation;
+		std::size_t remaining;
+		logtime_t next;
+		logtime_t maxFeedTime;
+
+		ToggleSource(ArduinoSimulationController& simulation, std::size_t count)
+			: simulation(simulation), remaining(count), next(1000), maxFeedTime(0) {}
+
+		logtime_t nextEventTime() const override
+		{
+			return remaining > 0 ? next : std::numeric_limits<logtime_t>::max();
+		}
+
+		void feed(logtime_t time) override
+		{
+			maxFeedTime = std::max(maxFeedTime, time);
+			while (remaining > 0 && next <= time) {
+				simulation.schedulePinValueChange(1, (next / 1000) % 2 ? LOW : HIGH, next);
+				next += 1000;
+				--remaining;
+			}
+		}
+	};
+
+public:
+	SimulationInputSourceTest() : MoccarduinoTest("simulation/input-source") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		TimeSeries<ArduinoPinState> events;
+		simulation.attachPinEventsConsumer(1, events);
+		emulator.pinMode(1, INPUT);
+
+		ToggleSource source(simulation, 1000);
+		simulation.attachInputSource(source);
+		ASSERT_EQ(emulator.digitalRead(1), HIGH, "no event before the first one is due");
+
+		for (std::size_t i = 1; i <= 10; ++i) {
+			emulator.delay(1);
+			ASSERT_EQ(emulator.digitalRead(1), i % 2 ? LOW : HIGH, "input value after " + std::to_string(i) + " ms");
+			ASSERT_TRUE(source.maxFeedTime <= simulation.getCurrentTime(), "source is fed only up to the current time");
+		}
+
+		emulator.delay(2000);
+		ASSERT_EQ(source.remaining, 0, "all events were fed");
+		ASSERT_EQ(events.size(), 1000, "all events were delivered");
+		ASSERT_EQ(events[999].time, 1000000, "time of the last event");
+		ASSERT_EXCEPTION(ArduinoEmulatorException, [&]() { simulation.createSnapshot(); }, "snapshot with input source");
+	}
+};
+
+
+SimulationInputSourceTest _simulationInputSourceTest;
+
+
+class PinChangeSuppressionTest : public MoccarduinoTest
+{
+public:
+	PinChangeSuppressionTest() : MoccarduinoTest("simulation/pin-change-suppression") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(2, OUTPUT);
+		simulation.registerPin(3, OUTPUT);
+		simulation.setPinChangeSuppression(3);
+		TimeSeries<ArduinoPinState> events, suppressedEvents;
+		simulation.attachPinEventsConsumer(2, events);
+		simulation.attachPinEventsConsumer(3, suppressedEvents);
+
+		emulator.pinMode(2, OUTPUT);
+		emulator.pinMode(3, OUTPUT);
+		int values[] = { LOW, LOW, HIGH, HIGH, HIGH, LOW };
+		for (int value : values) {
+			emulator.digitalWrite(2, value);
+			emulator.digitalWrite(3, value);
+		}
+
+		ASSERT_EQ(events.size(), 6, "all writes are recorded");
+		ASSERT_EQ(suppressedEvents.size(), 3, "only changes are recorded");
+		ASSERT_EQ(suppressedEvents[2].time, events[5].time + 20, "time of the last change");
+	}
+};
+
+
+PinChangeSuppressionTest _pinChangeSuppressionTest;
+
+
+class PinEventsBroadcastTest : public MoccarduinoTest
+{
+public:
+	PinEventsBroadcastTest() : MoccarduinoTest("simulation/pin-events-broadcast") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(2, OUTPUT);
+		simulation.registerPin(3, OUTPUT);
+		TimeSeries<ArduinoPinState> allEvents, dataEvents, clockEvents;
+		simulation.attachPinEventsConsumer(2, allEvents);
+		simulation.attachPinEventsConsumer(3, allEvents);
+		simulation.attachPinEventsConsumer(2, dataEvents);
+		simulation.attachPinEventsConsumer(3, clockEvents);
+
+		emulator.pinMode(2, OUTPUT);
+		emulator.pinMode(3, OUTPUT);
+		emulator.digitalWrite(2, HIGH);
+		emulator.digitalWrite(3, HIGH);
+		ASSERT_EQ(allEvents.size(), 2, "events of both pins");
+		ASSERT_EQ(dataEvents.size(), 1, "events of the data pin only");
+		ASSERT_EQ(clockEvents.size(), 1, "events of the clock pin only");
+
+		// the transaction is split among the subscribers
+		emulator.shiftOut(2, 3, MSBFIRST, 0xa5);
+		ASSERT_EQ(allEvents.size(), 2 + 24, "shiftOut events of both pins");
+		ASSERT_EQ(dataEvents.size(), 1 + 8, "shiftOut events of the data pin");
+		ASSERT_EQ(clockEvents.size(), 1 + 16, "shiftOut events of the clock pin");
+		ASSERT_EQ(dataEvents[1].time, allEvents[2].time, "time of the first data bit");
+
+		simulation.clearPinEvents(3);
+		ASSERT_EQ(clockEvents.size(), 0, "clock pin subscribers cleared");
+		ASSERT_EQ(dataEvents.size(), 9, "data pin subscribers kept");
+
+		simulation.detachPinEventsConsumer(allEvents);
+		emulator.digitalWrite(2, LOW);
+		ASSERT_EQ(allEvents.size(), 0, "detached consumer");
+		ASSERT_EQ(dataEvents.size(), 10, "remaining subscriber");
+	}
+};
+
+
+PinEventsBroadcastTest _pinEventsBroadcastTest;
+
+
+/**
+ * Program compiled into the tests -- reads input pin 1 after a delay.
+ */
+namespace delayedReadProgram
+{
+	int value = -1;
+	unsigned long readTime = 0;
+
+	void setup() {}
+
+	void loop()
+	{
+		delay(5);
+		value = digitalRead(1);
+		readTime = micros();
+	}
+}
+
+
+class TimeHorizonTest : public MoccarduinoTest
+{
+public:
+	TimeHorizonTest() : MoccarduinoTest("simulation/time-horizon") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		TimeSeries<ArduinoPinState> events;
+		simulation.attachPinEventsConsumer(1, events);
+		simulation.setTestedCode(delayedReadProgram::setup, delayedReadProgram::loop);
+		emulator.pinMode(1, INPUT);
+
+		// the event falls due while the loop is waiting in delay()
+		logtime_t loopStart = simulation.getCurrentTime();
+		simulation.enqueuePinValueChange(1, LOW, 2000);
+		simulation.runSingleLoop();
+		ASSERT_EQ(delayedReadProgram::value, LOW, "input delivered during delay()");
+		ASSERT_EQ(events.size(), 1, "one input event");
+		ASSERT_EQ(events[0].time, loopStart + 2000, "input delivered at its time");
+		ASSERT_GE(delayedReadProgram::readTime, loopStart + 5000, "value read after the delay");
+
+		// an earlier event is scheduled after the horizon was computed for a later one
+		logtime_t now = simulation.getCurrentTime();
+		simulation.schedulePinValueChange(1, LOW, now + 5000);
+		emulator.delayMicroseconds(10);
+		simulation.schedulePinValueChange(1, HIGH, now + 1000);
+		emulator.delayMicroseconds(2000);
+		int value = emulator.digitalRead(1);
+		ASSERT_EQ(value, HIGH, "input enqueued after the horizon was computed");
+		ASSERT_EQ(events.size(), 2, "only the earlier event is delivered");
+		ASSERT_EQ(events[1].time, now + 1000, "earlier input delivered at its time");
+		emulator.delayMicroseconds(3000);
+		value = emulator.digitalRead(1);
+		ASSERT_EQ(value, LOW, "later input delivered as well");
+		ASSERT_EQ(events[2].time, now + 5000, "later input delivered at its time");
+
+		// an event which falls due with the next time update is visible to digitalRead() right after it
+		now = simulation.getCurrentTime();
+		simulation.enqueuePinValueChange(1, HIGH, 1);
+		emulator.delayMicroseconds(1);
+		value = emulator.digitalRead(1);
+		ASSERT_EQ(value, HIGH, "buffered input which is due");
+		ASSERT_EQ(events.size(), 4, "due input delivered");
+		ASSERT_EQ(events[3].time, now + 1, "due input delivered at its time");
+	}
+};
+
+
+TimeHorizonTest _timeHorizonTest;
+
+
+class PinRegistrationTest : public MoccarduinoTest
+{
+public:
+	PinRegistrationTest() : MoccarduinoTest("simulation/pin-registration") {}
+
+	virtual void run() const
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		simulation.registerPin(2, OUTPUT);
+		simulation.registerPin(255, OUTPUT);
+		ASSERT_EXCEPTION(ArduinoEmulatorException, [&]() { simulation.registerPin(2, OUTPUT); }, "pin registered twice");
+		ASSERT_EXCEPTION(ArduinoEmulatorException, [&]() { emulator.pinMode(3, OUTPUT); }, "unregistered pin");
+
+		TimeSeries<ArduinoPinState> inputEvents, outputEvents;
+		simulation.attachPinEventsConsumer(1, inputEvents);
+		simulation.attachPinEventsConsumer(2, outputEvents);
+		emulator.pinMode(1, INPUT);
+		emulator.pinMode(2, OUTPUT);
+		emulator.pinMode(255, OUTPUT);
+		emulator.digitalWrite(2, HIGH);
+		emulator.digitalWrite(255, HIGH);
+		simulation.enqueuePinValueChange(1, LOW, 1000);
+		ASSERT_EQ(outputEvents.size(), 1, "output event recorded");
+
+		simulation.removeAllPins();
+		ASSERT_EXCEPTION(ArduinoEmulatorException, [&]() { emulator.digitalWrite(2, LOW); }, "removed pin");
+		ASSERT_EXCEPTION(ArduinoEmulatorException, [&]() { emulator.digitalRead(1); }, "removed input pin");
+
+		// the pins may be registered again, but they have no consumers and no scheduled inputs
+		simulation.registerPin(1, INPUT);
+		simulation.registerPin(2, OUTPUT);
+		emulator.pinMode(1, INPUT);
+		emulator.pinMode(2, OUTPUT);
+		emulator.digitalWrite(2, LOW);
+		emulator.delay(2);
+		int value = emulator.digitalRead(1);
+		ASSERT_EQ(value, HIGH, "inputs scheduled before the removal are dropped");
+		ASSERT_EQ(outputEvents.size(), 1, "consumers are detached from removed pins");
+		ASSERT_EQ(inputEvents.size(), 0, "consumers are detached from removed input pins");
+
+		TimeSeries<ArduinoPinState> newEvents;
+		simulation.attachPinEventsConsumer(1, newEvents);
+		simulation.enqueuePinValueChange(1, LOW, 1000);
+		emulator.delay(2);
+		value = emulator.digitalRead(1);
+		ASSERT_EQ(value, LOW, "input of the registered pin");
+		ASSERT_EQ(newEvents.size(), 1, "input event of the registered pin");
+	}
+};
+
+
+PinRegistrationTest _pinRegistrationTest;
+
+
+/**
+ * Program compiled into the tests -- polls an input, copies it to an output, and toggles another output
+ * every 20 ms. Optionally, it performs another action in every loop (see Mode).
+ */
+namespace pollingProgram
+{
+	enum class Mode { POLLING, ALTERNATING, SERIAL_PRINT, PIN_MODE, RANDOM_NUMBER };
+
+	Mode mode = Mode::POLLING;
+	std::size_t loops = 0; // observed by the test only, the program does not depend on it
+	int lastValue;
+	int toggle;
+	unsigned long nextToggle;
+	bool alternate;
+
+	void setup()
+	{
+		pinMode(1, INPUT);
+		pinMode(2, OUTPUT);
+		pinMode(3, OUTPUT);
+		lastValue = HIGH;
+		toggle = LOW;
+		nextToggle = 20;
+		alternate = false;
+		loops = 0;
+	}
+
+	void loop()
+	{
+		++loops;
+		int value = digitalRead(1);
+		if (value != lastValue) {
+			lastValue = value;
+			digitalWrite(2, value);
+		}
+
+		if (millis() >= nextToggle) {
+			nextToggle += 20;
+			toggle = toggle == LOW ? HIGH : LOW;
+			digitalWrite(3, toggle);
+		}
+
+		switch (mode) {
+		case Mode::ALTERNATING:
+			// the state changes in every loop, but every other loop has a side effect
+			alternate = !alternate;
+			if (alternate) {
+				digitalWrite(2, lastValue);
+			}
+			break;
+		case Mode::SERIAL_PRINT:
+			Serial.print("");
+			break;
+		case Mode::PIN_MODE:
+			pinMode(1, INPUT);
+			break;
+		case Mode::RANDOM_NUMBER:
+			random(10);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+
+class FastForwardTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Run the polling program for 110 ms with a few scheduled inputs.
+	 * @return simulation time at the end
+	 */
+	static logtime_t simulate(bool fastForward, pollingProgram::Mode mode, TimeSeries<ArduinoPinState>& events,
+		std::vector<logtime_t>& loopTimes)
+	{
+		ArduinoEmulator emulator;
+		ArduinoSimulationController simulation(emulator);
+		simulation.registerPin(1, INPUT);
+		simulation.registerPin(2, OUTPUT);
+		simulation.registerPin(3, OUTPUT);
+		simulation.attachPinEventsConsumer(2, events);
+		simulation.attachPinEventsConsumer(3, events);
+		simulation.setTestedCode(pollingProgram::setup, pollingProgram::loop);
+		simulation.setFastForward(fastForward);
+		pollingProgram::mode = mode;
+
+		simulation.runSetup();
+		simulation.schedulePinValueChange(1, LOW, 5000);
+		simulation.schedulePinValueChange(1, HIGH, 37000);
+		simulation.schedulePinValueChange(1, LOW, 37150);
+		simulation.schedulePinValueChange(1, HIGH, 90000);
+
+		auto callback = [&](logtime_t time) { loopTimes.push_back(time); return true; };
+		simulation.runLoopsForPeriod(50000, 100, callback);
+		simulation.runLoopsForPeriod(60000, 100, callback); // the period ends in the middle of an idle stretch
+		return simulation.getCurrentTime();
+	}
+
+	void checkEquivalence(pollingProgram::Mode mode, const std::string& comment, bool skipping) const
+	{
+		TimeSeries<ArduinoPinState> events, expectedEvents;
+		std::vector<logtime_t> loopTimes, expectedLoopTimes;
+		logtime_t time = simulate(true, mode, events, loopTimes);
+		std::size_t loops = pollingProgram::loops;
+		logtime_t expectedTime = simulate(false, mode, expectedEvents, expectedLoopTimes);
+		std::size_t expectedLoops = pollingProgram::loops;
+
+		ASSERT_EQ(time, expectedTime, comment + " (time at the end of the simulation)");
+		ASSERT_EQ(events.size(), expectedEvents.size(), comment + " (number of output events)");
+		for (std::size_t i = 0; i < events.size(); ++i) {
+			ASSERT_EQ(events[i].time, expectedEvents[i].time, comment + " (time of output event " + std::to_string(i) + ")");
+			ASSERT_TRUE(events[i].value == expectedEvents[i].value, comment + " (output event " + std::to_string(i) + ")");
+		}
+
+		ASSERT_EQ(loops, loopTimes.size(), comment + " (every executed loop is reported)");
+		if (skipping) {
+			ASSERT_LT(loops * 5, expectedLoops, comment + " (idle loops are skipped)");
+		}
+		else {
+			ASSERT_EQ(loops, expectedLoops, comment + " (no loops are skipped)");
+			for (std::size_t i = 0; i < loops; ++i) {
+				ASSERT_EQ(loopTimes[i], expectedLoopTimes[i], comment + " (time of loop " + std::to_string(i) + ")");
+			}
+		}
+	}
+
+public:
+	FastForwardTest() : MoccarduinoTest("simulation/fast-forward") {}
+
+	virtual void run() const
+	{
+		// inputs, millis() values, and period ends bound the skipped stretches, so the outputs are the same
+		checkEquivalence(pollingProgram::Mode::POLLING, "polling program", true);
+
+		// there are never two idle loops in a row
+		checkEquivalence(pollingProgram::Mode::ALTERNATING, "alternating side effects", false);
+
+		// loops with side effects are never skipped
+		checkEquivalence(pollingProgram::Mode::SERIAL_PRINT, "serial output", false);
+		checkEquivalence(pollingProgram::Mode::PIN_MODE, "pinMode()", false);
+		checkEquivalence(pollingProgram::Mode::RANDOM_NUMBER, "random()", false);
+	}
+};
+
+
+FastForwardTest _fastForwardTest;
@@ -3,6 +3,9 @@
 #include "../test.hpp"
 
 #include <functional>
+#include <algorithm>
+#include <cmath>
+#include <random>
 #include <cstdint>
 
 class EventAnalyzerTest : public MoccarduinoTest
@@ -119,3 +122,448 @@ public:
 
 
 TimeSeriesCompareTest  _timeSeriesCompareTest;
+
+
+class ColumnarTimeSeriesTest : public MoccarduinoTest
+{
+public:
+	ColumnarTimeSeriesTest() : MoccarduinoTest("time-series/columnar") {}
+
+	virtual void run() const
+	{
+		TimeSeries<int> rows;
+		ColumnarTimeSeries<int> columns;
+		std::vector<TimedEvent<int>> events = { { 100, 1 }, { 250, 2 }, { 300, 1 }, { 700, 2 }, { 710, 1 } };
+		rows.addEvents(events);
+		for (auto& e : events) {
+			columns.addEvent(e.time, e.value);
+		}
+
+		ASSERT_EQ(columns.size(), rows.size(), "size");
+		for (std::size_t i = 0; i < rows.size(); ++i) {
+			ASSERT_EQ(columns[i].time, rows[i].time, "event time");
+			ASSERT_EQ(columns.at(i).value, rows.at(i).value, "event value");
+		}
+		ASSERT_EQ(columns.back().time, 710, "last event");
+		ASSERT_EQ(columns.getDeltasMean(), rows.getDeltasMean(), "mean delta");
+		ASSERT_EQ(columns.getDeltasDeviation(), rows.getDeltasDeviation(), "delta deviation");
+		ASSERT_EQ(columns.findRepetitiveSubsequence({ 2, 1 }).length(), 4, "repetitive subsequence");
+
+		ColumnarTimeSeries<int> copy;
+		columns.replay(copy);
+		ASSERT_EQ(copy.compare(columns, ColumnarTimeSeries<int>::Range(0, 1000), 0), 0, "replayed series");
+	}
+};
+
+
+ColumnarTimeSeriesTest _columnarTimeSeriesTest;
+
+
+class DeltaStatisticsTest : public MoccarduinoTest
+{
+private:
+	template<class SERIES>
+	void testSeries(const std::vector<logtime_t>& times, const std::string& name) const
+	{
+		SERIES series;
+		for (auto t : times) {
+			series.addEvent(t, 0);
+		}
+
+		// straightforward reference values
+		std::vector<logtime_t> deltas;
+		for (std::size_t i = 1; i < times.size(); ++i) {
+			deltas.push_back(times[i] - times[i - 1]);
+		}
+		double mean = 0.0, squares = 0.0;
+		for (auto dt : deltas) mean += (double)dt / (double)deltas.size();
+		for (auto dt : deltas) squares += ((double)dt - mean) * ((double)dt - mean);
+
+		auto stats = series.getDeltasStatistics();
+		ASSERT_EQ(stats.count, deltas.size(), name + " count");
+		ASSERT_EQ(stats.min, *std::min_element(deltas.begin(), deltas.end()), name + " min");
+		ASSERT_EQ(stats.max, *std::max_element(deltas.begin(), deltas.end()), name + " max");
+		ASSERT_LT(std::abs(stats.mean - mean), 1e-6 * mean, name + " mean");
+		double deviation = std::sqrt(squares / (double)deltas.size());
+		ASSERT_LT(std::abs(stats.deviation - deviation), 1e-6 * mean, name + " deviation");
+		ASSERT_EQ(series.getDeltasDeviation(), stats.deviation, name + " deviation getter");
+	}
+
+public:
+	DeltaStatisticsTest() : MoccarduinoTest("time-series/delta-statistics") {}
+
+	virtual void run() const
+	{
+		std::vector<logtime_t> times;
+		logtime_t t = 1000;
+		for (std::size_t i = 0; i < 1003; ++i) {
+			t += 1000000 + (i * 7919) % 2001;
+			times.push_back(t);
+		}
+		testSeries<TimeSeries<int>>(times, "regular");
+		testSeries<ColumnarTimeSeries<int>>(times, "regular columnar");
+
+		// the squares of these deltas overflow 64-bit integers
+		std::vector<logtime_t> longDeltas = { 0, 1ull << 40, 1ull << 41, (1ull << 41) + 5, 1ull << 62, (1ull << 62) + 1 };
+		testSeries<TimeSeries<int>>(longDeltas, "long");
+		testSeries<ColumnarTimeSeries<int>>(longDeltas, "long columnar");
+
+		TimeSeries<int> series;
+		for (logtime_t time : { 0, 10, 30, 60, 100, 150 }) {
+			series.addEvent(time, 0);
+		}
+		auto percentiles = series.getDeltasPercentiles({ 0, 20, 50, 90, 100 });
+		std::vector<logtime_t> expected = { 10, 10, 30, 50, 50 };
+		for (std::size_t i = 0; i < expected.size(); ++i) {
+			ASSERT_EQ(percentiles[i], expected[i], "percentile " + std::to_string(i));
+		}
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { series.getDeltasPercentile(101); }, "percentile out of range");
+
+		auto histogram = series.getDeltasHistogram(15, 10, 3);
+		ASSERT_EQ(histogram[0], 2, "deltas below and in the first bucket"); // 10, 20
+		ASSERT_EQ(histogram[1], 1, "deltas in the second bucket"); // 30
+		ASSERT_EQ(histogram[2], 2, "deltas in and above the last bucket"); // 40, 50
+	}
+};
+
+
+DeltaStatisticsTest _deltaStatisticsTest;
+
+
+/**
+ * Checks the subsequence search against the original brute force algorithms (random inputs) and verifies
+ * the complexity on a worst case input (by counting the comparisons).
+ */
+class TimeSeriesSubsequenceTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Value which counts its comparisons.
+	 */
+	struct Value
+	{
+		static std::size_t comparisons;
+		int value;
+
+		Value(int v = 0) : value(v) {}
+
+		bool operator==(const Value& v) const
+		{
+			++comparisons;
+			return value == v.value;
+		}
+
+		bool operator!=(const Value& v) const
+		{
+			return !(*this == v);
+		}
+
+		operator std::string() const
+		{
+			return std::to_string(value);
+		}
+	};
+
+	using series_t = TimeSeries<Value>;
+
+	static series_t::Range bruteForceSubsequence(const std::vector<Value>& values, const std::vector<Value>& sequence)
+	{
+		series_t::Range bestFit(0, 0);
+		for (std::size_t start = 0; start < values.size() - bestFit.length(); ++start) {
+			std::size_t len = 0;
+			while (len < sequence.size() && start + len < values.size() && sequence[len] == values[start + len]) {
+				++len;
+			}
+			if (len > bestFit.length()) {
+				bestFit.set(start, start + len);
+			}
+		}
+		return bestFit;
+	}
+
+	static series_t::Range bruteForceRepetitiveSubsequence(const std::vector<Value>& values, const std::vector<Value>& sequence)
+	{
+		if (sequence.size() > values.size()) {
+			return series_t::Range(0, 0);
+		}
+
+		std::vector<bool> isStartingPoint(values.size());
+		for (std::size_t start = 0; start <= values.size() - sequence.size(); ++start) {
+			std::size_t len = 0;
+			while (len < sequence.size() && sequence[len] == values[start + len]) {
+				++len;
+			}
+			isStartingPoint[start] = len == sequence.size();
+		}
+
+		series_t::Range bestFit(0, 0);
+		for (std::size_t start = 0; start < values.size(); ++start) {
+			std::size_t len = 0;
+			while (isStartingPoint[start] && start + len < values.size() && isStartingPoint[start + len]) {
+				len += sequence.size();
+			}
+			if (len > bestFit.length()) {
+				bestFit.set(start, start + len);
+			}
+		}
+		return bestFit;
+	}
+
+	static void fill(series_t& series, const std::vector<Value>& values)
+	{
+		logtime_t time = 0;
+		for (auto&& value : values) {
+			series.addEvent(++time, value);
+		}
+	}
+
+public:
+	TimeSeriesSubsequenceTest() : MoccarduinoTest("time-series/subsequence") {}
+
+	virtual void run() const
+	{
+		std::mt19937 random(42);
+		for (std::size_t i = 0; i < 200; ++i) {
+			std::vector<Value> values(1 + random() % 60), sequence(1 + random() % 6);
+			int alphabet = 1 + random() % 3;
+			for (auto& v : values) v.value = random() % alphabet;
+			for (auto& v : sequence) v.value = random() % alphabet;
+
+			series_t series;
+			fill(series, values);
+			auto range = series.findSubsequence(sequence), expected = bruteForceSubsequence(values, sequence);
+			ASSERT_TRUE(range.start() == expected.start() && range.end() == expected.end(), "findSubsequence() result");
+			range = series.findRepetitiveSubsequence(sequence);
+			expected = bruteForceRepetitiveSubsequence(values, sequence);
+			ASSERT_TRUE(range.start() == expected.start() && range.end() == expected.end(), "findRepetitiveSubsequence() result");
+		}
+
+		// worst case for the brute force -- almost matching prefixes everywhere
+		const std::size_t n = 20000, k = 100;
+		std::vector<Value> values(n, Value(0)), sequence(k, Value(0));
+		sequence.back().value = 1;
+		values.back().value = 1;
+		series_t series;
+		fill(series, values);
+
+		Value::comparisons = 0;
+		auto range = series.findSubsequence(sequence);
+		std::size_t linearComparisons = Value::comparisons;
+
+		Value::comparisons = 0;
+		auto expected = bruteForceSubsequence(values, sequence);
+		std::size_t bruteForceComparisons = Value::comparisons;
+
+		ASSERT_EQ(range.start(), n - k, "the only match");
+		ASSERT_EQ(range.start(), expected.start(), "the same match as brute force");
+		ASSERT_LE(linearComparisons, 2 * (n + k + 1), "linear number of comparisons");
+		ASSERT_GE(bruteForceComparisons, (n - k) * k, "quadratic number of comparisons");
+	}
+};
+
+std::size_t TimeSeriesSubsequenceTest::Value::comparisons = 0;
+
+TimeSeriesSubsequenceTest _timeSeriesSubsequenceTest;
+
+
+class TimeSeriesTimeQueriesTest : public MoccarduinoTest
+{
+private:
+	template<class SERIES>
+	void checkQueries(const SERIES& series, logtime_t maxTime, const std::string& name) const
+	{
+		for (logtime_t time = 0; time <= maxTime; ++time) {
+			// linear scan for comparison
+			std::size_t last = series.size(), first = series.size();
+			for (std::size_t i = 0; i < series.size(); ++i) {
+				if (series[i].time <= time) last = i;
+				if (series[i].time >= time && first == series.size()) first = i;
+			}
+
+			ASSERT_EQ(series.indexAtOrBefore(time), last, name + " index at or before " + std::to_string(time));
+			ASSERT_EQ(series.valueAt(time, -1), last < series.size() ? series[last].value : -1, name + " value at " + std::to_string(time));
+			auto range = series.rangeByTime(time, time + 5);
+			std::size_t count = 0;
+			for (std::size_t i = 0; i < series.size(); ++i) {
+				count += (series[i].time >= time && series[i].time < time + 5) ? 1 : 0;
+			}
+			ASSERT_EQ(range.start(), first, name + " range start at " + std::to_string(time));
+			ASSERT_EQ(range.length(), count, name + " range length at " + std::to_string(time));
+		}
+	}
+
+public:
+	TimeSeriesTimeQueriesTest() : MoccarduinoTest("time-series/time-queries") {}
+
+	virtual void run() const
+	{
+		std::mt19937 random(7);
+		TimeSeries<int> series, indexed;
+		ColumnarTimeSeries<int> columnar;
+		indexed.setTimeIndex(4);
+		columnar.setTimeIndex(3);
+		logtime_t time = 10;
+		for (int i = 0; i < 100; ++i) {
+			time += random() % 4; // with repeated time stamps
+			series.addEvent(time, i);
+			indexed.addEvent(time, i);
+			columnar.addEvent(time, i);
+		}
+
+		checkQueries(series, time + 10, "plain");
+		checkQueries(indexed, time + 10, "indexed");
+		checkQueries(columnar, time + 10, "columnar");
+
+		// future events are inserted in the middle of the series
+		FutureTimeSeries<int> future;
+		future.setTimeIndex(2);
+		for (int i = 0; i < 60; ++i) {
+			future.addFutureEvent(10 + random() % 200, i);
+		}
+		checkQueries(future, 220, "future");
+		future.addTimingSkew(3);
+		checkQueries(future, 220, "future skewed");
+	}
+};
+
+
+TimeSeriesTimeQueriesTest _timeSeriesTimeQueriesTest;
+
+
+class FutureTimeSeriesBulkTest : public MoccarduinoTest
+{
+public:
+	FutureTimeSeriesBulkTest() : MoccarduinoTest("time-series/future-bulk") {}
+
+	virtual void run() const
+	{
+		std::mt19937 random(7);
+		FutureTimeSeries<int> single, bulk, deferred;
+		TimeSeries<int> singleEmitted, bulkEmitted, deferredEmitted;
+		single.attachNextConsumer(singleEmitted);
+		bulk.attachNextConsumer(bulkEmitted);
+		deferred.attachNextConsumer(deferredEmitted);
+		deferred.setDeferredMerge();
+
+		// batches interleaved with the pending events (and partially consumed)
+		logtime_t now = 0;
+		int value = 0;
+		for (int round = 0; round < 20; ++round) {
+			std::vector<TimedEvent<int>> batch;
+			for (int i = 0; i < 50; ++i) {
+				batch.emplace_back(now + random() % 1000, value++); // with repeated time stamps
+			}
+			for (auto& event : batch) {
+				single.addFutureEvent(event.time, event.value);
+				deferred.addFutureEvent(event.time, event.value);
+			}
+			bulk.addFutureEvents(batch);
+
+			std::string name = "round " + std::to_string(round);
+			ASSERT_EQ(bulk.size(), single.size(), name + " size");
+			for (std::size_t i = 0; i < single.size(); ++i) {
+				ASSERT_TRUE(bulk[i] == single[i], name + " event #" + std::to_string(i));
+			}
+			ASSERT_EQ(bulk.nextEventTime(), single.nextEventTime(), name + " next event");
+			ASSERT_EQ(deferred.nextEventTime(), single.nextEventTime(), name + " next deferred event");
+
+			now += random() % 500;
+			single.advanceTime(now);
+			bulk.advanceTime(now);
+			deferred.advanceTime(now);
+			ASSERT_EQ(bulkEmitted.size(), singleEmitted.size(), name + " emitted");
+			ASSERT_EQ(deferredEmitted.size(), singleEmitted.size(), name + " emitted deferred");
+		}
+		for (std::size_t i = 0; i < singleEmitted.size(); ++i) {
+			ASSERT_TRUE(bulkEmitted[i] == singleEmitted[i] && deferredEmitted[i] == singleEmitted[i], "emitted event #" + std::to_string(i));
+		}
+		deferred.mergeEvents();
+		ASSERT_EQ(deferred.size(), single.size(), "merged deferred events");
+		for (std::size_t i = 0; i < single.size(); ++i) {
+			ASSERT_TRUE(deferred[i] == single[i], "merged deferred event #" + std::to_string(i));
+		}
+
+		// the batch is rejected as a whole
+		std::size_t size = bulk.size();
+		std::vector<TimedEvent<int>> invalid{ { now + 10, 1 }, { now - 1, 2 } };
+		ASSERT_EXCEPTION(std::runtime_error, [&]() { bulk.addFutureEvents(invalid); }, "causality");
+		ASSERT_EQ(bulk.size(), size, "rejected batch");
+
+		// large batch in reverse order
+		FutureTimeSeries<int> reversed;
+		std::vector<TimedEvent<int>> events;
+		for (int i = 100000; i > 0; --i) {
+			events.emplace_back((logtime_t)i * 10, i);
+		}
+		reversed.addFutureEvents(events);
+		for (std::size_t i = 0; i < reversed.size(); ++i) {
+			ASSERT_EQ(reversed[i].value, (int)i + 1, "reversed batch #" + std::to_string(i));
+		}
+	}
+};
+
+
+FutureTimeSeriesBulkTest _futureTimeSeriesBulkTest;
+
+
+class BoundedTimeSeriesTest : public MoccarduinoTest
+{
+private:
+	/**
+	 * Verify that the evicted and the held events together form the whole history.
+	 */
+	void checkHistory(const BoundedTimeSeries<int>& bounded, const TimeSeries<int>& evicted, const TimeSeries<int>& all, const std::string& name) const
+	{
+		ASSERT_EQ(evicted.size(), bounded.evictedCount(), name + " evicted count");
+		ASSERT_EQ(evicted.size() + bounded.size(), all.size(), name + " total count");
+		for (std::size_t i = 0; i < all.size(); ++i) {
+			const auto& e = i < evicted.size() ? evicted[i] : bounded[i - evicted.size()];
+			ASSERT_TRUE(e == all[i], name + " event #" + std::to_string(i));
+		}
+	}
+
+public:
+	BoundedTimeSeriesTest() : MoccarduinoTest("time-series/bounded") {}
+
+	virtual void run() const
+	{
+		std::mt19937 random(11);
+		TimeSeries<int> all, evictedByCount, evictedBySpan;
+		BoundedTimeSeries<int> byCount(50, 0, 10), bySpan(0, 100);
+		byCount.attachEvictionSink(evictedByCount);
+		bySpan.attachEvictionSink(evictedBySpan);
+
+		logtime_t time = 0;
+		for (int i = 0; i < 1000; ++i) {
+			time += random() % 10;
+			all.addEvent(time, i);
+			byCount.addEvent(time, i);
+			bySpan.addEvent(time, i);
+			ASSERT_TRUE(byCount.size() <= 60 && byCount.size() >= std::min<std::size_t>(50, all.size()), "count retention");
+			ASSERT_TRUE(bySpan.size() <= 128, "expired events are evicted (lazily)");
+		}
+		checkHistory(byCount, evictedByCount, all, "by count");
+		checkHistory(bySpan, evictedBySpan, all, "by span");
+
+		bySpan.trim();
+		ASSERT_TRUE(bySpan.front().time + 100 >= time, "trimmed span retention");
+		checkHistory(bySpan, evictedBySpan, all, "trimmed by span");
+
+		// batches go through the same retention
+		std::vector<TimedEvent<int>> batch;
+		for (int i = 0; i < 333; ++i) {
+			batch.emplace_back(++time, -i);
+		}
+		all.addEvents(batch);
+		byCount.addEvents(batch);
+		ASSERT_EQ(byCount.back().value, -332, "last event of the batch");
+		checkHistory(byCount, evictedByCount, all, "batch by count");
+
+		byCount.flush();
+		ASSERT_TRUE(byCount.empty(), "flushed series is empty");
+		checkHistory(byCount, evictedByCount, all, "flushed by count");
+	}
+};
+
+
+BoundedTimeSeriesTest _boundedTimeSeriesTest;
@@ -2,7 +2,6 @@
 #include "emulator.hpp"
 
 #include <stdexcept>
-#include <random>
 #include <cctype>
 
 ArduinoEmulator *emulator;
@@ -90,11 +89,8 @@ void noTone(std::uint8_t pin) {
 
 // Random numbers
 
-std::default_random_engine random_engine;
-
 long random(long min, long max) {
-	std::uniform_int_distribution<long> distribution(min, max);
-	return distribution(random_engine);
+	return emulator->random(min, max);
 }
 
 long random(long max) {
@@ -102,7 +98,7 @@ long random(long max) {
 }
 
 void randomSeed(unsigned long seed) {
-	random_engine.seed(seed);
+	emulator->randomSeed(seed);
 }
 
 // Math
@@ -185,6 +181,7 @@ void SerialMock::print(TYPE val, SerialPrintFormat format)\
 	if (!emulator->isSerialEnabled()) {\
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");\
 	}\
+	emulator->registerSideEffect();\
 }\
 \
 void SerialMock::println(TYPE val, SerialPrintFormat format)\
@@ -192,6 +189,7 @@ void SerialMock::println(TYPE val, SerialPrintFormat format)\
 	if (!emulator->isSerialEnabled()) {\
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");\
 	}\
+	emulator->registerSideEffect();\
 }
 
 SERIAL_MOCK_PRINT_GEN(char)
@@ -208,24 +206,28 @@ void SerialMock::print(double val) {
 	if (!emulator->isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator->registerSideEffect();
 }
 
 void SerialMock::print(const char* val) {
 	if (!emulator->isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator->registerSideEffect();
 }
 
 void SerialMock::println(double val) {
 	if (!emulator->isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator->registerSideEffect();
 }
 
 void SerialMock::println(const char* val) {
 	if (!emulator->isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator->registerSideEffect();
 }
 
 std::size_t SerialMock::available() const {
@@ -7,15 +7,26 @@
 
 #include <deque>
 #include <map>
+#include <array>
+#include <bitset>
+#include <vector>
 #include <memory>
 #include <string>
 #include <sstream>
 #include <stdexcept>
 #include <cctype>
 #include <random>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
 
 using pin_t = std::uint8_t;
 
+/**
+ * Total number of pins that can be addressed by pin_t (size of the pin tables).
+ */
+constexpr std::size_t PINS_COUNT = (std::size_t)std::numeric_limits<pin_t>::max() + 1;
+
 
 class ArduinoSimulationController; // forward declaration, so we can befriend this class
 
@@ -72,6 +83,229 @@ public:
 };
 
 
+/**
+ * Transaction-level event that represents one shiftOut() invocation. The transaction is equivalent to 24 pin events:
+ * for each bit, the data pin is written and then the clock pin is set HIGH and LOW. Subsequent pin events are separated
+ * by a constant write delay (so their logical timestamps are exactly the same as if the writes were made one by one).
+ */
+struct ArduinoShiftOutEvent
+{
+	static constexpr std::size_t PIN_EVENTS = 24;
+
+	pin_t dataPin;
+	pin_t clockPin;
+	std::uint8_t bitOrder;	///< LSBFIRST or MSBFIRST
+	std::uint8_t value;		///< shifted byte
+	logtime_t time;			///< time of the first pin event
+	logtime_t writeDelay;	///< delay between two pin events
+
+	/**
+	 * Get the i-th bit of the value in the order of transmission.
+	 */
+	int getBit(std::size_t i) const
+	{
+		return bitOrder == LSBFIRST ? (value >> i) & 1 : (value >> (7 - i)) & 1;
+	}
+
+	/**
+	 * Get the timestamp of the pin event with given index (0 .. PIN_EVENTS-1).
+	 */
+	logtime_t eventTime(std::size_t idx) const
+	{
+		return time + idx * writeDelay;
+	}
+
+	logtime_t lastEventTime() const
+	{
+		return eventTime(PIN_EVENTS - 1);
+	}
+
+	/**
+	 * Feed the equivalent pin events to given consumer (edge expansion).
+	 * @param dataEvents whether the events of the data pin are included
+	 * @param clockEvents whether the events of the clock pin are included
+	 */
+	void expand(EventConsumer<ArduinoPinState>& consumer, bool dataEvents = true, bool clockEvents = true) const
+	{
+		for (std::size_t i = 0; i < 8; ++i) {
+			if (dataEvents) {
+				consumer.addEvent(eventTime(3 * i), ArduinoPinState(dataPin, getBit(i)));
+			}
+			if (clockEvents) {
+				consumer.addEvent(eventTime(3 * i + 1), ArduinoPinState(clockPin, HIGH));
+				consumer.addEvent(eventTime(3 * i + 2), ArduinoPinState(clockPin, LOW));
+			}
+		}
+	}
+};
+
+
+/**
+ * Interface of pin event consumers that understand shiftOut() transactions, so they do not need to process
+ * the individual events of data and clock pins.
+ */
+class ArduinoShiftOutConsumer
+{
+public:
+	virtual ~ArduinoShiftOutConsumer() = default;
+
+	/**
+	 * Process the transaction. The consumer is responsible for passing it to the next consumer in chain (see deliver()).
+	 */
+	virtual void addShiftOutEvent(const ArduinoShiftOutEvent& event) = 0;
+
+	/**
+	 * Deliver the transaction to given consumer (if not null). Consumers which do not understand the transactions
+	 * receive the individual pin events.
+	 */
+	static void deliver(EventConsumer<ArduinoPinState>* consumer, const ArduinoShiftOutEvent& event)
+	{
+		if (consumer == nullptr) {
+			return;
+		}
+
+		auto transactionConsumer = dynamic_cast<ArduinoShiftOutConsumer*>(consumer);
+		if (transactionConsumer != nullptr) {
+			transactionConsumer->addShiftOutEvent(event);
+		}
+		else {
+			event.expand(*consumer);
+		}
+	}
+};
+
+
+/**
+ * Fan-out node for pin events. The events are delivered to a flat list of subscribers (in the order of subscription),
+ * each subscriber receives only the events of the pins it has subscribed for. Unlike a chain of consumers,
+ * the subscribers do not pass events through each other, so independent analyses attached to the same pins
+ * do not slow down each other and a consumer attached to several pins never sees events of other pins.
+ * Time notifications and clear notifications are delivered to all subscribers.
+ */
+class ArduinoPinEventsBroadcast : public EventConsumer<ArduinoPinState>, public ArduinoShiftOutConsumer
+{
+public:
+	struct Subscriber
+	{
+		EventConsumer<ArduinoPinState>* consumer;
+		std::bitset<PINS_COUNT> pins;
+	};
+
+private:
+	std::vector<Subscriber> mSubscribers;
+
+	/**
+	 * True if the subscribers have been notified about mLastTime and no event has arrived since
+	 * (each pin forwards the same time notification, so the repeated ones are not delivered).
+	 */
+	bool mTimeNotified;
+
+protected:
+	void doAddEvent(logtime_t time, ArduinoPinState state) override
+	{
+		for (auto& subscriber : mSubscribers) {
+			if (subscriber.pins[state.pin]) {
+				subscriber.consumer->addEvent(time, state);
+			}
+		}
+		mTimeNotified = false;
+		EventConsumer<ArduinoPinState>::doAddEvent(time, state);
+	}
+
+	void doAdvanceTime(logtime_t time) override
+	{
+		if (mTimeNotified && time == mLastTime) {
+			return;
+		}
+
+		for (auto& subscriber : mSubscribers) {
+			subscriber.consumer->advanceTime(time);
+		}
+		mTimeNotified = true;
+		EventConsumer<ArduinoPinState>::doAdvanceTime(time);
+	}
+
+	void doClear() override
+	{
+		for (auto& subscriber : mSubscribers) {
+			subscriber.consumer->clear();
+		}
+		EventConsumer<ArduinoPinState>::doClear();
+	}
+
+public:
+	ArduinoPinEventsBroadcast() : mTimeNotified(false) {}
+
+	/**
+	 * Subscribe given consumer for the events of a pin. One consumer may be subscribed for multiple pins.
+	 */
+	void subscribe(EventConsumer<ArduinoPinState>& consumer, pin_t pin)
+	{
+		for (auto& subscriber : mSubscribers) {
+			if (subscriber.consumer == &consumer) {
+				subscriber.pins[pin] = true;
+				return;
+			}
+		}
+		mSubscribers.push_back({ &consumer, {} });
+		mSubscribers.back().pins[pin] = true;
+	}
+
+	/**
+	 * Remove given consumer from the subscribers (of all pins).
+	 */
+	void unsubscribe(EventConsumer<ArduinoPinState>& consumer)
+	{
+		mSubscribers.erase(std::remove_if(mSubscribers.begin(), mSubscribers.end(),
+			[&](const Subscriber& subscriber) { return subscriber.consumer == &consumer; }), mSubscribers.end());
+	}
+
+	const std::vector<Subscriber>& subscribers() const
+	{
+		return mSubscribers;
+	}
+
+	/**
+	 * Clear only the subscribers of given pin.
+	 */
+	void clearPin(pin_t pin)
+	{
+		for (auto& subscriber : mSubscribers) {
+			if (subscriber.pins[pin]) {
+				subscriber.consumer->clear();
+			}
+		}
+	}
+
+	/**
+	 * Subscribers of both pins receive the transaction, subscribers of one of the pins receive its individual events.
+	 * Only the logical time of the node itself stays at the beginning of the transaction, subscribers (and the next
+	 * consumer) may be advanced to its end. Therefore, the emulator emits a transaction only if no input event
+	 * is due before the transaction ends (see ArduinoEmulator::shiftOutTransaction()).
+	 */
+	void addShiftOutEvent(const ArduinoShiftOutEvent& event) override
+	{
+		if (event.time < mLastTime) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+
+		for (auto& subscriber : mSubscribers) {
+			bool data = subscriber.pins[event.dataPin];
+			bool clock = subscriber.pins[event.clockPin];
+			if (data && clock) {
+				ArduinoShiftOutConsumer::deliver(subscriber.consumer, event);
+			}
+			else if (data || clock) {
+				event.expand(*subscriber.consumer, data, clock);
+			}
+		}
+		mTimeNotified = false;
+		mLastTime = event.time;
+		ArduinoShiftOutConsumer::deliver(nextConsumer(), event);
+	}
+};
+
+
 class ArduinoEmulator;
 
 /**
@@ -93,6 +327,11 @@ private:
 	int mWiring;	///< how the pin is actually wired (INPUT/OUTPUT)
 	int mMode;		///< current operating mode (INPUT/OUTPUT)
 
+	/**
+	 * If true, writes which do not change the value emit only time notifications (not events).
+	 */
+	bool mSuppressUnchanged;
+
 	/*
 	 * Interface for the simulator.
 	 */
@@ -114,7 +353,17 @@ protected:
 
 
 public:
-	ArduinoPin(pin_t pin, int wiring = UNDEFINED) : mState(pin, UNDEFINED), mWiring(wiring), mMode(UNDEFINED) {}
+	ArduinoPin() : mState(), mWiring(UNDEFINED), mMode(UNDEFINED), mSuppressUnchanged(false) {}
+	ArduinoPin(pin_t pin, int wiring = UNDEFINED) : mState(pin, UNDEFINED), mWiring(wiring), mMode(UNDEFINED), mSuppressUnchanged(false) {}
+
+	/**
+	 * Enable or disable suppression of writes that do not change the value of the pin. When enabled, such writes
+	 * are passed to consumers only as time notifications (consumers which need every write must not use it).
+	 */
+	void setSuppressUnchanged(bool suppress = true)
+	{
+		mSuppressUnchanged = suppress;
+	}
 
 	/**
 	 * Change the mode of the pin. This can be done only once (typically in setup).
@@ -168,9 +417,27 @@ public:
 			throw ArduinoEmulatorException("Unable to write data to an input pin.");
 		}
 
+		if (mSuppressUnchanged && mState.value == value) {
+			advanceTime(time);
+			return;
+		}
+
 		mState.value = value;
 		addEvent(time, mState);
 	}
+
+	/**
+	 * Change the value of an output pin without emitting the event (the events are delivered
+	 * to consumers as a transaction, see ArduinoShiftOutEvent).
+	 */
+	void writeSilently(int value, logtime_t time)
+	{
+		if (time < mLastTime) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+		mState.value = value;
+		mLastTime = time;
+	}
 };
 
 
@@ -182,6 +449,21 @@ public:
 class ArduinoEmulator
 {
 friend class ArduinoSimulationController;
+public:
+	/**
+	 * Saved state of the emulator and of the tested code (see createSnapshot()).
+	 */
+	struct Snapshot
+	{
+		logtime_t currentTime;
+		std::vector<ArduinoPin> pins; ///< copies of registered pins (in the order of registration)
+		std::deque<char> serialData;
+		bool loopSideEffects;
+		logtime_t loopTimeSlack;
+		std::default_random_engine randomEngine;
+		ArduinoProgramSnapshot program;
+	};
+
 private:
 	/**
 	 * Current timestamp in microseconds (time elapsed from the start).
@@ -190,15 +472,38 @@ private:
 	logtime_t mCurrentTime;
 
 	/**
-	 * Pins of the arduino and their state.
+	 * Pins of the arduino and their state. The table is indexed directly by pin numbers,
+	 * only slots marked in mRegisteredPins hold valid (registered) pins.
+	 */
+	std::array<ArduinoPin, PINS_COUNT> mPins;
+
+	/**
+	 * Bitmask of registered pins (slots of mPins which are in use).
+	 */
+	std::bitset<PINS_COUNT> mRegisteredPins;
+
+	/**
+	 * Compact list of registered pins (in order of registration), so we can iterate over them quickly.
 	 */
-	std::map<pin_t, ArduinoPin> mPins;
+	std::vector<pin_t> mActivePins;
 
 	/**
-	 * Cache for future time series that feed the input pins.
+	 * Cache for future time series that feed the input pins (indexed by pin numbers, null if pin has no input).
 	 * These series need to be attached to emulator, so it can properly advance their time.
 	 */
-	std::map<pin_t, EventConsumer<ArduinoPinState>*> mInputs;
+	std::array<EventConsumer<ArduinoPinState>*, PINS_COUNT> mInputs;
+
+	/**
+	 * Compact list of pins which have an input attached (non-null items of mInputs).
+	 */
+	std::vector<pin_t> mInputPins;
+
+	/**
+	 * Earliest time when one of the inputs emits another event (event horizon).
+	 * Time notifications are propagated to the inputs only when the current time crosses this horizon.
+	 * Zero means the horizon is unknown and it will be recomputed with the next time update.
+	 */
+	logtime_t mTimeHorizon;
 
 	// Guards that prevent certain function from being called.
 	bool mEnablePinMode;
@@ -219,6 +524,11 @@ private:
 	bool mEnableNoTone;
 	bool mEnableSerial;
 
+	/**
+	 * If true, shiftOut() emits one transaction instead of individual pin events when possible.
+	 */
+	bool mShiftOutTransactions;
+
 	// Timing parameters
 	logtime_t mPinReadDelay;
 	logtime_t mPinWriteDelay;
@@ -229,6 +539,23 @@ private:
 	 */
 	std::deque<char> mSerialData;
 
+	/**
+	 * True if the last (or current) loop() invocation performed an action with observable side effects
+	 * (pin writes, serial I/O, ...). Loops without side effects are idle and may be fast-forwarded.
+	 */
+	bool mLoopSideEffects;
+
+	/**
+	 * How much time may pass before any of the time values read by the last (or current) loop()
+	 * using millis() or micros() would change (relative to the moment they were read).
+	 */
+	logtime_t mLoopTimeSlack;
+
+	/**
+	 * Pseudo-random generator used by random() (each emulator has its own).
+	 */
+	std::default_random_engine mRandomEngine;
+
 	/**
 	 * Manages the student's Arduino program and handles runtime function linkage.
 	*/
@@ -237,35 +564,89 @@ private:
 	void reset()
 	{
 		mCurrentTime = 0;
+		mTimeHorizon = 0;
 
-		for (auto& [_, input] : mInputs) {
-			input->clear();
+		for (auto pin : mInputPins) {
+			mInputs[pin]->clear();
 		}
 
-		for (auto& [_, arduinoPin] : mPins) {
-			arduinoPin.reset();
+		for (auto pin : mActivePins) {
+			mPins[pin].reset();
 		}
 
 		mSerialData.clear();
 	}
 
+	/**
+	 * Compute the earliest time when any of the input chains emits an event.
+	 */
+	void updateTimeHorizon()
+	{
+		mTimeHorizon = std::numeric_limits<logtime_t>::max();
+		for (auto pin : mInputPins) {
+			// the chain ends with the input pin (and continues with pin consumers which are not inputs)
+			const EventConsumer<ArduinoPinState>* stop = &mPins[pin];
+			for (auto consumer = mInputs[pin]; consumer != nullptr && consumer != stop; consumer = consumer->nextConsumer()) {
+				mTimeHorizon = std::min(mTimeHorizon, consumer->nextEventTime());
+			}
+		}
+	}
+
+	/**
+	 * Force recomputation of the event horizon with the next time update
+	 * (has to be called whenever new input events may have been scheduled).
+	 */
+	void invalidateTimeHorizon()
+	{
+		mTimeHorizon = 0;
+	}
+
+	/**
+	 * Propagate current time to all inputs, so they emit their pending events.
+	 */
+	void advanceInputsTime()
+	{
+		for (auto pin : mInputPins) {
+			mInputs[pin]->advanceTime(mCurrentTime);
+		}
+		updateTimeHorizon();
+	}
+
 	/**
 	 * Advances the Arduino emulator time forward by given number of microseconds.
+	 * The time is propagated lazily -- only inputs are notified and only when the event horizon is crossed.
+	 * Pin consumers are notified by synchronizeTime() which is invoked by the simulation controller.
 	 * @param us relative logical time in microseconds
 	 * @return time after update
 	 */
 	logtime_t advanceCurrentTimeBy(logtime_t us)
 	{
 		mCurrentTime += us;
-
-		for (auto& [_, input] : mInputs) {
-			input->advanceTime(mCurrentTime);
+		if (mCurrentTime >= mTimeHorizon) {
+			advanceInputsTime();
 		}
+		return mCurrentTime;
+	}
+
+	/**
+	 * Return the time of the nearest event any of the inputs will emit (max. value if there are none).
+	 */
+	logtime_t getNextInputEventTime()
+	{
+		updateTimeHorizon();
+		return mTimeHorizon;
+	}
 
-		for (auto& [_, arduinoPin] : mPins) {
-			arduinoPin.advanceTime(mCurrentTime);
+	/**
+	 * Propagate current time to all inputs and all pins (and their consumers).
+	 * This needs to be called before anyone outside the emulator observes the state of the pins or their consumers.
+	 */
+	void synchronizeTime()
+	{
+		advanceInputsTime();
+		for (auto pin : mActivePins) {
+			mPins[pin].advanceTime(mCurrentTime);
 		}
-		return mCurrentTime;
 	}
 
 	/**
@@ -273,12 +654,11 @@ private:
 	 */
 	ArduinoPin& getPin(pin_t pin)
 	{
-		auto it = mPins.find(pin);
-		if (it == mPins.end()) {
+		if (!mRegisteredPins[pin]) {
 			throw ArduinoEmulatorException("Trying to reach pin which is not defined in the emulator.");
 		}
 
-		return it->second;
+		return mPins[pin];
 	}
 
 	/**
@@ -286,8 +666,15 @@ private:
 	 */
 	void removeAllPins()
 	{
-		mInputs.clear();
-		mPins.clear();
+		for (auto pin : mActivePins) {
+			mPins[pin] = ArduinoPin(); // detaches all consumers as well
+		}
+		mRegisteredPins.reset();
+		mActivePins.clear();
+
+		mInputs.fill(nullptr);
+		mInputPins.clear();
+		invalidateTimeHorizon();
 	}
 
 	/**
@@ -295,11 +682,12 @@ private:
 	 */
 	void registerPin(pin_t pin, int wiring = ArduinoPin::UNDEFINED)
 	{
-		auto it = mPins.find(pin);
-		if (it != mPins.end()) {
+		if (mRegisteredPins[pin]) {
 			throw ArduinoEmulatorException("Given pin already exists.");
 		}
-		mPins.emplace(pin,ArduinoPin(pin, wiring));
+		mPins[pin] = ArduinoPin(pin, wiring);
+		mRegisteredPins[pin] = true;
+		mActivePins.push_back(pin);
 	}
 
 	/**
@@ -315,23 +703,122 @@ private:
 		}
 
 		// detach old input chain first (if exists)
-		auto it = mInputs.find(pin);
-		if (it != mInputs.end()) {
-			it->second->lastConsumer()->detachNextConsumer();
+		if (mInputs[pin] != nullptr) {
+			mInputs[pin]->lastConsumer()->detachNextConsumer();
+		}
+		else {
+			mInputPins.push_back(pin);
 		}
 
 		// attach the corresponding input pin at the end of consumer chain
 		input.lastConsumer()->attachNextConsumer(arduinoPin);
 		mInputs[pin] = &input;
+		invalidateTimeHorizon();
 	}
 
 	/**
 	* Load the student's code and perform static object initialization.
 	* Used by the simulator after it gets properly initialized.
+	* @param isolated if true, a private copy of the code is loaded (so it does not share globals with other emulators)
 	*/
-	void loadTestedCode(const std::string &fileName)
+	void loadTestedCode(const std::string &fileName, bool isolated = false)
+	{
+		mProgramManager.loadProgram(fileName, isolated);
+	}
+
+	/**
+	 * Use given functions as the tested code (see ArduinoProgramManager::setProgram()).
+	 */
+	void setTestedCode(void (*setup)(), void (*loop)())
+	{
+		mProgramManager.setProgram(setup, loop);
+	}
+
+	/**
+	 * Whether the student's code has already been loaded (e.g., preloaded before the simulation was set up).
+	 */
+	bool isTestedCodeLoaded() const
+	{
+		return mProgramManager.isLoaded();
+	}
+
+	/**
+	 * Save the state of the emulator (time, registered pins and their consumer links, serial buffer, random generator)
+	 * together with global variables of the tested code.
+	 */
+	Snapshot createSnapshot() const
+	{
+		Snapshot snapshot;
+		snapshot.currentTime = mCurrentTime;
+		for (auto pin : mActivePins) {
+			snapshot.pins.push_back(mPins[pin]);
+		}
+		snapshot.serialData = mSerialData;
+		snapshot.loopSideEffects = mLoopSideEffects;
+		snapshot.loopTimeSlack = mLoopTimeSlack;
+		snapshot.randomEngine = mRandomEngine;
+		snapshot.program = mProgramManager.createSnapshot();
+		return snapshot;
+	}
+
+	/**
+	 * Restore the state saved by createSnapshot(). The same pins must be registered.
+	 */
+	void restoreSnapshot(const Snapshot& snapshot)
 	{
-		mProgramManager.loadProgram(fileName);
+		if (snapshot.pins.size() != mActivePins.size()) {
+			throw ArduinoEmulatorException("The snapshot does not match registered pins.");
+		}
+		for (std::size_t i = 0; i < mActivePins.size(); ++i) {
+			if (snapshot.pins[i].mState.pin != mActivePins[i]) {
+				throw ArduinoEmulatorException("The snapshot does not match registered pins.");
+			}
+		}
+
+		mProgramManager.restoreSnapshot(snapshot.program);
+		for (std::size_t i = 0; i < mActivePins.size(); ++i) {
+			mPins[mActivePins[i]] = snapshot.pins[i];
+		}
+		mCurrentTime = snapshot.currentTime;
+		mSerialData = snapshot.serialData;
+		mLoopSideEffects = snapshot.loopSideEffects;
+		mLoopTimeSlack = snapshot.loopTimeSlack;
+		mRandomEngine = snapshot.randomEngine;
+		invalidateTimeHorizon();
+	}
+
+	/**
+	 * Perform shiftOut() as one transaction (see ArduinoShiftOutEvent). The transaction is used only if both pins
+	 * are valid outputs which share the chain of consumers and no input event is due before the transaction ends
+	 * (consumers which receive the expanded transaction are advanced to its end), so the outcome is the same
+	 * as with individual writes.
+	 * @return false if the transaction cannot be used (the writes need to be made one by one)
+	 */
+	bool shiftOutTransaction(pin_t dataPin, pin_t clockPin, std::uint8_t bitOrder, std::uint8_t val)
+	{
+		if (!mShiftOutTransactions || !mEnableDigitalWrite || dataPin == clockPin
+			|| !mRegisteredPins[dataPin] || !mRegisteredPins[clockPin]) {
+			return false;
+		}
+
+		auto& data = mPins[dataPin];
+		auto& clock = mPins[clockPin];
+		if (data.mMode != OUTPUT || clock.mMode != OUTPUT || data.nextConsumer() != clock.nextConsumer()) {
+			return false;
+		}
+
+		ArduinoShiftOutEvent event{ dataPin, clockPin, bitOrder, val, mCurrentTime, mPinWriteDelay };
+		if (getNextInputEventTime() <= event.lastEventTime()) {
+			return false;
+		}
+
+		data.writeSilently(event.getBit(7), event.eventTime(ArduinoShiftOutEvent::PIN_EVENTS - 3));
+		clock.writeSilently(LOW, event.lastEventTime());
+		ArduinoShiftOutConsumer::deliver(data.nextConsumer(), event);
+
+		mLoopSideEffects = true;
+		advanceCurrentTimeBy(ArduinoShiftOutEvent::PIN_EVENTS * mPinWriteDelay);
+		return true;
 	}
 
 	/**
@@ -339,20 +826,25 @@ private:
 	 */
 	void invokeSetup()
 	{
+		invalidateTimeHorizon(); // input events may have been scheduled by the simulation
 		mProgramManager.runSetup();
 	}
 
 	/**
-	 * Abstraction of setup() invocation used by the simulator.
+	 * Abstraction of loop() invocation used by the simulator.
 	 */
 	void invokeLoop()
 	{
+		invalidateTimeHorizon(); // input events may have been scheduled by the simulation
+		mLoopSideEffects = false;
+		mLoopTimeSlack = std::numeric_limits<logtime_t>::max();
 		mProgramManager.runLoop();
 	}
 
 public:
 	ArduinoEmulator() :
 		mCurrentTime(0),
+		mTimeHorizon(0),
 		mEnablePinMode(true),
 		mEnableDigitalWrite(true),
 		mEnableDigitalRead(true),
@@ -370,11 +862,16 @@ public:
 		mEnableTone(true),
 		mEnableNoTone(true),
 		mEnableSerial(false),
+		mShiftOutTransactions(true),
 		mPinReadDelay(20),
 		mPinWriteDelay(20),
 		mPinSetModeDelay(100),
+		mLoopSideEffects(false),
+		mLoopTimeSlack(std::numeric_limits<logtime_t>::max()),
 		mProgramManager(this)
-	{}
+	{
+		mInputs.fill(nullptr);
+	}
 
 	/*
 	 * Interface available to the tested implementation. 
@@ -395,6 +892,7 @@ public:
 
 		auto& arduinoPin = getPin(pin);
 		arduinoPin.setMode(mode);
+		mLoopSideEffects = true;
 		advanceCurrentTimeBy(mPinSetModeDelay);
 	}
 
@@ -410,6 +908,7 @@ public:
 
 		auto& arduinoPin = getPin(pin);
 		arduinoPin.write(val, mCurrentTime);
+		mLoopSideEffects = true;
 		advanceCurrentTimeBy(mPinWriteDelay);
 	}
 
@@ -487,6 +986,8 @@ public:
 			throw ArduinoEmulatorException("The millis() function is disabled in the emulator.");
 		}
 
+		// the returned value remains the same until the next millisecond starts
+		mLoopTimeSlack = std::min(mLoopTimeSlack, 1000 - (mCurrentTime % 1000));
 		return (unsigned long)(mCurrentTime / 1000);
 	}
 
@@ -500,6 +1001,7 @@ public:
 			throw ArduinoEmulatorException("The micros() function is disabled in the emulator.");
 		}
 
+		mLoopTimeSlack = 1; // the returned value changes with every microsecond
 		return (unsigned long)mCurrentTime;
 	}
 
@@ -568,6 +1070,10 @@ public:
 			throw ArduinoEmulatorException("The shiftOut() function is disabled in the emulator.");
 		}
 		
+		if (shiftOutTransaction(dataPin, clockPin, bitOrder, val)) {
+			return;
+		}
+
 		// Taken from Arduino codebase (wiring_shift.c)
 		for (std::uint8_t i = 0; i < 8; i++) {
 			if (bitOrder == LSBFIRST) {
@@ -633,11 +1139,45 @@ public:
 		throw ArduinoEmulatorException("The noTone() function is not implemented in the emulator yet.");
 	}
 
+	// Random numbers
+
+	/**
+	 * Generates pseudo-random numbers.
+	 * https://www.arduino.cc/reference/en/language/functions/random-numbers/random/
+	 */
+	long random(long min, long max)
+	{
+		mLoopSideEffects = true; // generator state changes
+		std::uniform_int_distribution<long> distribution(min, max);
+		return distribution(mRandomEngine);
+	}
+
+	/**
+	 * Initializes the pseudo-random number generator.
+	 * https://www.arduino.cc/reference/en/language/functions/random-numbers/randomseed/
+	 */
+	void randomSeed(unsigned long seed)
+	{
+		mLoopSideEffects = true;
+		mRandomEngine.seed(seed);
+	}
+
+	// Serial
+
 	bool isSerialEnabled() const
 	{
 		return mEnableSerial;
 	}
 
+	/**
+	 * Mark the running loop() as not idle. Used by parts of the Arduino API implemented outside of the emulator
+	 * which have observable side effects (e.g., serial output).
+	 */
+	void registerSideEffect()
+	{
+		mLoopSideEffects = true;
+	}
+
 	/**
 	 * Enqueue additional serial data to be read by the emulated code.
 	 */
@@ -680,6 +1220,7 @@ public:
 
 		char res = mSerialData.front();
 		mSerialData.pop_front();
+		mLoopSideEffects = true;
 		return res;
 	}
 };
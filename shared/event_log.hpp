@@ -0,0 +1,598 @@
+#ifndef MOCCARDUINO_SHARED_EVENT_LOG_HPP
+#define MOCCARDUINO_SHARED_EVENT_LOG_HPP
+
+#include "time_series.hpp"
+#include "helpers.hpp"
+#include "mapped_file.hpp"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <iostream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+
+
+
+/*
+ * Binary event log is a compact alternative to CSV logs. The file holds multiple columns (time series) and every column
+ * is stored separately, so the reader can use the file directly (memory mapped) without any parsing.
+ *
+ * Layout (little endian, all sections are aligned to 8 bytes):
+ *   file header (EventLogHeader), column headers (EventLogColumnHeader), column names, then sections of the columns:
+ *   - times: time deltas (from the previous event of the column) encoded as LEB128 varints
+ *   - checkpoints: pairs (time of the previous event, offset in times section) for every CHECKPOINT_STRIDE-th event,
+ *     so any event time can be decoded without reading the whole column
+ *   - values: packed values, the layout depends on the type of the column (see EventLogType)
+ */
+
+/**
+ * Type tags of the event log columns.
+ */
+enum class EventLogType : std::uint8_t
+{
+	BOOL = 1,	///< bit-packed booleans
+	BITS = 2,	///< bit arrays (BitArray), fixed number of bytes per value
+	STRING = 3,	///< strings (offsets array of count+1 items followed by characters), double-quoted in CSV
+	TEXT = 4,	///< strings already formatted for CSV (used for values of other types)
+};
+
+struct EventLogHeader
+{
+	char magic[8];				///< EVENT_LOG_MAGIC
+	std::uint32_t version;
+	std::uint32_t columns;		///< number of column headers that follow
+};
+
+struct EventLogColumnHeader
+{
+	EventLogType type;
+	std::uint8_t reserved[3];
+	std::uint32_t valueBits;	///< number of bits of BITS values
+	std::uint32_t nameOffset;	///< offset of the name from the beginning of the file
+	std::uint32_t nameLength;
+	std::uint64_t count;		///< number of events
+	std::uint64_t timesOffset;
+	std::uint64_t timesSize;	///< size of the times section in bytes
+	std::uint64_t checkpointsOffset;
+	std::uint64_t valuesOffset;
+	std::uint64_t valuesSize;	///< size of the values section in bytes
+};
+
+
+namespace internal
+{
+	constexpr char EVENT_LOG_MAGIC[8] = { 'M', 'O', 'C', 'C', 'E', 'L', 'O', 'G' };
+	constexpr std::uint32_t EVENT_LOG_VERSION = 1;
+	constexpr std::size_t EVENT_LOG_CHECKPOINT_STRIDE = 64;
+
+	inline void verifyLittleEndian()
+	{
+		std::uint16_t probe = 1;
+		if (*reinterpret_cast<const std::uint8_t*>(&probe) != 1) {
+			throw std::runtime_error("Binary event logs are supported only on little endian platforms.");
+		}
+	}
+
+	inline std::size_t alignEventLogOffset(std::size_t offset)
+	{
+		return (offset + 7) & ~(std::size_t)7;
+	}
+
+	/**
+	 * Number of bits of a BitArray type (zero for other types).
+	 */
+	template<typename T>
+	struct EventLogBits
+	{
+		static constexpr int value = 0;
+	};
+
+	template<int N>
+	struct EventLogBits<BitArray<N>>
+	{
+		static constexpr int value = N;
+	};
+}
+
+
+/**
+ * Encodes time series into the binary event log. Columns are encoded when added, the file is assembled by write().
+ */
+class EventLogWriter
+{
+private:
+	struct Column
+	{
+		EventLogColumnHeader header;
+		std::string name;
+		std::vector<std::uint8_t> times;
+		std::vector<std::uint64_t> checkpoints;
+		std::vector<std::uint8_t> values;
+
+		Column(const std::string& _name, EventLogType type, std::uint32_t valueBits = 0) : header(), name(_name)
+		{
+			header.type = type;
+			header.valueBits = valueBits;
+		}
+	};
+
+	std::vector<Column> mColumns;
+
+	static void encodeTimes(Column& column, const TimeSeriesBase<logtime_t>& series)
+	{
+		logtime_t last = 0;
+		for (std::size_t i = 0; i < series.size(); ++i) {
+			if (i % internal::EVENT_LOG_CHECKPOINT_STRIDE == 0) {
+				column.checkpoints.push_back(last);
+				column.checkpoints.push_back(column.times.size());
+			}
+
+			logtime_t time = series.getEventTime(i);
+			logtime_t delta = time - last;
+			while (delta >= 0x80) {
+				column.times.push_back((std::uint8_t)(delta | 0x80));
+				delta >>= 7;
+			}
+			column.times.push_back((std::uint8_t)delta);
+			last = time;
+		}
+		column.header.count = series.size();
+	}
+
+	static void appendString(Column& column, std::vector<std::uint64_t>& offsets, const std::string& str)
+	{
+		column.values.insert(column.values.end(), str.begin(), str.end());
+		offsets.push_back(column.values.size());
+	}
+
+	/**
+	 * Concatenate offsets and characters of a string column into its values section.
+	 */
+	static void finalizeStrings(Column& column, const std::vector<std::uint64_t>& offsets)
+	{
+		std::vector<std::uint8_t> values(offsets.size() * sizeof(std::uint64_t));
+		std::memcpy(values.data(), offsets.data(), values.size());
+		values.insert(values.end(), column.values.begin(), column.values.end());
+		column.values.swap(values);
+	}
+
+	static void writePadding(std::ostream& sout, std::size_t& offset)
+	{
+		static const char zeros[8] = { 0 };
+		std::size_t aligned = internal::alignEventLogOffset(offset);
+		sout.write(zeros, aligned - offset);
+		offset = aligned;
+	}
+
+	template<typename T>
+	static void writeSection(std::ostream& sout, std::size_t& offset, const std::vector<T>& data)
+	{
+		sout.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T));
+		offset += data.size() * sizeof(T);
+		writePadding(sout, offset);
+	}
+
+public:
+	EventLogWriter()
+	{
+		internal::verifyLittleEndian();
+	}
+
+	/**
+	 * Add a column of any time series. Values are stored as strings (formatted the same way as in CSV).
+	 */
+	void addColumn(const std::string& name, const TimeSeriesBase<logtime_t>& series)
+	{
+		Column& column = mColumns.emplace_back(name, EventLogType::TEXT);
+		encodeTimes(column, series);
+		std::vector<std::uint64_t> offsets = { 0 };
+		for (std::size_t i = 0; i < series.size(); ++i) {
+			appendString(column, offsets, series.getEventAsString(i));
+		}
+		finalizeStrings(column, offsets);
+	}
+
+	/**
+	 * Add a column of a typed time series. Booleans, bit arrays, and strings are packed, other types are formatted.
+	 */
+	template<typename VALUE, class STORAGE>
+	void addColumn(const std::string& name, const TimeSeries<VALUE, logtime_t, STORAGE>& series)
+	{
+		constexpr int BITS = internal::EventLogBits<VALUE>::value;
+		if constexpr (std::is_same_v<VALUE, bool>) {
+			Column& column = mColumns.emplace_back(name, EventLogType::BOOL, 1);
+			encodeTimes(column, series);
+			column.values.resize((series.size() + 7) / 8);
+			for (std::size_t i = 0; i < series.size(); ++i) {
+				column.values[i / 8] |= (series[i].value ? 1 : 0) << (i % 8);
+			}
+		}
+		else if constexpr (BITS > 0) {
+			constexpr std::size_t BYTES = (BITS + 7) / 8;
+			Column& column = mColumns.emplace_back(name, EventLogType::BITS, BITS);
+			encodeTimes(column, series);
+			column.values.resize(series.size() * BYTES);
+			for (std::size_t i = 0; i < series.size(); ++i) {
+				std::uint8_t* value = &column.values[i * BYTES];
+				std::memcpy(value, series[i].value.data(), BYTES);
+				if (BITS % 8 != 0) {
+					value[BYTES - 1] &= (1 << (BITS % 8)) - 1;
+				}
+			}
+		}
+		else if constexpr (std::is_same_v<VALUE, std::string>) {
+			Column& column = mColumns.emplace_back(name, EventLogType::STRING);
+			encodeTimes(column, series);
+			std::vector<std::uint64_t> offsets = { 0 };
+			for (std::size_t i = 0; i < series.size(); ++i) {
+				appendString(column, offsets, series[i].value);
+			}
+			finalizeStrings(column, offsets);
+		}
+		else {
+			addColumn(name, static_cast<const TimeSeriesBase<logtime_t>&>(series));
+		}
+	}
+
+	/**
+	 * Write the log with all added columns.
+	 */
+	void write(std::ostream& sout)
+	{
+		EventLogHeader header;
+		std::memcpy(header.magic, internal::EVENT_LOG_MAGIC, sizeof(header.magic));
+		header.version = internal::EVENT_LOG_VERSION;
+		header.columns = (std::uint32_t)mColumns.size();
+
+		// compute the layout
+		std::size_t offset = sizeof(EventLogHeader) + mColumns.size() * sizeof(EventLogColumnHeader);
+		for (auto&& column : mColumns) {
+			column.header.nameOffset = (std::uint32_t)offset;
+			column.header.nameLength = (std::uint32_t)column.name.size();
+			offset += column.name.size();
+		}
+		for (auto&& column : mColumns) {
+			offset = internal::alignEventLogOffset(offset);
+			column.header.timesOffset = offset;
+			column.header.timesSize = column.times.size();
+			offset = internal::alignEventLogOffset(offset + column.times.size());
+			column.header.checkpointsOffset = offset;
+			offset = internal::alignEventLogOffset(offset + column.checkpoints.size() * sizeof(std::uint64_t));
+			column.header.valuesOffset = offset;
+			column.header.valuesSize = column.values.size();
+			offset += column.values.size();
+		}
+
+		// write everything
+		offset = 0;
+		sout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		offset += sizeof(header);
+		for (auto&& column : mColumns) {
+			sout.write(reinterpret_cast<const char*>(&column.header), sizeof(column.header));
+			offset += sizeof(column.header);
+		}
+		for (auto&& column : mColumns) {
+			sout.write(column.name.data(), column.name.size());
+			offset += column.name.size();
+		}
+		writePadding(sout, offset);
+
+		for (auto&& column : mColumns) {
+			writeSection(sout, offset, column.times);
+			writeSection(sout, offset, column.checkpoints);
+			writeSection(sout, offset, column.values);
+		}
+	}
+};
+
+
+/**
+ * Read-only view of one column of a binary event log. It implements the time series interface, so it can be printed
+ * or compared like a regular time series, but the data are read directly from the (mapped) log.
+ * Sequential access to event times is O(1), random access decodes at most CHECKPOINT_STRIDE deltas.
+ * The view remembers the last decoded time, so one instance must not be read by multiple threads at once
+ * (copy the column for each thread, the copies share the log data).
+ */
+class EventLogColumn : public TimeSeriesBase<logtime_t>
+{
+private:
+	const EventLogColumnHeader* mHeader;
+	std::string mName;
+	const std::uint8_t* mTimes;
+	const std::uint64_t* mCheckpoints;
+	const std::uint8_t* mValues;
+
+	// the last decoded event time (sequential reading does not need to restart from checkpoints)
+	mutable std::size_t mCachedIndex;
+	mutable logtime_t mCachedTime;
+	mutable std::size_t mCachedNext; ///< offset of the delta of the event after the cached one
+
+	void checkIndex(std::size_t idx) const
+	{
+		if (idx >= mHeader->count) {
+			throw std::out_of_range("Event #" + std::to_string(idx) + " is out of range of event log column '" + mName + "'.");
+		}
+	}
+
+	logtime_t decodeDelta(std::size_t& offset) const
+	{
+		logtime_t delta = 0;
+		unsigned shift = 0;
+		std::uint8_t byte;
+		do {
+			if (offset >= mHeader->timesSize || shift >= 64) {
+				throw std::runtime_error("Corrupted times of event log column '" + mName + "'.");
+			}
+			byte = mTimes[offset++];
+			delta |= (logtime_t)(byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+		return delta;
+	}
+
+	std::string_view getString(std::size_t idx) const
+	{
+		const std::uint64_t* offsets = reinterpret_cast<const std::uint64_t*>(mValues);
+		std::size_t charsOffset = (mHeader->count + 1) * sizeof(std::uint64_t);
+		if (offsets[idx] > offsets[idx + 1] || charsOffset + offsets[idx + 1] > mHeader->valuesSize) {
+			throw std::runtime_error("Corrupted values of event log column '" + mName + "'.");
+		}
+		return std::string_view(reinterpret_cast<const char*>(mValues) + charsOffset, offsets[idx + 1]).substr(offsets[idx]);
+	}
+
+public:
+	EventLogColumn(const std::uint8_t* data, const EventLogColumnHeader* header)
+		: mHeader(header),
+		mName(reinterpret_cast<const char*>(data) + header->nameOffset, header->nameLength),
+		mTimes(data + header->timesOffset),
+		mCheckpoints(reinterpret_cast<const std::uint64_t*>(data + header->checkpointsOffset)),
+		mValues(data + header->valuesOffset),
+		mCachedIndex(~(std::size_t)0), mCachedTime(0), mCachedNext(0)
+	{}
+
+	const std::string& name() const
+	{
+		return mName;
+	}
+
+	EventLogType type() const
+	{
+		return mHeader->type;
+	}
+
+	std::size_t size() const override
+	{
+		return (std::size_t)mHeader->count;
+	}
+
+	bool empty() const override
+	{
+		return mHeader->count == 0;
+	}
+
+	logtime_t getEventTime(std::size_t idx) const override
+	{
+		if (idx != mCachedIndex) {
+			checkIndex(idx);
+			std::size_t from = idx - idx % internal::EVENT_LOG_CHECKPOINT_STRIDE;
+			if (mCachedIndex < idx && mCachedIndex >= from) {
+				from = mCachedIndex + 1; // continue from the cached event
+			}
+			else {
+				std::size_t checkpoint = idx / internal::EVENT_LOG_CHECKPOINT_STRIDE;
+				mCachedTime = mCheckpoints[checkpoint * 2];
+				mCachedNext = (std::size_t)mCheckpoints[checkpoint * 2 + 1];
+			}
+
+			for (std::size_t i = from; i <= idx; ++i) {
+				mCachedTime += decodeDelta(mCachedNext);
+			}
+			mCachedIndex = idx;
+		}
+		return mCachedTime;
+	}
+
+	std::string getEventAsString(std::size_t idx) const override
+	{
+		std::string result;
+		appendEventAsString(idx, result);
+		return result;
+	}
+
+	void appendEventAsString(std::size_t idx, std::string& buffer) const override
+	{
+		static constexpr char digits[] = "0123456789abcdef";
+		checkIndex(idx);
+		switch (mHeader->type) {
+		case EventLogType::BOOL:
+			buffer += getValue<bool>(idx) ? '1' : '0';
+			break;
+		case EventLogType::BITS: {
+			// the same format as BitArray::appendHex()
+			std::size_t bytes = (mHeader->valueBits + 7) / 8;
+			const std::uint8_t* value = mValues + idx * bytes;
+			if (mHeader->valueBits <= 4) {
+				buffer += digits[value[0] & 0x0f];
+			}
+			else {
+				for (std::size_t i = 0; i < bytes; ++i) {
+					buffer += digits[value[i] >> 4];
+					buffer += digits[value[i] & 0x0f];
+				}
+			}
+			break;
+		}
+		case EventLogType::STRING:
+			append_doublequoted(getString(idx), buffer);
+			break;
+		case EventLogType::TEXT:
+			buffer += getString(idx);
+			break;
+		}
+	}
+
+	/**
+	 * Get a typed value of an event. The type must match the type of the column.
+	 */
+	template<typename VALUE>
+	VALUE getValue(std::size_t idx) const
+	{
+		constexpr int BITS = internal::EventLogBits<VALUE>::value;
+		checkIndex(idx);
+		if constexpr (std::is_same_v<VALUE, bool>) {
+			if (mHeader->type == EventLogType::BOOL) {
+				return (mValues[idx / 8] >> (idx % 8)) & 1;
+			}
+		}
+		else if constexpr (BITS > 0) {
+			if (mHeader->type == EventLogType::BITS && mHeader->valueBits == BITS) {
+				VALUE value;
+				std::memcpy(value.data(), mValues + idx * ((BITS + 7) / 8), (BITS + 7) / 8);
+				return value;
+			}
+		}
+		else if constexpr (std::is_same_v<VALUE, std::string>) {
+			if (mHeader->type == EventLogType::STRING || mHeader->type == EventLogType::TEXT) {
+				return std::string(getString(idx));
+			}
+		}
+		throw std::runtime_error("Type of event log column '" + mName + "' does not match the requested value type.");
+	}
+
+	/**
+	 * Copy the column into a regular time series.
+	 */
+	template<typename VALUE>
+	TimeSeries<VALUE> toTimeSeries() const
+	{
+		TimeSeries<VALUE> series;
+		for (std::size_t i = 0; i < size(); ++i) {
+			series.addEvent(getEventTime(i), getValue<VALUE>(i));
+		}
+		return series;
+	}
+};
+
+
+/**
+ * Read-only view of a binary event log in memory. The data are not copied, so they must outlive the view.
+ * The structure of the log is verified when the view is created, so corrupted logs are rejected early.
+ */
+class EventLogView
+{
+private:
+	std::vector<EventLogColumn> mColumns;
+
+	static void verifySection(std::uint64_t offset, std::uint64_t size, std::size_t totalSize, const std::string& name)
+	{
+		if (offset % 8 != 0 || offset > totalSize || size > totalSize - offset) {
+			throw std::runtime_error("Invalid layout of event log column '" + name + "'.");
+		}
+	}
+
+protected:
+	EventLogView() {}
+
+	void load(const void* data, std::size_t size)
+	{
+		internal::verifyLittleEndian();
+		const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+		if (reinterpret_cast<std::uintptr_t>(bytes) % 8 != 0) {
+			throw std::runtime_error("Event log data must be aligned to 8 bytes.");
+		}
+
+		const EventLogHeader* header = reinterpret_cast<const EventLogHeader*>(bytes);
+		if (size < sizeof(EventLogHeader) || std::memcmp(header->magic, internal::EVENT_LOG_MAGIC, sizeof(header->magic)) != 0) {
+			throw std::runtime_error("The data are not a binary event log.");
+		}
+		if (header->version != internal::EVENT_LOG_VERSION) {
+			throw std::runtime_error("Unsupported version " + std::to_string(header->version) + " of the event log.");
+		}
+		if ((size - sizeof(EventLogHeader)) / sizeof(EventLogColumnHeader) < header->columns) {
+			throw std::runtime_error("The event log is truncated.");
+		}
+
+		const EventLogColumnHeader* columns = reinterpret_cast<const EventLogColumnHeader*>(bytes + sizeof(EventLogHeader));
+		for (std::size_t i = 0; i < header->columns; ++i) {
+			const EventLogColumnHeader& column = columns[i];
+			if ((std::uint64_t)column.nameOffset + column.nameLength > size) {
+				throw std::runtime_error("Invalid name of event log column #" + std::to_string(i) + ".");
+			}
+			mColumns.emplace_back(bytes, &column);
+
+			const std::string& name = mColumns.back().name();
+			std::uint64_t checkpoints = (column.count + internal::EVENT_LOG_CHECKPOINT_STRIDE - 1) / internal::EVENT_LOG_CHECKPOINT_STRIDE;
+			std::uint64_t valuesSize = 0;
+			switch (column.type) {
+			case EventLogType::BOOL:
+				valuesSize = (column.count + 7) / 8;
+				break;
+			case EventLogType::BITS:
+				valuesSize = column.count * ((column.valueBits + 7) / 8);
+				break;
+			case EventLogType::STRING:
+			case EventLogType::TEXT:
+				valuesSize = (column.count + 1) * sizeof(std::uint64_t);
+				break;
+			default:
+				throw std::runtime_error("Unknown type of event log column '" + name + "'.");
+			}
+
+			if (column.count > size || column.valuesSize < valuesSize) {
+				throw std::runtime_error("Invalid size of event log column '" + name + "'.");
+			}
+			verifySection(column.timesOffset, column.timesSize, size, name);
+			verifySection(column.checkpointsOffset, checkpoints * 2 * sizeof(std::uint64_t), size, name);
+			verifySection(column.valuesOffset, column.valuesSize, size, name);
+		}
+	}
+
+public:
+	EventLogView(const void* data, std::size_t size)
+	{
+		load(data, size);
+	}
+
+	EventLogView(const EventLogView&) = delete;
+	EventLogView& operator=(const EventLogView&) = delete;
+
+	const std::vector<EventLogColumn>& columns() const
+	{
+		return mColumns;
+	}
+
+	const EventLogColumn& column(const std::string& name) const
+	{
+		for (auto&& column : mColumns) {
+			if (column.name() == name) {
+				return column;
+			}
+		}
+		throw std::runtime_error("Event log column '" + name + "' not found.");
+	}
+};
+
+
+/**
+ * Binary event log opened from a file. On Linux, the file is memory mapped (so only the accessed pages are loaded),
+ * on other platforms it is read into memory.
+ */
+class EventLogFile : public EventLogView
+{
+private:
+	MappedFile mFile;
+
+public:
+	EventLogFile(const std::string& fileName)
+	{
+		if (!mFile.open(fileName)) {
+			throw std::runtime_error("Failed to open event log " + fileName);
+		}
+		load(mFile.data(), mFile.size());
+	}
+};
+
+#endif
@@ -11,6 +11,25 @@
 #include <string>
 #include <cstdint>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+/**
+ * Return the index of the lowest set bit of given (non-zero) word.
+ */
+inline std::size_t lowestBitIndex(std::uint64_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (std::size_t)index;
+#else
+	return (std::size_t)__builtin_ctzll(word);
+#endif
+}
+
 
 /**
  * Represents an array of bits of fixed size and offers some special functions.
@@ -146,23 +165,74 @@ public:
 	}
 
 	/**
-	 * Returns the bit array encoded in hex-based string.
+	 * Return all bits packed in one word (bit i of the word is the i-th bit of the array, unused bits are zero).
 	 */
-	operator std::string() const
+	std::uint64_t getWord() const
 	{
-		std::stringstream sstr;
-		sstr << std::hex << std::setfill('0');
+		static_assert(N <= 64, "The bit array does not fit in one word.");
+		std::uint64_t word = 0;
+		for (std::size_t i = 0; i < mData.size(); ++i) {
+			word |= (std::uint64_t)mData[i] << (i * 8);
+		}
+		if constexpr (N < 64) {
+			word &= ((std::uint64_t)1 << N) - 1;
+		}
+		return word;
+	}
+
+	/**
+	 * Set all bits from one word (the i-th bit of the array is bit i of the word).
+	 */
+	void setWord(std::uint64_t word)
+	{
+		static_assert(N <= 64, "The bit array does not fit in one word.");
+		for (std::size_t i = 0; i < mData.size(); ++i) {
+			mData[i] = (std::uint8_t)(word >> (i * 8));
+		}
+	}
+
+	/**
+	 * Raw internal bytes (bit 0 is the lowest bit of the first byte, unused bits of the last byte are undefined).
+	 */
+	const std::uint8_t* data() const
+	{
+		return mData.data();
+	}
+
+	std::uint8_t* data()
+	{
+		return mData.data();
+	}
+
+	/**
+	 * Append the bit array encoded in hex-based string (no allocations, if the output has enough capacity).
+	 */
+	void appendHex(std::string& out) const
+	{
+		static constexpr char digits[] = "0123456789abcdef";
 		if constexpr (N <= 4) {
-			int val = get<int>(0, 4);
-			sstr << std::setw(1) << val;
+			out += digits[mData[0] & ((1 << N) - 1)];
 		}
 		else {
-			for (int i = 0; i < ((N + 7) / 8); ++i) {
-				int val = get<int>(i * 8, 8);
-				sstr << std::setw(2) << val;
+			for (std::size_t i = 0; i < mData.size(); ++i) {
+				std::uint8_t val = mData[i];
+				if (N % 8 != 0 && i == mData.size() - 1) {
+					val &= (1 << (N % 8)) - 1;
+				}
+				out += digits[val >> 4];
+				out += digits[val & 0x0f];
 			}
 		}
-		return sstr.str();
+	}
+
+	/**
+	 * Returns the bit array encoded in hex-based string.
+	 */
+	operator std::string() const
+	{
+		std::string str;
+		appendHex(str);
+		return str;
 	}
 };
 
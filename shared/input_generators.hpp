@@ -0,0 +1,317 @@
+#ifndef MOCCARDUINO_SHARED_INPUT_GENERATORS_HPP
+#define MOCCARDUINO_SHARED_INPUT_GENERATORS_HPP
+
+#include "emulator.hpp"
+
+#include <random>
+#include <limits>
+#include <stdexcept>
+#include <cstdint>
+
+
+/**
+ * Base class for generators of input pin events. The events are computed one by one when the time approaches them,
+ * so a generator keeps only a constant state regardless of how many events it produces.
+ * A generator is attached to an input pin by ArduinoSimulationController::registerPinInput(). It is chained behind
+ * the input buffer of the pin, so its events are interleaved with the scheduled ones (in time order).
+ */
+class InputGenerator : public EventConsumer<ArduinoPinState>
+{
+private:
+	pin_t mPin;
+
+	/**
+	 * Emit all generated events up to given time (inclusive).
+	 */
+	void emitUntil(logtime_t time)
+	{
+		while (mNextTime <= time) {
+			nextAddEvent(mNextTime, ArduinoPinState(mPin, mNextValue));
+			generateNext();
+		}
+	}
+
+protected:
+	/**
+	 * Time of the next generated event (max. value if the generator is exhausted).
+	 */
+	logtime_t mNextTime;
+
+	/**
+	 * Pin value of the next generated event.
+	 */
+	int mNextValue;
+
+	/**
+	 * Compute the next event (update mNextTime and mNextValue). The events must be generated in time order.
+	 */
+	virtual void generateNext() = 0;
+
+	void doAddEvent(logtime_t time, ArduinoPinState value) override
+	{
+		emitUntil(time);
+		nextAddEvent(time, value);
+	}
+
+	void doAdvanceTime(logtime_t time) override
+	{
+		emitUntil(time);
+		nextAdvanceTime(time);
+	}
+
+public:
+	InputGenerator(pin_t pin) : mPin(pin), mNextTime(std::numeric_limits<logtime_t>::max()), mNextValue(LOW) {}
+
+	/**
+	 * Pin for which the events are generated.
+	 */
+	pin_t pin() const
+	{
+		return mPin;
+	}
+
+	logtime_t nextEventTime() const override
+	{
+		return mNextTime;
+	}
+
+	/**
+	 * Pin value of the next event (valid only if the generator is not exhausted).
+	 */
+	int nextValue() const
+	{
+		return mNextValue;
+	}
+
+	/**
+	 * Move to the following event without emitting the next one (used when a generator is driven by another one).
+	 */
+	void skipEvent()
+	{
+		generateNext();
+	}
+};
+
+
+/**
+ * Generates bursts of pulses (e.g., a double-click repeated periodically). Each pulse sets the pin to the active value
+ * and restores the inactive one after the pulse duration.
+ */
+class BurstInputGenerator : public InputGenerator
+{
+private:
+	logtime_t mStart;
+	logtime_t mBurstPeriod;
+	std::size_t mPulses;
+	logtime_t mPulsePeriod;
+	logtime_t mPulseDuration;
+	int mActiveValue;
+	std::size_t mBursts;
+
+	/**
+	 * Index of the next event (each pulse has two events -- the rising and the falling edge).
+	 */
+	std::uint64_t mIndex;
+
+	void setEvent()
+	{
+		std::uint64_t burst = mIndex / (2 * mPulses);
+		std::uint64_t pulse = (mIndex / 2) % mPulses;
+		bool end = mIndex % 2 != 0;
+
+		if (mBursts != 0 && burst >= mBursts) {
+			mNextTime = std::numeric_limits<logtime_t>::max();
+			return;
+		}
+
+		mNextTime = mStart + burst * mBurstPeriod + pulse * mPulsePeriod + (end ? mPulseDuration : 0);
+		mNextValue = end ? (mActiveValue == LOW ? HIGH : LOW) : mActiveValue;
+	}
+
+protected:
+	void generateNext() override
+	{
+		++mIndex;
+		setEvent();
+	}
+
+public:
+	/**
+	 * @param pin for which the events are generated
+	 * @param start time of the first pulse
+	 * @param burstPeriod time between the starts of two consecutive bursts
+	 * @param pulses number of pulses in one burst
+	 * @param pulsePeriod time between the starts of two consecutive pulses in a burst
+	 * @param pulseDuration how long the pin holds the active value
+	 * @param activeValue pin value during the pulse (LOW for funshield buttons which are pressed)
+	 * @param bursts number of generated bursts (0 = unlimited)
+	 */
+	BurstInputGenerator(pin_t pin, logtime_t start, logtime_t burstPeriod, std::size_t pulses, logtime_t pulsePeriod,
+		logtime_t pulseDuration, int activeValue = LOW, std::size_t bursts = 0)
+		: InputGenerator(pin), mStart(start), mBurstPeriod(burstPeriod), mPulses(pulses), mPulsePeriod(pulsePeriod),
+		mPulseDuration(pulseDuration), mActiveValue(activeValue), mBursts(bursts), mIndex(0)
+	{
+		if (pulses == 0 || pulseDuration == 0 || pulseDuration >= pulsePeriod) {
+			throw std::runtime_error("Pulses must have non-zero duration shorter than their period.");
+		}
+		if ((pulses - 1) * pulsePeriod + pulseDuration >= burstPeriod) {
+			throw std::runtime_error("The burst does not fit in its period.");
+		}
+		setEvent();
+	}
+};
+
+
+/**
+ * Generates periodic pulses (e.g., a button clicked every 250 ms or a square wave clock signal).
+ */
+class PeriodicInputGenerator : public BurstInputGenerator
+{
+public:
+	/**
+	 * @param pin for which the events are generated
+	 * @param start time of the first pulse
+	 * @param period time between the starts of two consecutive pulses
+	 * @param duration how long the pin holds the active value (half of the period for a square wave)
+	 * @param activeValue pin value during the pulse (LOW for funshield buttons which are pressed)
+	 * @param count number of generated pulses (0 = unlimited)
+	 */
+	PeriodicInputGenerator(pin_t pin, logtime_t start, logtime_t period, logtime_t duration, int activeValue = LOW,
+		std::size_t count = 0)
+		: BurstInputGenerator(pin, start, period, 1, period, duration, activeValue, count)
+	{}
+};
+
+
+/**
+ * Generates pulses with random gaps and durations (uniformly distributed in given ranges). The generator is seeded
+ * explicitly and it does not depend on the platform, so the same seed always produces the same events.
+ */
+class RandomInputGenerator : public InputGenerator
+{
+private:
+	std::mt19937_64 mRandom;
+	logtime_t mMinGap;
+	logtime_t mMaxGap;
+	logtime_t mMinDuration;
+	logtime_t mMaxDuration;
+	int mActiveValue;
+
+	/**
+	 * Number of pulses which remain to be generated after the current one (ignored if the count is unlimited).
+	 */
+	std::size_t mRemaining;
+	bool mUnlimited;
+
+	logtime_t randomTime(logtime_t min, logtime_t max)
+	{
+		return min + (logtime_t)(mRandom() % (max - min + 1));
+	}
+
+protected:
+	void generateNext() override
+	{
+		if (mNextValue == mActiveValue) {
+			mNextTime += randomTime(mMinDuration, mMaxDuration);
+			mNextValue = mActiveValue == LOW ? HIGH : LOW;
+		}
+		else if (mUnlimited || mRemaining > 0) {
+			mRemaining -= mUnlimited ? 0 : 1;
+			mNextTime += randomTime(mMinGap, mMaxGap);
+			mNextValue = mActiveValue;
+		}
+		else {
+			mNextTime = std::numeric_limits<logtime_t>::max();
+		}
+	}
+
+public:
+	/**
+	 * @param pin for which the events are generated
+	 * @param seed of the pseudo-random generator
+	 * @param start time of the first pulse
+	 * @param minGap minimal time between the end of a pulse and the start of the next one
+	 * @param maxGap maximal time between the end of a pulse and the start of the next one
+	 * @param minDuration minimal time the pin holds the active value
+	 * @param maxDuration maximal time the pin holds the active value
+	 * @param activeValue pin value during the pulse (LOW for funshield buttons which are pressed)
+	 * @param count number of generated pulses (0 = unlimited)
+	 */
+	RandomInputGenerator(pin_t pin, std::uint64_t seed, logtime_t start, logtime_t minGap, logtime_t maxGap,
+		logtime_t minDuration, logtime_t maxDuration, int activeValue = LOW, std::size_t count = 0)
+		: InputGenerator(pin), mRandom(seed), mMinGap(minGap), mMaxGap(maxGap), mMinDuration(minDuration),
+		mMaxDuration(maxDuration), mActiveValue(activeValue), mRemaining(count > 0 ? count - 1 : 0), mUnlimited(count == 0)
+	{
+		if (minGap == 0 || minGap > maxGap || minDuration == 0 || minDuration > maxDuration) {
+			throw std::runtime_error("Invalid ranges of random gaps or durations.");
+		}
+		mNextTime = start;
+		mNextValue = activeValue;
+	}
+};
+
+
+/**
+ * Adds bouncing (jitter) to the events of another generator. Every change of the pin value is followed by three
+ * short flips to the opposite value and back (in the same way the funshield controller simulates bouncing buttons).
+ * The bouncing is cut short when the source generator produces another event. The source generator must not
+ * be attached to the simulation, it is driven by this generator (and it must stay alive as long as this one).
+ */
+class BouncingInputGenerator : public InputGenerator
+{
+private:
+	InputGenerator& mSource;
+	logtime_t mDelay;
+
+	/**
+	 * Value the pin is bouncing around.
+	 */
+	int mValue;
+
+	/**
+	 * Time of the last change taken from the source.
+	 */
+	logtime_t mChangeTime;
+
+	/**
+	 * Number of bouncing events emitted after the last change (6 = bouncing is over).
+	 */
+	std::size_t mStep;
+
+protected:
+	void generateNext() override
+	{
+		if (mStep < 6 && mChangeTime + (mStep + 1) * mDelay < mSource.nextEventTime()) {
+			++mStep;
+			mNextTime = mChangeTime + mStep * mDelay;
+			mNextValue = mStep % 2 != 0 ? (mValue == LOW ? HIGH : LOW) : mValue;
+			return;
+		}
+
+		mNextTime = mSource.nextEventTime();
+		if (mNextTime == std::numeric_limits<logtime_t>::max()) {
+			return;
+		}
+		mNextValue = mValue = mSource.nextValue();
+		mChangeTime = mNextTime;
+		mStep = 0;
+		mSource.skipEvent();
+	}
+
+public:
+	/**
+	 * @param source generator of the changes which bounce
+	 * @param delay between two bouncing flips
+	 */
+	BouncingInputGenerator(InputGenerator& source, logtime_t delay)
+		: InputGenerator(source.pin()), mSource(source), mDelay(delay), mValue(LOW), mChangeTime(0), mStep(6)
+	{
+		if (delay == 0) {
+			throw std::runtime_error("Bouncing delay must not be zero.");
+		}
+		generateNext();
+	}
+};
+
+
+#endif
@@ -2,10 +2,19 @@
 #include "emulator.hpp"
 
 #include <stdexcept>
-#include <random>
 #include <cctype>
 
-ArduinoEmulator emulator;
+/**
+ * Default emulator instance (for applications that run only one simulation).
+ */
+ArduinoEmulator default_emulator;
+
+/**
+ * Emulator which handles the Arduino API invoked from the current thread.
+ * It is bound by the program manager whenever the tested code is executed, so multiple emulators
+ * (each running its own copy of the tested code) may coexist in one process.
+ */
+thread_local ArduinoEmulator* current_emulator = nullptr;
 
 ArduinoEmulator& get_arduino_emulator_instance()
 {
@@ -16,103 +25,118 @@ ArduinoEmulator& get_arduino_emulator_instance()
 	}
 	++invocationCount;
 
-	return emulator;
+	return default_emulator;
+}
+
+ArduinoEmulator* bind_arduino_emulator_instance(ArduinoEmulator* instance)
+{
+	auto previous = current_emulator;
+	current_emulator = instance;
+	return previous;
+}
+
+/**
+ * Get the emulator bound to the current thread.
+ */
+static inline ArduinoEmulator& emulator()
+{
+	if (current_emulator == nullptr) {
+		throw std::runtime_error("No Arduino emulator is bound to the current thread.");
+	}
+	return *current_emulator;
 }
 
 // Pins
 
 void pinMode(std::uint8_t pin, std::uint8_t mode)
 {
-	emulator.pinMode(pin, mode);
+	emulator().pinMode(pin, mode);
 }
 
 void digitalWrite(std::uint8_t pin, std::uint8_t val)
 {
-	emulator.digitalWrite(pin, val);
+	emulator().digitalWrite(pin, val);
 }
 
 int digitalRead(std::uint8_t pin)
 {
-	return emulator.digitalRead(pin);
+	return emulator().digitalRead(pin);
 }
 
 int analogRead(std::uint8_t pin)
 {
-	return emulator.analogRead(pin);
+	return emulator().analogRead(pin);
 }
 
 void analogReference(std::uint8_t mode)
 {
-	emulator.analogReference(mode);
+	emulator().analogReference(mode);
 }
 
 void analogWrite(std::uint8_t pin, int val)
 {
-	emulator.analogWrite(pin, val);
+	emulator().analogWrite(pin, val);
 }
 
 // Timing
 
 unsigned long millis(void)
 {
-	return emulator.millis();
+	return emulator().millis();
 }
 
 unsigned long micros(void)
 {
-	return emulator.micros();
+	return emulator().micros();
 }
 
 void delay(unsigned long ms)
 {
-	emulator.delay(ms);
+	emulator().delay(ms);
 }
 
 void delayMicroseconds(unsigned int us)
 {
-	emulator.delayMicroseconds(us);
+	emulator().delayMicroseconds(us);
 }
 
 // Advanced I/O
 
 unsigned long pulseIn(std::uint8_t pin, std::uint8_t state, unsigned long timeout)
 {
-	return emulator.pulseIn(pin, state, timeout);
+	return emulator().pulseIn(pin, state, timeout);
 }
 
 unsigned long pulseInLong(std::uint8_t pin, std::uint8_t state, unsigned long timeout)
 {
-	return emulator.pulseInLong(pin, state, timeout);
+	return emulator().pulseInLong(pin, state, timeout);
 }
 
 void shiftOut(std::uint8_t dataPin, std::uint8_t clockPin, std::uint8_t bitOrder, std::uint8_t val)
 {
-	emulator.shiftOut(dataPin, clockPin, bitOrder, val);
+	emulator().shiftOut(dataPin, clockPin, bitOrder, val);
 }
 
 std::uint8_t shiftIn(std::uint8_t dataPin, std::uint8_t clockPin, std::uint8_t bitOrder)
 {
-	return emulator.shiftIn(dataPin, clockPin, bitOrder);
+	return emulator().shiftIn(dataPin, clockPin, bitOrder);
 }
 
 void tone(std::uint8_t pin, unsigned int frequency, unsigned long duration)
 {
-	emulator.tone(pin, frequency, duration);
+	emulator().tone(pin, frequency, duration);
 }
 
 void noTone(std::uint8_t pin)
 {
-	emulator.noTone(pin);
+	emulator().noTone(pin);
 }
 
 // Random numbers
 
-std::default_random_engine random_engine;
-
 long random(long min, long max)
 {
-	std::uniform_int_distribution<long> distribution(min, max);
-	return distribution(random_engine);
+	return emulator().random(min, max);
 }
 
 long random(long max)
@@ -122,7 +146,7 @@ long random(long max)
 
 void randomSeed(unsigned long seed)
 {
-	random_engine.seed(seed);
+	emulator().randomSeed(seed);
 }
 
 // Math
@@ -204,12 +228,12 @@ bool isWhitespace(int c)
 
 SerialMock::operator bool() const
 {
-	return emulator.isSerialEnabled();
+	return emulator().isSerialEnabled();
 }
 
 void SerialMock::begin(long speed, SerialConfig config)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
 }
@@ -218,16 +242,18 @@ void SerialMock::begin(long speed, SerialConfig config)
 #define SERIAL_MOCK_PRINT_GEN(TYPE)\
 void SerialMock::print(TYPE val, SerialPrintFormat format)\
 {\
-	if (!emulator.isSerialEnabled()) {\
+	if (!emulator().isSerialEnabled()) {\
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");\
 	}\
+	emulator().registerSideEffect();\
 }\
 \
 void SerialMock::println(TYPE val, SerialPrintFormat format)\
 {\
-	if (!emulator.isSerialEnabled()) {\
+	if (!emulator().isSerialEnabled()) {\
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");\
 	}\
+	emulator().registerSideEffect();\
 }
 
 SERIAL_MOCK_PRINT_GEN(char)
@@ -242,71 +268,75 @@ SERIAL_MOCK_PRINT_GEN(unsigned long long)
 
 void SerialMock::print(double val)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator().registerSideEffect();
 }
 
 void SerialMock::print(const char* val)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator().registerSideEffect();
 }
 
 void SerialMock::println(double val)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator().registerSideEffect();
 }
 
 void SerialMock::println(const char* val)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
+	emulator().registerSideEffect();
 }
 
 std::size_t SerialMock::available() const
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	return emulator.serialDataAvailable();
+	return emulator().serialDataAvailable();
 }
 
 int SerialMock::peek() const
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	if (emulator.serialDataAvailable() == 0) {
+	if (emulator().serialDataAvailable() == 0) {
 		return -1;
 	}
-	return emulator.peekSerial();
+	return emulator().peekSerial();
 }
 
 int SerialMock::read()
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	if (emulator.serialDataAvailable() == 0) {
+	if (emulator().serialDataAvailable() == 0) {
 		return -1;
 	}
-	return emulator.readSerial();
+	return emulator().readSerial();
 
 }
 
 std::size_t SerialMock::readBytes(char* buffer, std::size_t length)
 {
-	if (!emulator.isSerialEnabled()) {
+	if (!emulator().isSerialEnabled()) {
 		throw ArduinoEmulatorException("The Serial interface is disabled in the emulator.");
 	}
-	length = std::min(length, emulator.serialDataAvailable());
+	length = std::min(length, emulator().serialDataAvailable());
 	for (std::size_t i = 0; i < length; ++i) {
-		buffer[i] = emulator.readSerial();
+		buffer[i] = emulator().readSerial();
 	}
 	return length;
 }
@@ -261,13 +261,26 @@ public:
  * Demultiplexes state changes by computing the time each LED has been lit
  * in given quantization intervals and 
  */
-template<int LEDS>
-class LedsEventsDemultiplexer : public EventConsumer<BitArray<LEDS>>
+template<int LEDS, class NEXT = EventConsumer<BitArray<LEDS>>>
+class LedsEventsDemultiplexer : public StaticEventConsumer<BitArray<LEDS>, logtime_t, NEXT>
 {
 public:
 	using state_t = BitArray<LEDS>;
 
+	/**
+	 * The same stage with another type of the next consumer (see EventPipeline).
+	 */
+	template<class N>
+	using with_next = LedsEventsDemultiplexer<LEDS, N>;
+
 private:
+	static_assert(LEDS <= 64, "The states of all LEDs must fit in one word.");
+
+	/**
+	 * Bitmask of all LEDs.
+	 */
+	static constexpr std::uint64_t FULL_MASK = LEDS < 64 ? ((std::uint64_t)1 << (LEDS % 64)) - 1 : ~(std::uint64_t)0;
+
 	/**
 	 * Time window for demultiplexing.
 	 */
@@ -284,14 +297,14 @@ private:
 	logtime_t mNextMarker;
 
 	/**
-	 * Last encountered state set by addEvent().
+	 * Last encountered state set by addEvent() as a bitmask of LEDs which are ON.
 	 */
-	state_t mLastState;
+	std::uint64_t mLastState;
 
 	/**
-	 * Demultiplexed state stored by last closed window.
+	 * Demultiplexed state stored by last closed window (bitmask of LEDs which are ON).
 	 */
-	state_t mLastDemuxedState;
+	std::uint64_t mLastDemuxedState;
 
 	/**
 	 * Accumulated active times for each LED in the last time window.
@@ -299,30 +312,36 @@ private:
 	std::array<logtime_t, LEDS> mActiveTimes;
 
 	/**
-	 * Compute new demuxed state from the accumulated active times and reset active times in the process.
+	 * Convert LEDs state to a bitmask of LEDs which are ON (LEDs use inverted logic).
+	 */
+	static std::uint64_t litMask(const state_t& state)
+	{
+		return ~state.getWord() & FULL_MASK;
+	}
+
+	/**
+	 * Compute new demuxed state (bitmask of lit LEDs) from the accumulated active times and reset active times in the process.
 	 */
-	state_t demuxState()
+	std::uint64_t demuxState()
 	{
-		state_t newState(OFF);
+		std::uint64_t newState = 0;
 		for (std::size_t i = 0; i < LEDS; ++i) {
-			if (mActiveTimes[i] >= mThreshold) {
-				newState.set(ON, i, 1); // the LED has been ON for sufficient amount of time
-			}
-			mActiveTimes[i] = 0;
+			// the LED has been ON for sufficient amount of time
+			newState |= (std::uint64_t)(mActiveTimes[i] >= mThreshold) << i;
 		}
+		mActiveTimes.fill(0);
 		return newState;
 	}
 
 	/**
 	 * Use last know state and increase time accumulators for all LEDs which are currently ON.
+	 * Only the set bits of the state mask are visited (multiplexed displays light only a few LEDs at a time).
 	 * @param dt how much time have passed since the last update
 	 */
 	void accumulateActiveTimes(logtime_t dt)
 	{
-		for (std::size_t i = 0; i < LEDS; ++i) {
-			if (mLastState[i] == ON) {
-				mActiveTimes[i] += dt;
-			}
+		for (std::uint64_t lit = mLastState; lit != 0; lit &= lit - 1) {
+			mActiveTimes[lowestBitIndex(lit)] += dt;
 		}
 	}
 
@@ -357,16 +376,18 @@ private:
 			if (mLastDemuxedState != demuxedState) {
 				// demuxed state has changed
 				mLastDemuxedState = demuxedState;
-				if (this->nextConsumer() != nullptr) {
+				if (this->next() != nullptr) {
 					// emit event for following consumers
-					this->nextConsumer()->addEvent(mNextMarker, demuxedState);
+					state_t state;
+					state.setWord(~demuxedState);
+					this->next()->addEvent(mNextMarker, state);
 				}
 				mNextMarker += mTimeWindow; // time window shifts one place
 			}
 			else {
-				if (this->nextConsumer() != nullptr) {
+				if (this->next() != nullptr) {
 					// no event -> just advance time for following consumers
-					this->nextConsumer()->advanceTime(mNextMarker);
+					this->next()->advanceTime(mNextMarker);
 				}
 
 				if (mLastDemuxedState != mLastState) {
@@ -393,29 +414,38 @@ protected:
 		do {
 			updateOpenedWindow(time); // update, possibly close current window
 		} while (isWindowOpen() && time >= mNextMarker);
-		mLastState = state;
+		mLastState = litMask(state);
 		if (!isWindowOpen()) {
 			// the event triggers opening of a new window
 			mNextMarker = time + mTimeWindow;
 		}
 	}
 
+	void doAddEvents(const TimedEvent<state_t>* events, std::size_t count) override
+	{
+		// the same as addEvent() for each event, but without the virtual calls
+		for (std::size_t i = 0; i < count; ++i) {
+			LedsEventsDemultiplexer::doAddEvent(events[i].time, events[i].value);
+			this->mLastTime = events[i].time;
+		}
+	}
+
 	void doAdvanceTime(logtime_t time)
 	{
 		do {
 			updateOpenedWindow(time); // update, possibly close current window
 		} while (isWindowOpen() && time >= mNextMarker);
-		if (!isWindowOpen() && this->nextConsumer() != nullptr) {
+		if (!isWindowOpen() && this->next() != nullptr) {
 			// if no window is open, we can pass time advances as usual
-			this->nextConsumer()->advanceTime(time);
+			this->next()->advanceTime(time);
 		}
 	}
 
 	void doClear() override
 	{
 		mNextMarker = this->mLastTime;
-		mLastState.fill(OFF);
-		mLastDemuxedState.fill(OFF);
+		mLastState = 0;
+		mLastDemuxedState = 0;
 		mActiveTimes.fill(0);
 		EventConsumer<BitArray<LEDS>>::doClear();
 	}
@@ -429,8 +459,8 @@ public:
 		mTimeWindow(timeWindow),
 		mThreshold(threshold),
 		mNextMarker(0),
-		mLastState(OFF),
-		mLastDemuxedState(OFF)
+		mLastState(0),
+		mLastDemuxedState(0)
 	{
 		if (mTimeWindow == 0) {
 			throw std::runtime_error("Demultiplexing time window must be greater than 0.");
@@ -455,12 +485,18 @@ public:
  * Therefore the recommended setup is to use demultiplexer with smaller window (e.g., 10ms) followed by aggregator with
  * larger window (50-100ms).
  */
-template<int LEDS>
-class LedsEventsAggregator : public EventConsumer<BitArray<LEDS>>
+template<int LEDS, class NEXT = EventConsumer<BitArray<LEDS>>>
+class LedsEventsAggregator : public StaticEventConsumer<BitArray<LEDS>, logtime_t, NEXT>
 {
 public:
 	using state_t = BitArray<LEDS>;
 
+	/**
+	 * The same stage with another type of the next consumer (see EventPipeline).
+	 */
+	template<class N>
+	using with_next = LedsEventsAggregator<LEDS, N>;
+
 private:
 	/**
 	 * Time window for aggregation.
@@ -509,14 +545,14 @@ private:
 			// process the last opened window
 			if (mLastState != mLastEmittedState) {
 				mLastEmittedState = mLastState;
-				if (this->nextConsumer() != nullptr) {
+				if (this->next() != nullptr) {
 					// emit event for following consumers
-					this->nextConsumer()->addEvent(mLastStateTime, mLastEmittedState);
+					this->next()->addEvent(mLastStateTime, mLastEmittedState);
 				}
 			}
-			else if (this->nextConsumer() != nullptr) {
+			else if (this->next() != nullptr) {
 				// advance time for the following consumer
-				this->nextConsumer()->advanceTime(mNextMarker);
+				this->next()->advanceTime(mNextMarker);
 			}
 		}
 	}
@@ -536,12 +572,21 @@ protected:
 		}
 	}
 
+	void doAddEvents(const TimedEvent<state_t>* events, std::size_t count) override
+	{
+		// the same as addEvent() for each event, but without the virtual calls
+		for (std::size_t i = 0; i < count; ++i) {
+			LedsEventsAggregator::doAddEvent(events[i].time, events[i].value);
+			this->mLastTime = events[i].time;
+		}
+	}
+
 	void doAdvanceTime(logtime_t time)
 	{
 		updateOpenedWindow(time); // update, possibly close current window
-		if (!isWindowOpen() && this->nextConsumer() != nullptr) {
+		if (!isWindowOpen() && this->next() != nullptr) {
 			// if no window is open, we can pass time advances as usual
-			this->nextConsumer()->advanceTime(time);
+			this->next()->advanceTime(time);
 		}
 	}
 
@@ -656,7 +701,7 @@ public:
  * display state events are produced off the sprout.
  */
 template<int DIGITS>
-class SerialSegLedDisplay : public ForkedEventConsumer<ArduinoPinState, BitArray<DIGITS * 8>>
+class SerialSegLedDisplay : public ForkedEventConsumer<ArduinoPinState, BitArray<DIGITS * 8>>, public ArduinoShiftOutConsumer
 {
 public:
 	using state_t = BitArray<DIGITS * 8>;
@@ -760,6 +805,36 @@ public:
 		mLatch(false)
 	{}
 
+	/**
+	 * Process one shiftOut() transaction without expanding it into individual pin events.
+	 */
+	void addShiftOutEvent(const ArduinoShiftOutEvent& event) override
+	{
+		if (event.dataPin != mDataInputPin || event.clockPin != mClockInputPin) {
+			event.expand(*this); // not our serial line
+			return;
+		}
+
+		if (event.time < this->mLastTime) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+
+		// each bit is pushed by the HIGH -> LOW transition of the clock, the transaction ends with clock LOW
+		for (std::size_t i = 0; i < 8; ++i) {
+			mShiftRegister.push(event.getBit(i) == HIGH);
+		}
+		mDataInput = event.getBit(7) == HIGH;
+		mClockInput = false;
+		this->mLastTime = event.lastEventTime();
+
+		// pass the transaction along
+		ArduinoShiftOutConsumer::deliver(this->nextConsumer(), event);
+
+		if (this->sproutConsumer() != nullptr) {
+			this->sproutConsumer()->advanceTime(event.lastEventTime());
+		}
+	}
+
 	/**
 	 * Attach the LED display to existing simulation (connect as event consumer to corresponding pins).
 	 */
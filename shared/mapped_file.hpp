@@ -0,0 +1,132 @@
+#ifndef MOCCARDUINO_SHARED_MAPPED_FILE_HPP
+#define MOCCARDUINO_SHARED_MAPPED_FILE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+/**
+ * Read-only contents of a file in memory. On Linux, the file is memory mapped (so only the accessed pages are loaded),
+ * on other platforms it is read into a buffer. In both cases, the data are aligned at least to 8 bytes.
+ */
+class MappedFile
+{
+private:
+	const char* mData;
+	std::size_t mSize;
+#ifdef __linux__
+	void* mMapping;
+#endif
+	std::vector<std::uint64_t> mBuffer; // 64-bit items keep the data aligned
+
+	void close()
+	{
+#ifdef __linux__
+		if (mMapping != nullptr) {
+			::munmap(mMapping, mSize);
+			mMapping = nullptr;
+		}
+#endif
+		mBuffer.clear();
+		mData = nullptr;
+		mSize = 0;
+	}
+
+public:
+	MappedFile() : mData(nullptr), mSize(0)
+#ifdef __linux__
+		, mMapping(nullptr)
+#endif
+	{}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	/**
+	 * Open the file and make its contents available.
+	 * @return false if the file cannot be opened
+	 */
+	bool open(const std::string& fileName)
+	{
+		close();
+		std::ifstream sin;
+#ifdef __linux__
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+			::close(fd);
+			sin.open(fileName, std::ios::binary); // pipes and devices cannot be mapped
+			return sin.is_open() && read(sin);
+		}
+		mSize = (std::size_t)info.st_size;
+		if (mSize > 0) {
+			void* mapping = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED) {
+				::close(fd);
+				mSize = 0;
+				sin.open(fileName, std::ios::binary);
+				return sin.is_open() && read(sin);
+			}
+			::madvise(mapping, mSize, MADV_SEQUENTIAL);
+			mMapping = mapping;
+			mData = static_cast<const char*>(mapping);
+		}
+		::close(fd);
+		return true;
+#else
+		sin.open(fileName, std::ios::binary);
+		return sin.is_open() && read(sin);
+#endif
+	}
+
+	/**
+	 * Read the whole stream into memory (in blocks) instead of mapping a file (e.g., for stdin).
+	 * @return false if reading failed
+	 */
+	bool read(std::istream& sin)
+	{
+		constexpr std::size_t BLOCK = 64 * 1024;
+		close();
+		while (sin) {
+			if (mSize + BLOCK > mBuffer.size() * sizeof(std::uint64_t)) {
+				mBuffer.resize(std::max(mBuffer.size() * 2, (mSize + BLOCK + 7) / sizeof(std::uint64_t)));
+			}
+			sin.read(reinterpret_cast<char*>(mBuffer.data()) + mSize, BLOCK);
+			mSize += (std::size_t)sin.gcount();
+		}
+		mData = reinterpret_cast<const char*>(mBuffer.data());
+		return sin.eof();
+	}
+
+	const char* data() const
+	{
+		return mData;
+	}
+
+	std::size_t size() const
+	{
+		return mSize;
+	}
+};
+
+
+#endif
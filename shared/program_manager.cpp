@@ -1,15 +1,68 @@
 #include "program_manager.hpp"
 #include <iostream>
+#include <filesystem>
+#include <algorithm>
 
 #ifdef __linux__
 #include <dlfcn.h>
+#include <link.h>
+#include <unistd.h>
+#include <cstdlib>
 
-void ArduinoProgramManager::loadProgram(const std::string &fileName)
+// defined in interface.cpp, sets the emulator used by the current thread and returns the previous one
+ArduinoEmulator* bind_arduino_emulator_instance(ArduinoEmulator* emulator);
+
+ArduinoEmulatorBinding::ArduinoEmulatorBinding(ArduinoEmulator* emulator) :
+    mPrevious(bind_arduino_emulator_instance(emulator))
+{}
+
+ArduinoEmulatorBinding::~ArduinoEmulatorBinding()
+{
+    bind_arduino_emulator_instance(mPrevious);
+}
+
+/**
+ * Make a private copy of the program in a temporary file, so it can be loaded as a separate instance
+ * (dlopen returns the already loaded instance when the same file is opened again).
+ */
+static std::string createProgramCopy(const std::string& fileName)
+{
+    // mimic dlopen search for plain file names (our executables have rpath set to $ORIGIN)
+    std::filesystem::path source(fileName);
+    if (fileName.find('/') == std::string::npos) {
+        auto path = std::filesystem::read_symlink("/proc/self/exe").parent_path() / fileName;
+        if (std::filesystem::exists(path)) {
+            source = path;
+        }
+    }
+
+    std::string copy = (std::filesystem::temp_directory_path() / "moccarduino-XXXXXX").string();
+    int fd = mkstemp(copy.data());
+    if (fd < 0) throw std::runtime_error("Unable to create a temporary copy of the Arduino program.");
+    close(fd);
+
+    std::filesystem::copy_file(source, copy, std::filesystem::copy_options::overwrite_existing);
+    return copy;
+}
+
+void ArduinoProgramManager::loadProgram(const std::string &fileName, bool isolated)
 {
-    if (mArduinoProgramHandle) throw std::runtime_error("The Arduino program is already loaded!");
+    if (isLoaded()) throw std::runtime_error("The Arduino program is already loaded!");
 
-    mArduinoProgramHandle = dlopen(fileName.c_str(), RTLD_NOW);
-    if (!mArduinoProgramHandle) throw std::runtime_error(dlerror());
+    // global objects of the program may use the Arduino API while being initialized
+    ArduinoEmulatorBinding binding(mEmulator);
+
+    if (isolated) {
+        std::string copy = createProgramCopy(fileName);
+        mArduinoProgramHandle = dlopen(copy.c_str(), RTLD_NOW | RTLD_LOCAL);
+        std::string error = mArduinoProgramHandle ? "" : dlerror();
+        std::filesystem::remove(copy); // the file is no longer needed once it is mapped
+        if (!mArduinoProgramHandle) throw std::runtime_error(error);
+    }
+    else {
+        mArduinoProgramHandle = dlopen(fileName.c_str(), RTLD_NOW);
+        if (!mArduinoProgramHandle) throw std::runtime_error(dlerror());
+    }
 
     mArduinoSetup = reinterpret_cast<decltype(mArduinoSetup)>(dlsym(mArduinoProgramHandle, "setup"));
     if (const char* error = dlerror()) throw std::runtime_error(error);
@@ -20,6 +73,9 @@ void ArduinoProgramManager::loadProgram(const std::string &fileName)
 
 void ArduinoProgramManager::unloadProgram()
 {
+    // global objects of the program may use the Arduino API while being destroyed
+    ArduinoEmulatorBinding binding(mEmulator);
+
     if (mArduinoProgramHandle) dlclose(mArduinoProgramHandle);
     if (const char* error = dlerror()) throw std::runtime_error(error);
 
@@ -28,17 +84,101 @@ void ArduinoProgramManager::unloadProgram()
     mArduinoLoop = nullptr;
 }
 
+/**
+ * Find the memory ranges holding global variables of a loaded program (writable PT_LOAD segments).
+ * The RELRO part is excluded, it is read-only after relocation and it does not change afterwards.
+ */
+static std::vector<std::pair<char*, std::size_t>> getWritableSegments(void* handle)
+{
+    struct link_map* map = nullptr;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0) throw std::runtime_error(dlerror());
+
+    struct SegmentsSearch {
+        ElfW(Addr) base;
+        std::vector<std::pair<char*, std::size_t>> segments;
+    } search{ map->l_addr, {} };
+
+    dl_iterate_phdr([](struct dl_phdr_info* info, std::size_t, void* data) -> int {
+        auto search = static_cast<SegmentsSearch*>(data);
+        if (info->dlpi_addr != search->base) return 0;
+
+        ElfW(Addr) relroStart = 0, relroEnd = 0;
+        for (std::size_t i = 0; i < info->dlpi_phnum; ++i) {
+            if (info->dlpi_phdr[i].p_type == PT_GNU_RELRO) {
+                relroStart = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+                relroEnd = relroStart + info->dlpi_phdr[i].p_memsz;
+            }
+        }
+
+        for (std::size_t i = 0; i < info->dlpi_phnum; ++i) {
+            auto& header = info->dlpi_phdr[i];
+            if (header.p_type != PT_LOAD || (header.p_flags & PF_W) == 0) continue;
+
+            ElfW(Addr) start = info->dlpi_addr + header.p_vaddr;
+            ElfW(Addr) end = start + header.p_memsz;
+            if (start < relroEnd && relroStart < end) {
+                // cut out the RELRO part (it may be at the beginning or at the end of the segment)
+                if (start < relroStart) search->segments.emplace_back((char*)start, relroStart - start);
+                start = std::max(start, relroEnd);
+            }
+            if (start < end) search->segments.emplace_back((char*)start, end - start);
+        }
+        return 1;
+    }, &search);
+
+    return search.segments;
+}
+
 #elif _WIN32
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <system_error>
 
-void ArduinoProgramManager::loadProgram(const std::string& fileName)
+/**
+ * Find the memory ranges holding global variables of a loaded program (writable PE sections).
+ */
+static std::vector<std::pair<char*, std::size_t>> getWritableSegments(void* handle)
 {
-    if (mArduinoProgramHandle) throw std::runtime_error("The Arduino program is already loaded!");
+    auto base = static_cast<char*>(handle);
+    auto ntHeaders = reinterpret_cast<IMAGE_NT_HEADERS*>(base + reinterpret_cast<IMAGE_DOS_HEADER*>(base)->e_lfanew);
+    auto section = IMAGE_FIRST_SECTION(ntHeaders);
+
+    std::vector<std::pair<char*, std::size_t>> segments;
+    for (std::size_t i = 0; i < ntHeaders->FileHeader.NumberOfSections; ++i, ++section) {
+        if (section->Characteristics & IMAGE_SCN_MEM_WRITE) {
+            segments.emplace_back(base + section->VirtualAddress, section->Misc.VirtualSize);
+        }
+    }
+    return segments;
+}
+
+// each DLL has its own copy of the interface with the emulator set explicitly (see loadProgram)
+ArduinoEmulatorBinding::ArduinoEmulatorBinding(ArduinoEmulator* emulator) : mPrevious(nullptr) {}
+ArduinoEmulatorBinding::~ArduinoEmulatorBinding() {}
 
-    mArduinoProgramHandle = LoadLibraryA(fileName.c_str());
+/**
+ * Make a private copy of the program in a temporary file, so it can be loaded as a separate instance
+ * (LoadLibrary returns the already loaded instance when the same file is opened again).
+ */
+static std::string createProgramCopy(const std::string& fileName)
+{
+    char tempDir[MAX_PATH + 1], copy[MAX_PATH + 1];
+    if (!GetTempPathA(MAX_PATH + 1, tempDir)) throw std::system_error(GetLastError(), std::system_category(), "GetTempPath");
+    if (!GetTempFileNameA(tempDir, "moc", 0, copy)) throw std::system_error(GetLastError(), std::system_category(), "GetTempFileName");
+    if (!CopyFileA(fileName.c_str(), copy, FALSE)) throw std::system_error(GetLastError(), std::system_category(), "Error copying Arduino program!");
+    return copy;
+}
+
+void ArduinoProgramManager::loadProgram(const std::string& fileName, bool isolated)
+{
+    if (isLoaded()) throw std::runtime_error("The Arduino program is already loaded!");
+
+    if (isolated) {
+        mProgramCopy = createProgramCopy(fileName);
+    }
+
+    mArduinoProgramHandle = LoadLibraryA(isolated ? mProgramCopy.c_str() : fileName.c_str());
     if (!mArduinoProgramHandle) throw std::system_error(GetLastError(), std::system_category(), "Error opening Arduino program!");
 
     mArduinoSetup = reinterpret_cast<decltype(mArduinoSetup)>(GetProcAddress((HMODULE)mArduinoProgramHandle, "setup"));
@@ -59,6 +199,11 @@ void ArduinoProgramManager::unloadProgram() {
         if (FreeLibrary((HMODULE)mArduinoProgramHandle) == 0) throw std::system_error(GetLastError(), std::system_category());
     }
 
+    if (!mProgramCopy.empty()) {
+        DeleteFileA(mProgramCopy.c_str());
+        mProgramCopy.clear();
+    }
+
     mArduinoProgramHandle = nullptr;
     mArduinoSetup = nullptr;
     mArduinoLoop = nullptr;
@@ -66,6 +211,29 @@ void ArduinoProgramManager::unloadProgram() {
 
 #endif
 
+ArduinoProgramSnapshot ArduinoProgramManager::createSnapshot() const
+{
+    ArduinoProgramSnapshot snapshot;
+    if (!mArduinoProgramHandle) return snapshot;
+
+    snapshot.program = mArduinoProgramHandle;
+    for (auto&& [address, size] : getWritableSegments(mArduinoProgramHandle)) {
+        snapshot.segments.push_back({ address, std::vector<char>(address, address + size) });
+    }
+    return snapshot;
+}
+
+void ArduinoProgramManager::restoreSnapshot(const ArduinoProgramSnapshot& snapshot)
+{
+    if (snapshot.program != mArduinoProgramHandle) {
+        throw std::runtime_error("The snapshot was taken from a different instance of the Arduino program.");
+    }
+
+    for (auto&& segment : snapshot.segments) {
+        std::copy(segment.data.begin(), segment.data.end(), segment.address);
+    }
+}
+
 ArduinoProgramManager::~ArduinoProgramManager()
 {
     try {
@@ -2,10 +2,45 @@
 #define PROGRAM_MANAGER_HPP
 
 #include <string>
+#include <vector>
 #include <stdexcept>
 
 class ArduinoEmulator;
 
+/**
+ * Binds given emulator to the Arduino API invoked from the current thread for the lifetime of this object
+ * (the previous binding is restored afterwards). This allows multiple emulators to run in one process.
+ */
+class ArduinoEmulatorBinding {
+private:
+    ArduinoEmulator* mPrevious;
+
+public:
+    ArduinoEmulatorBinding(ArduinoEmulator* emulator);
+    ~ArduinoEmulatorBinding();
+
+    ArduinoEmulatorBinding(const ArduinoEmulatorBinding&) = delete;
+    ArduinoEmulatorBinding& operator=(const ArduinoEmulatorBinding&) = delete;
+};
+
+/**
+ * Copy of the writable memory segments (.data and .bss) of a loaded program, i.e., values of its global variables.
+ * Memory allocated dynamically by the program is not included.
+ */
+struct ArduinoProgramSnapshot {
+    struct Segment {
+        char* address;
+        std::vector<char> data;
+    };
+
+    /**
+     * Handle of the program instance the snapshot was taken from (null if no program was loaded).
+     */
+    void* program = nullptr;
+
+    std::vector<Segment> segments;
+};
+
 class ArduinoProgramManager {
 private:
 
@@ -14,9 +49,15 @@ private:
 
     void* mArduinoProgramHandle;
 
+    /**
+     * Path to a private copy of the program (if it was loaded isolated and the copy needs to be removed on unload).
+     */
+    std::string mProgramCopy;
+
     /**
      * Only really necessary for Windows, as LoadLibrary doesn't perform reverse
      * linking (and as such the emulator's functions can't be linked to the running instance).
+     * On other platforms, the emulator is bound to the thread which invokes the program.
      */
     ArduinoEmulator* mEmulator;
 
@@ -36,23 +77,56 @@ public:
      * static and global object initialization (the emulator is fully up and running at this point,
      * so no crash).
      * @param fileName full name of the compiled program that is to be tested
+     * @param isolated if true, a private copy of the program is loaded, so it has its own globals
+     *                 (the same program may be loaded by multiple managers at once)
      */
-    void loadProgram(const std::string &fileName);
+    void loadProgram(const std::string &fileName, bool isolated = false);
+
+    /**
+     * Use given functions as setup() and loop() of the tested program instead of loading it from a file
+     * (e.g., a program compiled into the tests). Global variables of such program are not saved in snapshots.
+     */
+    void setProgram(void (*setup)(), void (*loop)())
+    {
+        if (isLoaded()) throw std::runtime_error("The Arduino program is already loaded!");
+        mArduinoSetup = setup;
+        mArduinoLoop = loop;
+    }
 
     /**
      * Unloads the tested program and automatically deinitializes its global objects.
      */
     void unloadProgram();
 
+    /**
+     * Whether the program has been loaded (and its global objects initialized).
+     */
+    bool isLoaded() const
+    {
+        return mArduinoProgramHandle != nullptr || mArduinoLoop != nullptr;
+    }
+
+    /**
+     * Save global variables of the loaded program (the snapshot is empty if no program is loaded).
+     */
+    ArduinoProgramSnapshot createSnapshot() const;
+
+    /**
+     * Restore global variables of the program from a snapshot taken from the same loaded instance.
+     */
+    void restoreSnapshot(const ArduinoProgramSnapshot& snapshot);
+
     void runSetup()
     {
-        if (mArduinoProgramHandle == nullptr) throw std::runtime_error("The arduino program is not loaded yet!");
+        if (mArduinoSetup == nullptr) throw std::runtime_error("The arduino program is not loaded yet!");
+        ArduinoEmulatorBinding binding(mEmulator);
         mArduinoSetup();
     }
 
     void runLoop()
     {
-        if (mArduinoProgramHandle == nullptr) throw std::runtime_error("The arduino program is not loaded yet!");
+        if (mArduinoLoop == nullptr) throw std::runtime_error("The arduino program is not loaded yet!");
+        ArduinoEmulatorBinding binding(mEmulator);
         mArduinoLoop();
     }
 };
@@ -4,11 +4,36 @@
 #include "emulator.hpp"
 
 #include <map>
+#include <array>
+#include <memory>
 #include <string>
 #include <algorithm>
 #include <deque>
 
 
+/**
+ * Source of input events which are produced lazily -- the simulation pulls the events only when its time
+ * approaches them, so the inputs need not be scheduled in advance (e.g., a long scenario read from a file).
+ * See ArduinoSimulationController::attachInputSource().
+ */
+class ArduinoInputSource
+{
+public:
+	virtual ~ArduinoInputSource() = default;
+
+	/**
+	 * Return the time of the next event the source will produce (max. value if there are none).
+	 */
+	virtual logtime_t nextEventTime() const = 0;
+
+	/**
+	 * Schedule all events up to given time (inclusive) in the simulation (using schedulePinValueChange()
+	 * or scheduleSerialInputEvent() of the controller). Events past given time should not be scheduled yet.
+	 */
+	virtual void feed(logtime_t time) = 0;
+};
+
+
 /**
  * Handles arduino simulation using an instance of arduino emulator (which holds the state).
  * Controller basically provides external interface for emulator which for the purposes
@@ -16,7 +41,56 @@
  */
 class ArduinoSimulationController
 {
+public:
+	/**
+	 * Saved state of the simulation (see createSnapshot()).
+	 */
+	struct Snapshot
+	{
+		ArduinoEmulator::Snapshot emulator;
+		ArduinoPinEventsBroadcast pinEvents;
+		std::vector<std::pair<pin_t, FutureTimeSeries<ArduinoPinState>>> inputBuffers;
+		std::deque<std::pair<logtime_t, std::string>> serialInput;
+	};
+
 private:
+	/**
+	 * Input buffer of one pin. If an input source is attached, the buffer pulls the source before it emits
+	 * its events, so the events are scheduled just in time (regardless of the order in which the pins are updated).
+	 */
+	class InputBuffer : public FutureTimeSeries<ArduinoPinState>
+	{
+	private:
+		ArduinoSimulationController& mController;
+
+	protected:
+		void doAdvanceTime(logtime_t time) override
+		{
+			mController.feedInputs(time);
+			FutureTimeSeries<ArduinoPinState>::doAdvanceTime(time);
+			if (mController.mInputSource != nullptr) {
+				discardConsumed(); // the events are fed continuously, so only the pending ones are kept
+			}
+		}
+
+	public:
+		using FutureTimeSeries<ArduinoPinState>::operator=;
+
+		InputBuffer(ArduinoSimulationController& controller) : mController(controller)
+		{
+			setDeferredMerge(); // the buffer is used only as a queue, so the events may be scheduled in any order
+		}
+
+		logtime_t nextEventTime() const override
+		{
+			logtime_t time = FutureTimeSeries<ArduinoPinState>::nextEventTime();
+			if (mController.mInputSource != nullptr) {
+				time = std::min(time, mController.mInputSource->nextEventTime());
+			}
+			return time;
+		}
+	};
+
 	ArduinoEmulator& mEmulator;
 
 	/**
@@ -26,15 +100,31 @@ private:
 
 	/**
 	 * Input buffers (future time series) that are used to store input events.
-	 * These buffers are created and attached as event consumers to input pins.
+	 * These buffers are created (lazily) and attached as event consumers to input pins.
+	 * The table is indexed directly by pin numbers (null if the pin has no buffer yet).
+	 */
+	std::array<std::unique_ptr<InputBuffer>, PINS_COUNT> mInputBuffers;
+
+	/**
+	 * Fan-out node shared by all pins with attached consumers (see attachPinEventsConsumer()).
 	 */
-	std::map<pin_t, FutureTimeSeries<ArduinoPinState>> mInputBuffers;
+	ArduinoPinEventsBroadcast mPinEvents;
 
 	/**
 	 * Registered simulation inputs, strings that will be sent as serial data (at given time)
 	 */
 	std::deque<std::pair<logtime_t, std::string>> mSerialInput;
 
+	/**
+	 * Source of input events pulled during the simulation (null if all inputs are scheduled in advance).
+	 */
+	ArduinoInputSource* mInputSource;
+
+	/**
+	 * If true, runLoopsForPeriod() skips loop() invocations that are known to be idle.
+	 */
+	bool mFastForward;
+
 	void setMethodEnableFlag(const std::string& name, bool enabled)
 	{
 		auto it = mEnableMethodFlags.find(name);
@@ -44,17 +134,91 @@ private:
 		*(it->second) = enabled;
 	}
 
+	/**
+	 * Pull the events from the input source (if attached) up to given time.
+	 */
+	void feedInputs(logtime_t time)
+	{
+		if (mInputSource != nullptr) {
+			mInputSource->feed(time);
+		}
+	}
+
+	/**
+	 * Get the input buffer of given pin (the buffer is created and attached to the pin when needed).
+	 */
+	InputBuffer& getInputBuffer(pin_t pin)
+	{
+		auto& buffer = mInputBuffers[pin];
+		if (!buffer) {
+			auto newBuffer = std::make_unique<InputBuffer>(*this);
+			mEmulator.registerPinInput(pin, *newBuffer);
+			buffer = std::move(newBuffer);
+		}
+		return *buffer;
+	}
+
 	void advanceCurrentTimeBy(logtime_t time)
 	{
 		logtime_t currentTime = mEmulator.advanceCurrentTimeBy(time);
+		feedInputs(currentTime); // serial inputs and pins which have no buffers yet
+		mEmulator.synchronizeTime();
 		while (!mSerialInput.empty() && mSerialInput.front().first <= currentTime) {
 			mEmulator.addSerialData(mSerialInput.front().second);
 			mSerialInput.pop_front();
 		}
 	}
 
+	/**
+	 * Return the time of the nearest scheduled input event (pin or serial).
+	 */
+	logtime_t getNextInputEventTime()
+	{
+		logtime_t time = mEmulator.getNextInputEventTime();
+		if (!mSerialInput.empty()) {
+			time = std::min(time, mSerialInput.front().first);
+		}
+		if (mInputSource != nullptr) {
+			time = std::min(time, mInputSource->nextEventTime());
+		}
+		return time;
+	}
+
+	/**
+	 * Skip loop() invocations which would be exact repetitions of the last (idle) one.
+	 * The last loop had no side effects, so the following loops will behave the same way (and take the same time)
+	 * as long as they receive no new inputs and all values they read from millis() or micros() stay the same.
+	 * It is assumed, that the tested program keeps no state that changes in idle loops (e.g., a loop counter).
+	 * @param loopStart time when the last (idle) loop started
+	 * @param endTime time when the loops of the simulation period end
+	 */
+	void fastForwardIdleLoops(logtime_t loopStart, logtime_t endTime)
+	{
+		logtime_t now = getCurrentTime();
+		logtime_t period = now - loopStart;
+
+		// k-th loop after the idle one starts at loopStart + k * period, find the first one that needs to be executed
+		logtime_t nextEvent = getNextInputEventTime();
+		if (period == 0 || nextEvent <= now) {
+			return;
+		}
+
+		// last loop which starts before the next input event is delivered
+		logtime_t k = (nextEvent - 1 - loopStart) / period;
+
+		// all skipped loops must read the same time values
+		k = std::min(k, (mEmulator.mLoopTimeSlack - 1) / period + 1);
+
+		// first loop which would not be executed at all (the simulation period ends)
+		k = std::min(k, (endTime - loopStart + period - 1) / period);
+
+		if (k > 1) {
+			advanceCurrentTimeBy(loopStart + k * period - now);
+		}
+	}
+
 public:
-	ArduinoSimulationController(ArduinoEmulator& emulator) : mEmulator(emulator)
+	ArduinoSimulationController(ArduinoEmulator& emulator) : mEmulator(emulator), mInputSource(nullptr), mFastForward(false)
 	{
 		removeAllPins();
 		mEmulator.reset();
@@ -91,6 +255,28 @@ public:
 		return mEmulator.mCurrentTime;
 	}
 
+	/**
+	 * Enable or disable fast-forwarding of idle loops in runLoopsForPeriod(). If enabled, loop() invocations
+	 * with no side effects (no writes, no serial I/O) are detected and simulated time jumps right before
+	 * the next scheduled input event (or before the time values read by the loop would change).
+	 * Skipped loops are not reported to the callback. The tested program must not keep any state that changes
+	 * in loops without side effects (e.g., it must not count loop invocations).
+	 */
+	void setFastForward(bool enabled = true)
+	{
+		mFastForward = enabled;
+	}
+
+	/**
+	 * Enable or disable shiftOut() transactions (enabled by default). If enabled, shiftOut() delivers one transaction
+	 * to the consumers of the data and clock pins instead of 24 individual pin events (the consumers which do not
+	 * implement ArduinoShiftOutConsumer receive the individual events anyway, with the same timestamps).
+	 */
+	void setShiftOutTransactions(bool enabled = true)
+	{
+		mEmulator.mShiftOutTransactions = enabled;
+	}
+
 	/**
 	 * Enable given method in emulator. At the beginning, all methods are enabled.
 	 */
@@ -113,6 +299,10 @@ public:
 	void removeAllPins()
 	{
 		mEmulator.removeAllPins();
+		mPinEvents = ArduinoPinEventsBroadcast();
+		for (auto& buffer : mInputBuffers) {
+			buffer.reset(); // scheduled inputs of removed pins are dropped
+		}
 	}
 
 	/**
@@ -123,13 +313,36 @@ public:
 		mEmulator.registerPin(pin, wiring);
 	}
 
+	/**
+	 * Enable or disable suppression of writes that do not change the value of given pin
+	 * (such writes are passed to the consumers of the pin only as time notifications).
+	 */
+	void setPinChangeSuppression(pin_t pin, bool enabled = true)
+	{
+		mEmulator.getPin(pin).setSuppressUnchanged(enabled);
+	}
+
 	/**
 	 * Attach an event consumer to an output pin. The cosumer receives all events produced by the pin.
+	 * The consumers are not chained, each one is subscribed to a common fan-out node (ArduinoPinEventsBroadcast),
+	 * so a consumer attached to several pins receives only their events and any number of independent
+	 * consumers may observe the same simulation run.
 	 */
 	void attachPinEventsConsumer(pin_t pin, EventConsumer<ArduinoPinState> &consumer)
 	{
 		auto& arduinoPin = mEmulator.getPin(pin);
-		arduinoPin.lastConsumer()->attachNextConsumer(consumer);
+		if (arduinoPin.nextConsumer() != &mPinEvents) {
+			arduinoPin.attachNextConsumer(mPinEvents);
+		}
+		mPinEvents.subscribe(consumer, pin);
+	}
+
+	/**
+	 * Detach an event consumer from all pins it was attached to.
+	 */
+	void detachPinEventsConsumer(EventConsumer<ArduinoPinState>& consumer)
+	{
+		mPinEvents.unsubscribe(consumer);
 	}
 
 	/**
@@ -137,27 +350,73 @@ public:
 	 */
 	int getPinValue(pin_t pin) const
 	{
+		mEmulator.synchronizeTime();
 		auto& arduinoPin = mEmulator.getPin(pin);
 		return arduinoPin.mState.value;
 	}
 
+	/**
+	 * Attach an additional input to given input pin (e.g., one of the generators from input_generators.hpp).
+	 * The input is chained between the input buffer of the pin and the pin itself, so it receives the scheduled
+	 * events and it may inject its own (which must not precede the current time). Multiple inputs may be attached
+	 * to one pin. The inputs must stay alive as long as the simulation runs and they cannot be saved in snapshots.
+	 */
+	void registerPinInput(pin_t pin, EventConsumer<ArduinoPinState>& input)
+	{
+		if (input.nextEventTime() < getCurrentTime()) {
+			throw ArduinoEmulatorException("Unable to attach input which would produce events in the past.");
+		}
+
+		auto& arduinoPin = mEmulator.getPin(pin);
+		EventConsumer<ArduinoPinState>* last = &getInputBuffer(pin);
+		while (last->nextConsumer() != &arduinoPin) {
+			last = last->nextConsumer();
+		}
+		last->detachNextConsumer();
+		last->attachNextConsumer(input);
+		input.lastConsumer()->attachNextConsumer(arduinoPin);
+		mEmulator.invalidateTimeHorizon();
+	}
+
+	/**
+	 * Schedule a change of given pin at given (absolute) time using pin events (works only on input pins).
+	 * The time must not precede the events the pin has already received.
+	 */
+	void schedulePinValueChange(pin_t pin, int value, logtime_t time)
+	{
+		getInputBuffer(pin).addFutureEvent(time, ArduinoPinState(pin, value));
+		mEmulator.invalidateTimeHorizon();
+	}
+
+	/**
+	 * Schedule a sequence of changes of given pin at once (the changes may be in any order, they are sorted
+	 * and merged with the scheduled events in one step). Otherwise, the same rules as in schedulePinValueChange() apply.
+	 */
+	void schedulePinValueChanges(pin_t pin, const std::vector<TimedEvent<int>>& changes)
+	{
+		std::vector<TimedEvent<ArduinoPinState>> events;
+		events.reserve(changes.size());
+		for (auto& change : changes) {
+			events.emplace_back(change.time, ArduinoPinState(pin, change.value));
+		}
+		getInputBuffer(pin).addFutureEvents(events);
+		mEmulator.invalidateTimeHorizon();
+	}
+
 	/**
 	 * Enqueue a change of given pin using pin events (works only on input pins).
 	 * The event is scheduled at current time (with optional delay).
 	 */
 	void enqueuePinValueChange(pin_t pin, int value, logtime_t delay = 0)
 	{
-		bool needsRegistration = mInputBuffers.find(pin) == mInputBuffers.end();
-		mInputBuffers[pin].addFutureEvent(mEmulator.mCurrentTime + delay, ArduinoPinState(pin, value));
-
-		if (needsRegistration) {
-			mEmulator.registerPinInput(pin, mInputBuffers[pin]);
-		}
+		schedulePinValueChange(pin, value, mEmulator.mCurrentTime + delay);
 	}
 
-	void enqueueSerialInputEvent(const std::string& input, logtime_t delay = 0)
+	/**
+	 * Schedule data sent over the serial link at given (absolute) time. Serial events must be scheduled in order.
+	 */
+	void scheduleSerialInputEvent(const std::string& input, logtime_t time)
 	{
-		logtime_t time = mEmulator.mCurrentTime + delay;
 		if (!mSerialInput.empty() && mSerialInput.back().first > time) {
 			throw ArduinoEmulatorException("Adding serial input event at " + std::to_string(time)
 				+ " would violate ordering, since last event is already scheduled at "
@@ -166,6 +425,42 @@ public:
 		mSerialInput.emplace_back(std::make_pair(time, input));
 	}
 
+	void enqueueSerialInputEvent(const std::string& input, logtime_t delay = 0)
+	{
+		scheduleSerialInputEvent(input, mEmulator.mCurrentTime + delay);
+	}
+
+	/**
+	 * Attach a source of input events which is pulled lazily while the simulation is running (only one source
+	 * may be attached). The source may change any pin which is registered as input (when the source is attached)
+	 * and send serial data. Its events are kept only until they are delivered, so the memory does not depend
+	 * on the length of the input. The source must stay alive until it is detached (or the simulation ends).
+	 */
+	void attachInputSource(ArduinoInputSource& source)
+	{
+		if (mInputSource != nullptr) {
+			throw ArduinoEmulatorException("Another input source is already attached.");
+		}
+		mInputSource = &source;
+
+		// every input pin pulls the source before its events are emitted
+		for (std::size_t pin = 0; pin < PINS_COUNT; ++pin) {
+			if (mEmulator.mRegisteredPins[pin] && mEmulator.mPins[pin].mWiring == INPUT) {
+				getInputBuffer((pin_t)pin);
+			}
+		}
+		mEmulator.invalidateTimeHorizon();
+	}
+
+	/**
+	 * Detach the input source (the events it has already scheduled remain scheduled).
+	 */
+	void detachInputSource()
+	{
+		mInputSource = nullptr;
+		mEmulator.invalidateTimeHorizon();
+	}
+
 
 	/**
 	 * Clear all events for pin's queue.
@@ -173,7 +468,12 @@ public:
 	void clearPinEvents(pin_t pin)
 	{
 		auto& arduinoPin = mEmulator.getPin(pin);
-		arduinoPin.clear();
+		if (arduinoPin.nextConsumer() == &mPinEvents) {
+			mPinEvents.clearPin(pin);
+		}
+		else {
+			arduinoPin.clear();
+		}
 	}
 
 	/**
@@ -186,10 +486,93 @@ public:
 
 	/**
 	* Load the student's tested code after the emulator's initialization
+	* @param isolated if true, a private copy of the code is loaded, so multiple simulations of the same program
+	*                 (each with its own emulator) may run in one process
 	*/
-	void loadTestedCode(const std::string &fileName)
+	void loadTestedCode(const std::string &fileName, bool isolated = false)
+	{
+		mEmulator.loadTestedCode(fileName, isolated);
+	}
+
+	/**
+	 * Use given functions as setup() and loop() of the tested code instead of loading it from a file
+	 * (e.g., a program compiled into the tests).
+	 */
+	void setTestedCode(void (*setup)(), void (*loop)())
+	{
+		mEmulator.setTestedCode(setup, loop);
+	}
+
+	/**
+	 * Whether the tested code has been loaded already (e.g., preloaded before the simulation was set up).
+	 */
+	bool isTestedCodeLoaded() const
 	{
-		mEmulator.loadTestedCode(fileName);
+		return mEmulator.isTestedCodeLoaded();
+	}
+
+	/**
+	 * Save the complete state of the simulation -- the emulator, global variables of the tested code,
+	 * and scheduled inputs. The snapshot can be restored (multiple times) to branch several scenarios
+	 * from one checkpoint without replaying setup() and the common prefix of the simulation.
+	 * Event consumers attached to the pins are restored only as links; their state needs to be saved
+	 * by the caller (the consumers are plain values, so they can be saved by copying).
+	 * The position of an attached input source cannot be saved, so the source needs to be detached first.
+	 * Simulations with inputs attached by registerPinInput() cannot be saved at all.
+	 */
+	Snapshot createSnapshot() const
+	{
+		if (mInputSource != nullptr) {
+			throw ArduinoEmulatorException("Simulation with an attached input source cannot be saved.");
+		}
+
+		for (auto pin : mEmulator.mInputPins) {
+			if (mInputBuffers[pin] && mInputBuffers[pin]->nextConsumer() != &mEmulator.mPins[pin]) {
+				throw ArduinoEmulatorException("Simulation with attached pin inputs cannot be saved.");
+			}
+		}
+
+		Snapshot snapshot;
+		snapshot.emulator = mEmulator.createSnapshot();
+		snapshot.pinEvents = mPinEvents;
+		for (auto pin : mEmulator.mInputPins) {
+			if (mInputBuffers[pin]) {
+				snapshot.inputBuffers.emplace_back(pin, *mInputBuffers[pin]);
+			}
+		}
+		snapshot.serialInput = mSerialInput;
+		return snapshot;
+	}
+
+	/**
+	 * Restore the state saved by createSnapshot() of this controller. Input events scheduled after the snapshot
+	 * was taken are discarded.
+	 */
+	void restoreSnapshot(const Snapshot& snapshot)
+	{
+		for (auto& [pin, buffer] : snapshot.inputBuffers) {
+			if (!mInputBuffers[pin]) {
+				throw ArduinoEmulatorException("The snapshot does not match the input buffers of the simulation.");
+			}
+		}
+
+		mEmulator.restoreSnapshot(snapshot.emulator);
+		mPinEvents = snapshot.pinEvents;
+
+		// empty all buffers (clear() is not used, since it would be propagated to the pins)
+		for (auto pin : mEmulator.mInputPins) {
+			auto& buffer = mInputBuffers[pin];
+			if (buffer) {
+				auto next = buffer->nextConsumer();
+				*buffer = FutureTimeSeries<ArduinoPinState>();
+				buffer->attachNextConsumer(*next);
+				buffer->setDeferredMerge();
+			}
+		}
+		for (auto& [pin, buffer] : snapshot.inputBuffers) {
+			*mInputBuffers[pin] = buffer;
+		}
+		mSerialInput = snapshot.serialInput;
 	}
 
 	/**
@@ -233,6 +616,7 @@ public:
 
 	/**
 	 * Run loops for given time period.
+	 * If fast-forwarding is enabled (see setFastForward()), idle loops may be skipped.
 	 * @param period How long whould we loop.
 	 * @param loopDelay How much is internal clock advanced after every loop.
 	 */
@@ -240,12 +624,26 @@ public:
 		std::function<bool(logtime_t)> callback = [](logtime_t) { return true; })
 	{
 		logtime_t endTime = getCurrentTime() + period;
+		std::size_t idleLoops = 0; // number of consecutive idle loops which received no inputs
 		while (getCurrentTime() < endTime) {
+			logtime_t loopStart = getCurrentTime();
+			logtime_t nextEvent = mFastForward ? getNextInputEventTime() : 0;
 			runSingleLoop(loopDelay);
 
 			if (!callback(getCurrentTime())) {
 				break;
 			}
+
+			if (mFastForward) {
+				// inputs delivered during the loop (or right after it) may change the behavior of the next loop
+				bool idle = !mEmulator.mLoopSideEffects && nextEvent > getCurrentTime();
+				idleLoops = idle ? idleLoops + 1 : 0;
+
+				// two idle loops in a row indicate the program is in a steady state (just polling inputs)
+				if (idleLoops >= 2) {
+					fastForwardIdleLoops(loopStart, endTime);
+				}
+			}
 		}
 	}
 };
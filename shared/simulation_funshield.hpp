@@ -14,6 +14,17 @@ class FunshieldSimulationController
 public:
 	using leds_display_t = LedDisplay<4>;
 	using seg_display_t = SerialSegLedDisplay<4>;
+
+	/**
+	 * Saved state of the funshield simulation (see createSnapshot()).
+	 */
+	struct Snapshot
+	{
+		ArduinoSimulationController::Snapshot arduino;
+		leds_display_t leds;
+		seg_display_t segDisplay;
+	};
+
 private:
 	/**
 	 * Underlying arduino simulator used for lowlevel operations and code invocation.
@@ -62,6 +73,7 @@ public:
 		}
 		for (auto pin : mLedPins) {
 			mArduino.registerPin(pin, OUTPUT);
+			mArduino.setPinChangeSuppression(pin); // LEDs are usually rewritten in every loop, only changes matter
 		}
 
 		// serial interface for the 7seg LEDs
@@ -86,6 +98,32 @@ public:
 		return mArduino;
 	}
 
+	/**
+	 * Set the delay between two state changes when button bouncing is simulated (zero disables the bouncing).
+	 */
+	void setButtonBouncingDelay(logtime_t delay)
+	{
+		mButtonBouncingDelay = delay;
+	}
+
+	/**
+	 * Save the state of the simulation including the displays (see ArduinoSimulationController::createSnapshot()).
+	 */
+	Snapshot createSnapshot() const
+	{
+		return { mArduino.createSnapshot(), mLeds, mSegDisplay };
+	}
+
+	/**
+	 * Restore the state saved by createSnapshot().
+	 */
+	void restoreSnapshot(const Snapshot& snapshot)
+	{
+		mArduino.restoreSnapshot(snapshot.arduino);
+		mLeds = snapshot.leds;
+		mSegDisplay = snapshot.segDisplay;
+	}
+
 	/**
 	 * Get LEDs grouped into simple display object.
 	 */
@@ -118,6 +156,33 @@ s	 */
 		return mSegDisplay;
 	}
 
+	/**
+	 * Schedule a change of button state at given (absolute) time.
+	 * @param button zero-based index of the button (0 is button1)
+	 * @param pressed new state of the button (true = down)
+	 * @param time when the state changes
+	 * @param bouncing flag indicates whether bouncing effect will be applied (also the bouncing delay must be > 0)
+	 */
+	void scheduleButtonChange(std::size_t button, bool pressed, logtime_t time, bool bouncing = true)
+	{
+		int value = pressed ? LOW : HIGH;
+		if (!bouncing || mButtonBouncingDelay == 0) {
+			mArduino.schedulePinValueChange(mButtionPins[button], value, time);
+			return;
+		}
+
+		// the bouncing events may interleave with events scheduled before, so they are merged in one batch
+		std::vector<TimedEvent<int>> changes;
+		changes.emplace_back(time, value);
+		for (std::size_t i = 1; i <= 3; ++i) {
+			time += mButtonBouncingDelay;
+			changes.emplace_back(time, value == LOW ? HIGH : LOW);
+			time += mButtonBouncingDelay;
+			changes.emplace_back(time, value);
+		}
+		mArduino.schedulePinValueChanges(mButtionPins[button], changes);
+	}
+
 	/**
 	 * Press button (schedule event).
 	 * @param button zero-based index of the button (0 is button1)
@@ -126,17 +191,7 @@ s	 */
 	 */
 	void buttonDown(std::size_t button, logtime_t afterDelay = 0, bool bouncing = true)
 	{
-		mArduino.enqueuePinValueChange(mButtionPins[button], LOW, afterDelay);
-
-		if (bouncing && mButtonBouncingDelay > 0) {
-			logtime_t delay = afterDelay;
-			for (std::size_t i = 1; i <= 3; ++i) {
-				delay += mButtonBouncingDelay;
-				buttonUp(button, delay, false);
-				delay += mButtonBouncingDelay;
-				buttonDown(button, delay, false);
-			}
-		}
+		scheduleButtonChange(button, true, mArduino.getCurrentTime() + afterDelay, bouncing);
 	}
 
 	/**
@@ -147,17 +202,7 @@ s	 */
 	 */
 	void buttonUp(std::size_t button, logtime_t afterDelay = 0, bool bouncing = true)
 	{
-		mArduino.enqueuePinValueChange(mButtionPins[button], HIGH, afterDelay);
-
-		if (bouncing && mButtonBouncingDelay > 0) {
-			logtime_t delay = afterDelay;
-			for (std::size_t i = 1; i <= 3; ++i) {
-				delay += mButtonBouncingDelay;
-				buttonDown(button, delay, false);
-				delay += mButtonBouncingDelay;
-				buttonUp(button, delay, false);
-			}
-		}
+		scheduleButtonChange(button, false, mArduino.getCurrentTime() + afterDelay, bouncing);
 	}
 
 	/**
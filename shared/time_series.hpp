@@ -8,13 +8,42 @@
 #include <limits>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <type_traits>
 #include <cstdint>
 #include <cmath>
+#include <tuple>
+#include <utility>
+#include <charconv>
+
+#include "time_statistics.hpp"
 
 using logtime_t = std::uint64_t;
 
+/**
+ * Event with its timestamp. This is the item type of time series and of event batches (see EventConsumer::addEvents()).
+ */
+template<typename VALUE, typename TIME = logtime_t>
+struct TimedEvent {
+public:
+	TIME time;		///< when the event happen
+	VALUE value;	///< associated value of the event (new state)
+
+	TimedEvent(TIME t, VALUE v) : time(t), value(v) {}
+
+	// make the sorting algorithm great again!
+	inline bool operator<(const TimedEvent& e) const
+	{
+		return time < e.time || (time == e.time && value < e.value);
+	}
+
+	inline bool operator==(const TimedEvent& e) const
+	{
+		return time == e.time && value == e.value;
+	}
+};
+
 
 /**
  * Base class for all event consumers. Event consumer is an interface that fills events
@@ -25,6 +54,9 @@ using logtime_t = std::uint64_t;
 template<typename VALUE, typename TIME = logtime_t>
 class EventConsumer
 {
+public:
+	using event_t = TimedEvent<VALUE, TIME>;
+
 private:
 	/**
 	 * Reference to the next consumer in the chain. We are using shared pointers,
@@ -49,6 +81,16 @@ protected:
 		}
 	}
 
+	/**
+	 * Pass a batch of events to the next consumer in the chain.
+	 */
+	void nextAddEvents(const event_t* events, std::size_t count)
+	{
+		if (mNextConsumer != nullptr) {
+			mNextConsumer->addEvents(events, count);
+		}
+	}
+
 	/**
 	 * Notify the next consumer that tempus fugit!
 	 */
@@ -75,6 +117,26 @@ protected:
 		nextAddEvent(time, value);
 	}
 
+	/**
+	 * Process a batch of events (their ordering has been already verified by addEvents()).
+	 * The default implementation processes the events one by one, as if they were added by addEvent().
+	 */
+	virtual void doAddEvents(const event_t* events, std::size_t count)
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			doAddEvent(events[i].time, events[i].value);
+			mLastTime = events[i].time;
+		}
+	}
+
+	/**
+	 * Hint that a batch of given size is going to be added (e.g., so the consumer can preallocate its storage).
+	 */
+	virtual void reserveEvents(std::size_t)
+	{
+		// base class does not store events
+	}
+
 	virtual void doAdvanceTime(TIME time)
 	{
 		// base class have no implementation, just a transparent throughput
@@ -134,7 +196,7 @@ public:
 	/**
 	 * Attach next event consumer right after this one.
 	 */
-	void attachNextConsumer(EventConsumer<VALUE, TIME> &consumer)
+	virtual void attachNextConsumer(EventConsumer<VALUE, TIME> &consumer)
 	{
 		if (mNextConsumer != nullptr) {
 			throw std::runtime_error("Next consumer is already attached.");
@@ -145,7 +207,7 @@ public:
 	/**
 	 * Detach the next event consumer.
 	 */
-	void detachNextConsumer()
+	virtual void detachNextConsumer()
 	{
 		if (mNextConsumer == nullptr) {
 			throw std::runtime_error("No next consumer is attached.");
@@ -169,6 +231,38 @@ public:
 		mLastTime = time;
 	}
 
+	/**
+	 * Consume a batch of events. The ordering is verified once per batch and the consumer may process
+	 * the events in a tight loop (without a virtual call per event). The outcome is the same as if the events
+	 * were added one by one. Large batches are verified and processed in chunks (so the events are still cached
+	 * when processed), if the causality is violated, the chunks before the violating one are already consumed.
+	 * @param events array of events sorted by time
+	 * @param count number of events in the array
+	 */
+	void addEvents(const event_t* events, std::size_t count)
+	{
+		constexpr std::size_t CHUNK = 4096;
+		reserveEvents(count);
+		for (std::size_t start = 0; start < count; start += CHUNK) {
+			std::size_t end = std::min(start + CHUNK, count);
+			TIME lastTime = mLastTime;
+			for (std::size_t i = start; i < end; ++i) {
+				if (events[i].time < lastTime) {
+					throw std::runtime_error("Unable to add event that violates causality.");
+				}
+				lastTime = events[i].time;
+			}
+
+			doAddEvents(events + start, end - start);
+			mLastTime = lastTime;
+		}
+	}
+
+	void addEvents(const std::vector<event_t>& events)
+	{
+		addEvents(events.data(), events.size());
+	}
+
 	/**
 	 * Notifies the event consumer that the time has advanced. This might be useful in case one of the consumers
 	 * in chain is actually delaying or emitting events so the whole pipeline will not get stuck.
@@ -182,6 +276,16 @@ public:
 		mLastTime = time;
 	}
 
+	/**
+	 * Returns the earliest time at which this consumer would emit an event on its own (i.e., when advanceTime
+	 * is invoked). Consumers that only react to incoming events return max. value. This is used by the emulator
+	 * to avoid propagating time notifications which would not produce anything.
+	 */
+	virtual TIME nextEventTime() const
+	{
+		return std::numeric_limits<TIME>::max();
+	}
+
 	/**
 	 * Clear all recorded events (start all over again).
 	 * Logical time is not reset.
@@ -318,6 +422,182 @@ public:
 		: mLastValue(), mEventCallback(eventCallback), mClearCallback(clearCallback) {}
 };
 
+/**
+ * Event consumer which knows the type of the next consumer in the chain at compile time. Stages derived from this class
+ * pass events to next() instead of the generic nextConsumer(), so if NEXT is a final class, the calls along the chain
+ * are devirtualized and they may be inlined (see EventPipeline). The default NEXT keeps the regular runtime linking.
+ */
+template<typename VALUE, typename TIME = logtime_t, class NEXT = EventConsumer<VALUE, TIME>>
+class StaticEventConsumer : public EventConsumer<VALUE, TIME>
+{
+private:
+	/**
+	 * The next consumer (the same object as nextConsumer(), but with the exact type).
+	 */
+	NEXT* mNext;
+
+protected:
+	NEXT* next() const
+	{
+		return mNext;
+	}
+
+public:
+	StaticEventConsumer() : mNext(nullptr) {}
+
+	void attachNextConsumer(EventConsumer<VALUE, TIME>& consumer) override
+	{
+		auto next = dynamic_cast<NEXT*>(&consumer);
+		if (next == nullptr) {
+			throw std::runtime_error("The next consumer does not match the type required by this stage.");
+		}
+		EventConsumer<VALUE, TIME>::attachNextConsumer(consumer);
+		mNext = next;
+	}
+
+	void detachNextConsumer() override
+	{
+		EventConsumer<VALUE, TIME>::detachNextConsumer();
+		mNext = nullptr;
+	}
+};
+
+
+/**
+ * Makes a consumer class final, so the compiler knows the exact type of its objects.
+ */
+template<class CONSUMER>
+class FinalEventConsumer final : public CONSUMER
+{
+public:
+	using CONSUMER::CONSUMER;
+};
+
+
+namespace internal
+{
+	/**
+	 * Binds the types of pipeline stages together (each stage gets the final type of its successor).
+	 * All stages but the last one need to provide `template<class NEXT> using with_next` alias.
+	 */
+	template<class STAGE, class... REST>
+	struct PipelineStages
+	{
+		using next_t = typename PipelineStages<REST...>::head_t;
+		using head_t = FinalEventConsumer<typename STAGE::template with_next<next_t>>;
+		using tuple_t = decltype(std::tuple_cat(std::declval<std::tuple<head_t>>(), std::declval<typename PipelineStages<REST...>::tuple_t>()));
+	};
+
+	template<class STAGE>
+	struct PipelineStages<STAGE>
+	{
+		using head_t = FinalEventConsumer<STAGE>;
+		using tuple_t = std::tuple<head_t>;
+	};
+}
+
+
+/**
+ * Pipeline of consumers composed at compile time. The stages are given in the order of the event flow, e.g.
+ * `EventPipeline<LedsEventsDemultiplexer<32>, LedsEventsAggregator<32>, TimeSeries<BitArray<32>>>`.
+ * Each stage is bound to the exact type of the next one, so the whole chain may be inlined by the compiler.
+ * The pipeline interoperates with the runtime-linked consumers -- head() may be attached to any consumer chain
+ * and other consumers may be attached after tail().
+ */
+template<class... STAGES>
+class EventPipeline
+{
+public:
+	using stages_t = typename internal::PipelineStages<STAGES...>::tuple_t;
+	static constexpr std::size_t STAGES_COUNT = sizeof...(STAGES);
+
+private:
+	stages_t mStages;
+
+	template<std::size_t... I>
+	void link(std::index_sequence<I...>)
+	{
+		(std::get<I>(mStages).attachNextConsumer(std::get<I + 1>(mStages)), ...);
+	}
+
+	template<typename ARGS, std::size_t... I>
+	EventPipeline(const ARGS& args, std::index_sequence<I...>) :
+		mStages(std::make_from_tuple<std::tuple_element_t<I, stages_t>>(std::get<I>(args))...)
+	{
+		link(std::make_index_sequence<STAGES_COUNT - 1>());
+	}
+
+public:
+	/**
+	 * All stages are default-constructed.
+	 */
+	EventPipeline()
+	{
+		link(std::make_index_sequence<STAGES_COUNT - 1>());
+	}
+
+	/**
+	 * Each stage is constructed from a tuple of arguments (e.g., `std::make_tuple(15000)`, `std::make_tuple()`).
+	 */
+	template<typename... ARGS, typename = std::enable_if_t<sizeof...(ARGS) == sizeof...(STAGES)>>
+	EventPipeline(ARGS... args) : EventPipeline(std::make_tuple(args...), std::index_sequence_for<STAGES...>())
+	{}
+
+	// the stages are linked by pointers
+	EventPipeline(const EventPipeline&) = delete;
+	EventPipeline& operator=(const EventPipeline&) = delete;
+
+	/**
+	 * Get the I-th stage of the pipeline.
+	 */
+	template<std::size_t I>
+	auto& get()
+	{
+		return std::get<I>(mStages);
+	}
+
+	template<std::size_t I>
+	const auto& get() const
+	{
+		return std::get<I>(mStages);
+	}
+
+	/**
+	 * The first stage (which receives events).
+	 */
+	auto& head()
+	{
+		return get<0>();
+	}
+
+	/**
+	 * The last stage (e.g., a time series that collects the results).
+	 */
+	auto& tail()
+	{
+		return get<STAGES_COUNT - 1>();
+	}
+
+	const auto& tail() const
+	{
+		return get<STAGES_COUNT - 1>();
+	}
+};
+
+
+namespace internal
+{
+	/**
+	 * Detects values which can be formatted into a string buffer directly (e.g., BitArray).
+	 */
+	template<typename T, typename = void>
+	struct HasAppendHex : std::false_type {};
+
+	template<typename T>
+	struct HasAppendHex<T, std::void_t<decltype(std::declval<const T&>().appendHex(std::declval<std::string&>()))>> : std::true_type {};
+}
+
+
 template<typename TIME = logtime_t>
 class TimeSeriesBase
 {
@@ -383,217 +663,481 @@ public:
 	virtual TIME getEventTime(std::size_t idx) const = 0;
 	virtual std::string getEventAsString(std::size_t idx) const = 0;
 
+	/**
+	 * Append the value of an event (formatted the same way as getEventAsString) to given buffer.
+	 * Derived classes override it to format values without temporary strings.
+	 */
+	virtual void appendEventAsString(std::size_t idx, std::string& buffer) const
+	{
+		buffer += getEventAsString(idx);
+	}
+
 protected:
+	/**
+	 * Append a string wrapped in double quotes to the buffer (all double quotes inside are properly encoded).
+	 */
+	static void append_doublequoted(std::string_view str, std::string& buffer)
+	{
+		buffer += '"';
+		for (char c : str) {
+			if (c == '"') buffer += '"'; // prefix double quote with another (RFC 4180)
+			buffer += c;
+		}
+		buffer += '"';
+	}
+
 	/**
 	 * Wrap a string in double quotes and properly encode all double quotes inside.
 	 */
 	static std::string encode_doublequotes(const std::string& str)
 	{
-		std::stringstream result;
-		result << '"';
-		std::for_each(str.begin(), str.end(), [&](const char c) {
-			if (c == '"') result << '"'; // prefix double quote with another (RFC 4180)
-			result << c;
-		});
-		result << '"';
-		return result.str();
+		std::string result;
+		append_doublequoted(str, result);
+		return result;
 	}
 
+	/**
+	 * Append a value converted to string to the buffer.
+	 */
 	template<typename T>
-	static std::string convert(const T& value) {
+	static void appendConverted(const T& value, std::string& buffer)
+	{
 		if constexpr (std::is_same_v<T, std::string>) {
-			return encode_doublequotes(value);
+			append_doublequoted(value, buffer);
+		}
+		else if constexpr (std::is_same_v<T, bool>) {
+			buffer += value ? '1' : '0';
 		}
-		if constexpr (std::is_same_v<T, bool>) {
-			return value ? "1" : "0";
+		else if constexpr (std::is_integral_v<T>) {
+			char digits[24];
+			buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
 		}
-		if constexpr (std::is_arithmetic_v<T>) {
-			return std::to_string(value);
+		else if constexpr (std::is_arithmetic_v<T>) {
+			buffer += std::to_string(value);
+		}
+		else if constexpr (internal::HasAppendHex<T>::value) {
+			value.appendHex(buffer);
 		}
 		else {
-			return std::string(value);
+			buffer += std::string(value);
 		}
 	}
+
+	template<typename T>
+	static std::string convert(const T& value) {
+		std::string result;
+		appendConverted(value, result);
+		return result;
+	}
 };
 
 /**
- * A container of time-marked events. It provides a similar interface like vector
- * (which is also used as internal storage) and additionaly some analytical functions that
- * might help with behavioral assertions.
- * @tparam VALUE the inner value of each event (e.g., a state of a pin)
- * @tparam TIME type used for logical time stamps
+ * Default storage of time series events -- a vector of (time, value) structures.
  */
-template<typename VALUE, typename TIME = logtime_t> 
-class TimeSeries : public TimeSeriesBase<TIME>, public EventConsumer<VALUE, TIME>
+template<typename VALUE, typename TIME = logtime_t>
+class RowEventsStorage : public std::vector<TimedEvent<VALUE, TIME>>
 {
 public:
-	using Range = typename TimeSeriesBase<TIME>::Range;
-
 	/**
-	 * Internal structure that wraps all time series events.
+	 * The events are stored in one array, so they can be passed on as a batch without copying.
 	 */
-	struct Event {
-	public:
-		TIME time;		///< when the event happen
-		VALUE value;	///< associated value of the event (new state)
-
-		Event(TIME t, VALUE v) : time(t), value(v) {}
-
-		// make the sorting algorithm great again!
-		inline bool operator<(const Event& e) const
-		{
-			return time < e.time || (time == e.time && value < e.value);
-		}
-
-		inline bool operator==(const Event& e) const
-		{
-			return time == e.time && value == e.value;
-		}
-	};
+	static constexpr bool CONTIGUOUS = true;
 
-protected:
 	/**
-	 * Internal data structure that actually holds the events.
-	 * The events are sorted by their time in ascending order.
-	 * Events with the same time may be in any order.
+	 * Time stamps are interleaved with values.
 	 */
-	std::vector<Event> mEvents;
+	static constexpr bool DENSE_TIMES = false;
 
-	void doAddEvent(TIME time, VALUE value) override
+	TIME time(std::size_t idx) const
 	{
-		if (!this->mEvents.empty() && this->mEvents.back().time > time) {
-			throw std::runtime_error("Unable to add event that violates causality.");
-		}
+		return (*this)[idx].time;
+	}
 
-		mEvents.emplace_back(time, value);
-		EventConsumer<VALUE, TIME>::doAddEvent(time, value);
+	const VALUE& value(std::size_t idx) const
+	{
+		return (*this)[idx].value;
 	}
 
-	void doClear() override
+	void append(const TimedEvent<VALUE, TIME>* events, std::size_t count)
 	{
-		mEvents.clear();
-		EventConsumer<VALUE, TIME>::doClear();
+		this->insert(this->end(), events, events + count);
 	}
+};
+
+
+/**
+ * Columnar storage of time series events -- times and values are kept in separate arrays. Analytical functions
+ * which work only with the time stamps stream through a dense array and no padding is wasted between a time stamp
+ * and a small value. The events are assembled on access, so the items are returned by value.
+ */
+template<typename VALUE, typename TIME = logtime_t>
+class ColumnEventsStorage
+{
+private:
+	std::vector<TIME> mTimes;
+	std::vector<VALUE> mValues;
 
 public:
-	// interface that simulates deque
+	static constexpr bool CONTIGUOUS = false;
+	static constexpr bool DENSE_TIMES = true;
 
-	std::size_t size() const override
+	std::size_t size() const
 	{
-		return mEvents.size();
+		return mTimes.size();
 	}
 
-	bool empty() const override
+	bool empty() const
 	{
-		return mEvents.empty();
+		return mTimes.empty();
 	}
 
-	TIME getEventTime(std::size_t idx) const override
+	std::size_t capacity() const
 	{
-		return mEvents[idx].time;
+		return mTimes.capacity();
 	}
 
-	std::string getEventAsString(std::size_t idx) const override
+	void reserve(std::size_t capacity)
 	{
-		return TimeSeriesBase<TIME>::convert(mEvents[idx].value);
+		mTimes.reserve(capacity);
+		mValues.reserve(capacity);
 	}
 
-	const Event& operator[](std::size_t idx) const
+	void clear()
 	{
-		return mEvents[idx];
+		mTimes.clear();
+		mValues.clear();
 	}
 
-	const Event& at(std::size_t idx) const
+	TIME time(std::size_t idx) const
 	{
-		return mEvents[idx];
+		return mTimes[idx];
 	}
 
-	const Event& front() const
+	typename std::vector<VALUE>::const_reference value(std::size_t idx) const
 	{
-		if (empty()) {
-			throw std::runtime_error("The time series is empty. Unable to reach first item.");
-		}
-		return mEvents.front();
+		return mValues[idx];
 	}
 
-	const Event& back() const
+	TimedEvent<VALUE, TIME> operator[](std::size_t idx) const
 	{
-		if (empty()) {
-			throw std::runtime_error("The time series is empty. Unable to reach last item.");
-		}
-		return mEvents.back();
+		return TimedEvent<VALUE, TIME>(mTimes[idx], mValues[idx]);
 	}
 
-
-	/*
-	 * Analytical functions
-	 */
-
 	/**
-	 * Get the difference between first and last event in given range.
+	 * All time stamps (as a dense array).
 	 */
-	TIME getRangeDuration(const Range& range) const
+	const std::vector<TIME>& times() const
 	{
-		if (range.length() < 2) {
-			return 0.0;
-		}
-		else {
-			return mEvents[range.end() - 1] - mEvents[range.start()];
-		}
+		return mTimes;
 	}
 
-	/**
-	 * Examine event time stamps in given range and return the mean delay between subsequent events.
-	 */
-	double getDeltasMean(const Range& range) const
+	void emplace_back(TIME time, VALUE value)
 	{
-		if (range.length() < 2) {
-			return 0.0;
-		}
-
-		TIME deltas = 0;
-		TIME lastTime = mEvents[range.start()].time;
-
-		for (std::size_t i = range.start() + 1; i < range.end(); ++i) {
-			deltas += mEvents[i].time - lastTime;
-			lastTime = mEvents[i].time;
-		}
-
-		return (double)deltas / (double)(range.length() - 1);
+		mTimes.push_back(time);
+		mValues.push_back(std::move(value));
 	}
 
-	/**
-	 * Examine event time stamps of the entire series and return the mean delay between subsequent events.
-	 */
-	double getDeltasMean() const
+	void append(const TimedEvent<VALUE, TIME>* events, std::size_t count)
 	{
-		return getDeltasMean(Range(0, mEvents.size()));
+		for (std::size_t i = 0; i < count; ++i) {
+			emplace_back(events[i].time, events[i].value);
+		}
 	}
+};
+
+
+/**
+ * A container of time-marked events. It provides a similar interface like vector
+ * (which is also used as internal storage) and additionaly some analytical functions that
+ * might help with behavioral assertions.
+ * @tparam VALUE the inner value of each event (e.g., a state of a pin)
+ * @tparam TIME type used for logical time stamps
+ * @tparam STORAGE container of the events (RowEventsStorage or ColumnEventsStorage)
+ */
+template<typename VALUE, typename TIME = logtime_t, class STORAGE = RowEventsStorage<VALUE, TIME>>
+class TimeSeries : public TimeSeriesBase<TIME>, public EventConsumer<VALUE, TIME>
+{
+public:
+	using Range = typename TimeSeriesBase<TIME>::Range;
 
 	/**
-	 * Examine event time stamps in given range and return the std. deviation
-	 * of delays between subsequent events.
+	 * Internal structure that wraps all time series events.
 	 */
-	double getDeltasDeviation(const Range& range) const
+	using Event = TimedEvent<VALUE, TIME>;
+
+	/**
+	 * Type returned by item accessors (const Event& for row storage, Event for columnar storage).
+	 */
+	using reference = decltype(std::declval<const STORAGE&>()[0]);
+
+protected:
+	/**
+	 * Internal data structure that actually holds the events.
+	 * The events are sorted by their time in ascending order.
+	 * Events with the same time may be in any order.
+	 */
+	STORAGE mEvents;
+
+	/**
+	 * Sparse index of event times (time of every mTimeIndexStride-th event), which narrows down binary searches
+	 * in very large series (zero stride = the index is disabled).
+	 */
+	std::size_t mTimeIndexStride;
+	std::vector<TIME> mTimeIndex;
+
+	/**
+	 * Update the time index after the events from given index on have been added or modified.
+	 */
+	void updateTimeIndex(std::size_t from)
+	{
+		if (mTimeIndexStride == 0) {
+			return;
+		}
+
+		mTimeIndex.resize(std::min(mTimeIndex.size(), (from + mTimeIndexStride - 1) / mTimeIndexStride));
+		for (std::size_t i = mTimeIndex.size() * mTimeIndexStride; i < mEvents.size(); i += mTimeIndexStride) {
+			mTimeIndex.push_back(mEvents.time(i));
+		}
+	}
+
+	/**
+	 * Find the first event which is after given time (or at given time if `including` is set).
+	 * @return index of the event (size() if there is no such event)
+	 */
+	std::size_t findFirstEventAfter(TIME time, bool including) const
+	{
+		auto before = [&](TIME t) { return including ? t < time : t <= time; };
+
+		std::size_t low = 0, high = mEvents.size();
+		if (!mTimeIndex.empty()) {
+			// entry j of the index is the time of event j*stride, so the result is in (j-1)*stride + 1 .. j*stride
+			std::size_t j = std::partition_point(mTimeIndex.begin(), mTimeIndex.end(), before) - mTimeIndex.begin();
+			if (j > 0) {
+				low = (j - 1) * mTimeIndexStride + 1;
+			}
+			if (j < mTimeIndex.size()) {
+				high = j * mTimeIndexStride;
+			}
+		}
+
+		while (low < high) {
+			std::size_t mid = low + (high - low) / 2;
+			if (before(mEvents.time(mid))) {
+				low = mid + 1;
+			}
+			else {
+				high = mid;
+			}
+		}
+		return low;
+	}
+
+	void doAddEvent(TIME time, VALUE value) override
+	{
+		if (!this->mEvents.empty() && this->mEvents.time(this->mEvents.size() - 1) > time) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+
+		mEvents.emplace_back(time, value);
+		updateTimeIndex(mEvents.size() - 1);
+		EventConsumer<VALUE, TIME>::doAddEvent(time, value);
+	}
+
+	void doAddEvents(const Event* events, std::size_t count) override
+	{
+		if (!this->mEvents.empty() && this->mEvents.time(this->mEvents.size() - 1) > events[0].time) {
+			throw std::runtime_error("Unable to add event that violates causality.");
+		}
+
+		mEvents.append(events, count);
+		updateTimeIndex(mEvents.size() - count);
+		this->nextAddEvents(events, count);
+	}
+
+	void reserveEvents(std::size_t count) override
+	{
+		if (mEvents.capacity() < mEvents.size() + count) {
+			mEvents.reserve(std::max(mEvents.size() + count, 2 * mEvents.capacity()));
+		}
+	}
+
+	void doClear() override
+	{
+		mEvents.clear();
+		mTimeIndex.clear();
+		EventConsumer<VALUE, TIME>::doClear();
+	}
+
+public:
+	TimeSeries() : mTimeIndexStride(0) {}
+
+	// interface that simulates deque
+
+	std::size_t size() const override
+	{
+		return mEvents.size();
+	}
+
+	bool empty() const override
+	{
+		return mEvents.empty();
+	}
+
+	TIME getEventTime(std::size_t idx) const override
+	{
+		return mEvents.time(idx);
+	}
+
+	std::string getEventAsString(std::size_t idx) const override
+	{
+		return TimeSeriesBase<TIME>::convert(mEvents.value(idx));
+	}
+
+	void appendEventAsString(std::size_t idx, std::string& buffer) const override
+	{
+		TimeSeriesBase<TIME>::appendConverted(mEvents.value(idx), buffer);
+	}
+
+	reference operator[](std::size_t idx) const
+	{
+		return mEvents[idx];
+	}
+
+	reference at(std::size_t idx) const
+	{
+		return mEvents[idx];
+	}
+
+	reference front() const
+	{
+		if (empty()) {
+			throw std::runtime_error("The time series is empty. Unable to reach first item.");
+		}
+		return mEvents[0];
+	}
+
+	reference back() const
+	{
+		if (empty()) {
+			throw std::runtime_error("The time series is empty. Unable to reach last item.");
+		}
+		return mEvents[mEvents.size() - 1];
+	}
+
+	/**
+	 * Feed all recorded events to given consumer (as one batch, or in batches of limited size
+	 * if the storage needs to assemble the events).
+	 */
+	void replay(EventConsumer<VALUE, TIME>& consumer) const
+	{
+		if constexpr (STORAGE::CONTIGUOUS) {
+			consumer.addEvents(mEvents.data(), mEvents.size());
+		}
+		else {
+			constexpr std::size_t BATCH = 1024;
+			std::vector<Event> batch;
+			batch.reserve(std::min(BATCH, mEvents.size()));
+			for (std::size_t start = 0; start < mEvents.size(); start += BATCH) {
+				batch.clear();
+				for (std::size_t i = start; i < std::min(start + BATCH, mEvents.size()); ++i) {
+					batch.emplace_back(mEvents.time(i), mEvents.value(i));
+				}
+				consumer.addEvents(batch);
+			}
+		}
+	}
+
+
+	/*
+	 * Time-based queries (binary search)
+	 */
+
+	/**
+	 * Enable sparse time index which keeps time of every stride-th event in a small dense array. The binary search
+	 * of the time-based queries then touches only a few cache lines of the (possibly huge) events storage.
+	 * @param stride distance between indexed events (zero disables the index)
+	 */
+	void setTimeIndex(std::size_t stride = 64)
+	{
+		mTimeIndexStride = stride;
+		mTimeIndex.clear();
+		updateTimeIndex(0);
+	}
+
+	/**
+	 * Get the index of the last event which happened at or before given time (size() if there is no such event).
+	 */
+	std::size_t indexAtOrBefore(TIME time) const
+	{
+		std::size_t idx = findFirstEventAfter(time, false);
+		return idx > 0 ? idx - 1 : mEvents.size();
+	}
+
+	/**
+	 * Get the value which was valid at given time (i.e., value of the last event at or before that time).
+	 * @param initialValue the value returned if there is no such event
+	 */
+	VALUE valueAt(TIME time, const VALUE& initialValue) const
+	{
+		std::size_t idx = indexAtOrBefore(time);
+		return idx < mEvents.size() ? mEvents.value(idx) : initialValue;
+	}
+
+	/**
+	 * Get the range of events which happened in the [start, end) time interval.
+	 */
+	Range rangeByTime(TIME start, TIME end) const
+	{
+		std::size_t first = findFirstEventAfter(start, true);
+		return Range(first, std::max(first, findFirstEventAfter(end, true)));
+	}
+
+
+	/*
+	 * Analytical functions
+	 */
+
+	/**
+	 * Get the difference between first and last event in given range.
+	 */
+	TIME getRangeDuration(const Range& range) const
 	{
 		if (range.length() < 2) {
 			return 0.0;
 		}
+		else {
+			return mEvents.time(range.end() - 1) - mEvents.time(range.start());
+		}
+	}
 
-		TIME deltas = 0;
-		TIME squareDeltas = 0;
-		TIME lastTime = mEvents[range.start()].time;
-
-		for (std::size_t i = range.start() + 1; i < range.end(); ++i) {
-			auto dt = mEvents[i].time - lastTime;
-			deltas += dt;
-			squareDeltas += dt * dt;
-			lastTime = mEvents[i].time;
+	/**
+	 * Examine event time stamps in given range and return the mean delay between subsequent events.
+	 */
+	double getDeltasMean(const Range& range) const
+	{
+		if (range.length() < 2) {
+			return 0.0;
 		}
 
-		double count = (double)(range.length() - 1);
-		double mean = (double)deltas / count;
-		return std::sqrt(((double)squareDeltas / count) - (mean * mean));	// E(X^2) - (EX)^2;
+		// the deltas telescope, their sum is the duration of the range
+		return (double)getRangeDuration(range) / (double)(range.length() - 1);
+	}
+
+	/**
+	 * Examine event time stamps of the entire series and return the mean delay between subsequent events.
+	 */
+	double getDeltasMean() const
+	{
+		return getDeltasMean(Range(0, mEvents.size()));
+	}
+
+	/**
+	 * Examine event time stamps in given range and return the std. deviation
+	 * of delays between subsequent events.
+	 */
+	double getDeltasDeviation(const Range& range) const
+	{
+		return getDeltasStatistics(range).deviation;
 	}
 
 	/**
@@ -605,6 +1149,151 @@ public:
 		return getDeltasDeviation(Range(0, mEvents.size()));
 	}
 
+	/**
+	 * Compute count, min, max, mean, and std. deviation of delays between subsequent events in given range
+	 * in one pass (vectorized for columnar storage if the CPU supports AVX2).
+	 */
+	DeltaStatistics<TIME> getDeltasStatistics(const Range& range) const
+	{
+		DeltaStatistics<TIME> stats;
+		if (range.length() < 2) {
+			return stats;
+		}
+
+		stats.count = range.length() - 1;
+		stats.mean = getDeltasMean(range);
+
+		internal::DeltaAccumulator<TIME> accumulator(stats.mean);
+		if constexpr (STORAGE::DENSE_TIMES) {
+			accumulator.accumulate(mEvents.times().data(), range.start() + 1, range.end());
+		}
+		else {
+			accumulator.accumulate([this](std::size_t i) { return mEvents.time(i); }, range.start() + 1, range.end());
+		}
+
+		stats.min = accumulator.min;
+		stats.max = accumulator.max;
+		stats.deviation = std::sqrt(accumulator.squares / (double)stats.count);
+		return stats;
+	}
+
+	DeltaStatistics<TIME> getDeltasStatistics() const
+	{
+		return getDeltasStatistics(Range(0, mEvents.size()));
+	}
+
+	/**
+	 * Get delays between subsequent events in given range.
+	 */
+	std::vector<TIME> getDeltas(const Range& range) const
+	{
+		std::vector<TIME> deltas;
+		for (std::size_t i = range.start() + 1; i < range.end(); ++i) {
+			deltas.push_back(mEvents.time(i) - mEvents.time(i - 1));
+		}
+		return deltas;
+	}
+
+	/**
+	 * Get percentiles of delays between subsequent events in given range (nearest-rank method, i.e., the smallest
+	 * delta which is greater or equal to given percentage of deltas). All values are zero if there are no deltas.
+	 * @param percentiles list of requested percentiles (each in [0, 100] range)
+	 */
+	std::vector<TIME> getDeltasPercentiles(const std::vector<double>& percentiles, const Range& range) const
+	{
+		std::vector<TIME> res(percentiles.size(), 0);
+		auto deltas = getDeltas(range);
+		for (std::size_t i = 0; i < percentiles.size(); ++i) {
+			if (!(percentiles[i] >= 0.0 && percentiles[i] <= 100.0)) {
+				throw std::runtime_error("Percentile " + std::to_string(percentiles[i]) + " is out of range.");
+			}
+			if (deltas.empty()) {
+				continue;
+			}
+
+			auto rank = (std::size_t)std::ceil(percentiles[i] / 100.0 * (double)deltas.size());
+			auto nth = deltas.begin() + (rank > 0 ? rank - 1 : 0);
+			std::nth_element(deltas.begin(), nth, deltas.end());
+			res[i] = *nth;
+		}
+		return res;
+	}
+
+	std::vector<TIME> getDeltasPercentiles(const std::vector<double>& percentiles) const
+	{
+		return getDeltasPercentiles(percentiles, Range(0, mEvents.size()));
+	}
+
+	TIME getDeltasPercentile(double percentile, const Range& range) const
+	{
+		return getDeltasPercentiles({ percentile }, range)[0];
+	}
+
+	TIME getDeltasPercentile(double percentile) const
+	{
+		return getDeltasPercentile(percentile, Range(0, mEvents.size()));
+	}
+
+	/**
+	 * Count delays between subsequent events in buckets [lowerBound + i*bucketWidth, lowerBound + (i+1)*bucketWidth).
+	 * Delays below (above) the covered interval are counted in the first (last) bucket.
+	 */
+	std::vector<std::size_t> getDeltasHistogram(TIME lowerBound, TIME bucketWidth, std::size_t buckets, const Range& range) const
+	{
+		if (bucketWidth == 0 || buckets == 0) {
+			throw std::runtime_error("Histogram needs at least one bucket of non-zero width.");
+		}
+
+		std::vector<std::size_t> histogram(buckets, 0);
+		for (std::size_t i = range.start() + 1; i < range.end(); ++i) {
+			TIME dt = mEvents.time(i) - mEvents.time(i - 1);
+			std::size_t bucket = dt < lowerBound ? 0 : (std::size_t)((dt - lowerBound) / bucketWidth);
+			++histogram[std::min(bucket, buckets - 1)];
+		}
+		return histogram;
+	}
+
+	std::vector<std::size_t> getDeltasHistogram(TIME lowerBound, TIME bucketWidth, std::size_t buckets) const
+	{
+		return getDeltasHistogram(lowerBound, bucketWidth, buckets, Range(0, mEvents.size()));
+	}
+
+	/**
+	 * For each event, compute the length of the longest prefix of given sequence which matches the values
+	 * of the events starting at that index. This is the Z-function of the sequence concatenated with the values
+	 * of the series (with a separator that matches nothing), so it takes O(N + K) comparisons.
+	 */
+	std::vector<std::size_t> getPrefixMatchLengths(const std::vector<VALUE>& sequence) const
+	{
+		const std::size_t k = sequence.size();
+		const std::size_t n = k + 1 + size();
+
+		// compare an item of the sequence with an item of the concatenation
+		auto equal = [&](std::size_t seqIdx, std::size_t idx) -> bool {
+			if (seqIdx == k || idx == k) {
+				return false; // separator (a whole sequence has been matched)
+			}
+			return idx < k ? sequence[seqIdx] == sequence[idx] : sequence[seqIdx] == mEvents.value(idx - k - 1);
+		};
+
+		std::vector<std::size_t> z(n, 0);
+		std::size_t left = 0, right = 0; // the rightmost known match [left, right) of a prefix
+		for (std::size_t i = 1; i < n; ++i) {
+			if (i < right) {
+				z[i] = std::min(right - i, z[i - left]);
+			}
+			while (i + z[i] < n && equal(z[i], i + z[i])) {
+				++z[i];
+			}
+			if (i + z[i] > right) {
+				left = i;
+				right = i + z[i];
+			}
+		}
+
+		return std::vector<std::size_t>(z.begin() + k + 1, z.end());
+	}
+
 	/**
 	 * Tries to find the first occurence of a continuous sequence in the time series.
 	 * If no such sequence exists, tries to return the longest prefix.
@@ -621,15 +1310,11 @@ public:
 			return Range(0, 0);
 		}
 
-		// simple N x K comparison (may be replaced with Rabin-Karp or Knuth-Morris-Pratt in the future)
+		auto lengths = getPrefixMatchLengths(sequence);
 		Range bestFit(0, 0);
-		for (std::size_t start = 0; start < size() - bestFit.length(); ++start) {
-			std::size_t len = 0;
-			while (len < sequence.size() && sequence[len] == mEvents[start + len].value) {
-				++len;
-			}
-			if (len > bestFit.length()) {
-				bestFit.set(start, start + len);
+		for (std::size_t start = 0; start < lengths.size(); ++start) {
+			if (lengths[start] > bestFit.length()) {
+				bestFit.set(start, start + lengths[start]);
 			}
 		}
 
@@ -652,32 +1337,22 @@ public:
 			return Range(0, 0); // sequence is longer than the current time series (no possible match)
 		}
 
-		std::vector<bool> isStartingPoint(mEvents.size());	// true for each index where a the search sequence starts
-		std::vector<std::size_t> startingPoints;			// list of all indices (ordered) where a starting point is
-
-		// simple N x K comparison (may be replaced with Rabin-Karp or Knuth-Morris-Pratt in the future)
-		for (std::size_t start = 0; start <= size() - sequence.size(); ++start) {
-			std::size_t len = 0;
-			while (len < sequence.size() && sequence[len] == mEvents[start + len].value) {
-				++len;
+		// length of the chain of repetitions starting at each index (zero if the sequence does not start there)
+		auto chains = getPrefixMatchLengths(sequence);
+		const std::size_t k = sequence.size();
+		for (std::size_t start = chains.size(); start-- > 0; ) {
+			if (chains[start] == k) {
+				chains[start] += start + k < chains.size() ? chains[start + k] : 0;
 			}
-
-			bool entireSequenceMatched = (len == sequence.size());
-			isStartingPoint[start] = entireSequenceMatched;
-			if (entireSequenceMatched) {
-				startingPoints.push_back(start);
+			else {
+				chains[start] = 0;
 			}
 		}
 
-		// assemble the longest repetitive sequence from collected starting points
 		Range bestFit(0, 0);
-		for (auto start : startingPoints) {
-			std::size_t len = 0;
-			while (start + len < size() && isStartingPoint[start + len]) {
-				len += sequence.size();
-			}
-			if (len > bestFit.length()) {
-				bestFit.set(start, start + len);
+		for (std::size_t start = 0; start < chains.size(); ++start) {
+			if (chains[start] > bestFit.length()) {
+				bestFit.set(start, start + chains[start]);
 			}
 		}
 
@@ -694,7 +1369,7 @@ public:
 	 *                partial mapping is stored here even if the whole sequence could not have been matched
 	 * @return true if the whole sequence was matched
 	 */
-	bool findSelectedSubsequence(const TimeSeries<VALUE, TIME>& sequence, std::vector<std::size_t> &mapping) const
+	bool findSelectedSubsequence(const TimeSeries& sequence, std::vector<std::size_t> &mapping) const
 	{
 		if (sequence.empty()) {
 			throw std::runtime_error("Empty sequence given as needle for search.");
@@ -707,7 +1382,7 @@ public:
 
 		std::size_t idx = 0;
 		for (std::size_t si = 0; si < sequence.size(); ++si) {
-			while (idx < size() && sequence[si].value != mEvents[idx].value) {
+			while (idx < size() && sequence.mEvents.value(si) != mEvents.value(idx)) {
 				++idx;
 			}
 
@@ -728,18 +1403,18 @@ public:
 	 * @param range time range of interest
 	 * @param initialValue the value expected (for both series) before the first event
 	 */
-	TIME compare(const TimeSeries<VALUE, TIME> &timeSeries, const Range &range, const VALUE& initialValue) const
+	TIME compare(const TimeSeries &timeSeries, const Range &range, const VALUE& initialValue) const
 	{
 		TIME res = 0;
 		
-		const TimeSeries<VALUE, TIME>* ts[]{ this, &timeSeries };
+		const STORAGE* ts[]{ &mEvents, &timeSeries.mEvents };
 		VALUE lastValue[]{ initialValue, initialValue };
 		std::size_t idx[]{ 0, 0 };
 
 		// skip parts of time series which are before the range (update starting values)
 		for (std::size_t t = 0; t < 2; ++t) {
-			while (idx[t] < ts[t]->size() && ts[t]->at(idx[t]).time <= range.start()) {
-				lastValue[t] = ts[t]->at(idx[t]).value;
+			while (idx[t] < ts[t]->size() && ts[t]->time(idx[t]) <= range.start()) {
+				lastValue[t] = ts[t]->value(idx[t]);
 				++idx[t];
 			}
 		}
@@ -749,7 +1424,7 @@ public:
 			// index of the series which has next event sooner
 			logtime_t nextTs[2];
 			for (std::size_t t = 0; t < 2; ++t) {
-				nextTs[t] = idx[t] < ts[t]->size() ? ts[t]->at(idx[t]).time : std::numeric_limits<logtime_t>::max();
+				nextTs[t] = idx[t] < ts[t]->size() ? ts[t]->time(idx[t]) : std::numeric_limits<logtime_t>::max();
 			}
 			std::size_t next = nextTs[0] <= nextTs[1] ? 0 : 1;
 
@@ -760,7 +1435,7 @@ public:
 
 			// update the local states
 			lastTime = nextTs[next];
-			lastValue[next] = ts[next]->at(idx[next]).value;
+			lastValue[next] = ts[next]->value(idx[next]);
 			++idx[next];
 		}
 
@@ -774,6 +1449,13 @@ public:
 };
 
 
+/**
+ * Time series which keeps times and values of the events in separate arrays (see ColumnEventsStorage).
+ */
+template<typename VALUE, typename TIME = logtime_t>
+using ColumnarTimeSeries = TimeSeries<VALUE, TIME, ColumnEventsStorage<VALUE, TIME>>;
+
+
 /**
  * Extension of time series so it can hold "future" events. Future events are registered but not emitted
  * to the next item in the chain until such action is triggered by time advancing or consumig a regular event.
@@ -787,15 +1469,69 @@ private:
 	 */
 	std::size_t mLastConsumed;
 
+	/**
+	 * Events added out of order (before the last event of the series) which are not merged into the series yet.
+	 * They are kept in the order of addition and merged at once (see setDeferredMerge()).
+	 */
+	std::vector<TimedEvent<VALUE, TIME>> mUnmerged;
+
+	/**
+	 * The earliest time of the unmerged events (max. value if there are none).
+	 */
+	TIME mUnmergedMin;
+
+	/**
+	 * Whether the events added out of order are merged only when they are due (see setDeferredMerge()).
+	 */
+	bool mDeferredMerge;
+
 	/**
 	 * Emit events which has not yet been emited up to given timestamp (inclusive).
 	 */
 	void consumeEventsUntil(TIME time)
 	{
+		if (mUnmergedMin <= time) {
+			mergeEvents();
+		}
+
+		std::size_t first = mLastConsumed;
 		while (mLastConsumed < this->mEvents.size() && this->mEvents[mLastConsumed].time <= time) {
-			this->nextAddEvent(this->mEvents[mLastConsumed].time, this->mEvents[mLastConsumed].value);
 			++mLastConsumed;
 		}
+		if (first < mLastConsumed) {
+			this->nextAddEvents(&this->mEvents[first], mLastConsumed - first);
+		}
+	}
+
+	/**
+	 * Return the index where an event with given time belongs (after the events with the same time).
+	 * The event must not be placed among the events which were already emitted.
+	 */
+	std::size_t findInsertPosition(TIME time) const
+	{
+		std::size_t idx = std::upper_bound(this->mEvents.begin(), this->mEvents.end(), time,
+			[](TIME time, const TimedEvent<VALUE, TIME>& event) { return time < event.time; }) - this->mEvents.begin();
+		if (idx < mLastConsumed) {
+			throw std::runtime_error("Invariant breached! Index of last consumed event and last timestamp are not in sync.");
+		}
+		return idx;
+	}
+
+	/**
+	 * Append an event at the end of the series if it belongs there, otherwise put it aside among the unmerged events.
+	 * The unmerged events are always older than the last event of the series, so appended events belong after them.
+	 * @return true if the event was appended
+	 */
+	bool appendOrPutAside(TIME time, const VALUE& value)
+	{
+		if (this->mEvents.empty() || this->mEvents[this->mEvents.size() - 1].time <= time) {
+			this->mEvents.emplace_back(time, value);
+			return true;
+		}
+
+		mUnmerged.emplace_back(time, value);
+		mUnmergedMin = std::min(mUnmergedMin, time);
+		return false;
 	}
 
 protected:
@@ -806,6 +1542,12 @@ protected:
 		EventConsumer<VALUE, TIME>::doAddEvent(time, value);	// yes, we skip the TimeSeries implementation
 	}
 
+	void doAddEvents(const TimedEvent<VALUE, TIME>* events, std::size_t count) override
+	{
+		// the events are interleaved with the future ones, so they are processed one by one
+		EventConsumer<VALUE, TIME>::doAddEvents(events, count);
+	}
+
 
 	void doAdvanceTime(TIME time) override
 	{
@@ -816,11 +1558,58 @@ protected:
 	void doClear() override
 	{
 		mLastConsumed = 0;
+		mUnmerged.clear();
+		mUnmergedMin = std::numeric_limits<TIME>::max();
 		TimeSeries<VALUE, TIME>::doClear();
 	}
 
 public:
-	FutureTimeSeries() : mLastConsumed(0) {}
+	FutureTimeSeries() : mLastConsumed(0), mUnmergedMin(std::numeric_limits<TIME>::max()), mDeferredMerge(false) {}
+
+	TIME nextEventTime() const override
+	{
+		TIME time = mLastConsumed < this->mEvents.size()
+			? this->mEvents[mLastConsumed].time
+			: std::numeric_limits<TIME>::max();
+		return std::min(time, mUnmergedMin);
+	}
+
+	/**
+	 * Defer merging of the events added out of order. They are put aside and merged (sorted) at once when any of them
+	 * is due to be emitted (or when mergeEvents() is called), so scheduling n events in any order takes O(n log n).
+	 * Until then, these events are not visible through the time series interface (size(), operator[], queries, ...),
+	 * so the deferred merge is suitable for series which are used only as queues of future events (e.g., inputs).
+	 */
+	void setDeferredMerge(bool enabled = true)
+	{
+		mDeferredMerge = enabled;
+		if (!enabled) {
+			mergeEvents();
+		}
+	}
+
+	/**
+	 * Merge the events which were put aside (see setDeferredMerge()) into the series.
+	 */
+	void mergeEvents()
+	{
+		if (mUnmerged.empty()) {
+			return;
+		}
+
+		// only the events after the first unmerged event need to be merged
+		std::size_t first = findInsertPosition(mUnmergedMin);
+		std::size_t middle = this->mEvents.size();
+		this->mEvents.append(mUnmerged.data(), mUnmerged.size());
+		mUnmerged.clear();
+		mUnmergedMin = std::numeric_limits<TIME>::max();
+
+		// both sorting and merging are stable (events with the same time keep the order of addition)
+		auto byTime = [](const TimedEvent<VALUE, TIME>& a, const TimedEvent<VALUE, TIME>& b) { return a.time < b.time; };
+		std::stable_sort(this->mEvents.begin() + middle, this->mEvents.end(), byTime);
+		std::inplace_merge(this->mEvents.begin() + first, this->mEvents.begin() + middle, this->mEvents.end(), byTime);
+		this->updateTimeIndex(first);
+	}
 
 	/**
 	 * Add event that is considered to be in the future. It is not passed along through the event consumer chain,
@@ -833,16 +1622,60 @@ public:
 			throw std::runtime_error("Unable to add event that violates causality.");
 		}
 
-		// shuffle the event to the right place from the back
 		std::size_t idx = this->mEvents.size();
-		this->mEvents.emplace_back(time, value);
-		while (idx > 0 && this->mEvents[idx-1].time > this->mEvents[idx].time) {
-			std::swap(this->mEvents[idx-1], this->mEvents[idx]);
-			--idx;
+		if (!mDeferredMerge && idx > 0 && this->mEvents[idx - 1].time > time) {
+			// find the right place right away (after the events with the same time)
+			idx = findInsertPosition(time);
+			this->mEvents.emplace(this->mEvents.begin() + idx, time, value);
+			this->updateTimeIndex(idx);
+		}
+		else if (appendOrPutAside(time, value)) {
+			this->updateTimeIndex(idx);
 		}
+	}
 
-		if (idx < mLastConsumed) {
-			throw std::runtime_error("Invariant breached! Index of last consumed event and last timestamp are not in sync.");
+	/**
+	 * Add a batch of future events (in any order). The events which are out of order are sorted and merged
+	 * with the series at once, so it takes O(n log n) instead of inserting the events one by one. The result
+	 * is the same as if the events were added by addFutureEvent() in the order of the batch.
+	 * If any event violates causality, no event is added.
+	 * @param events array of events (not necessarily sorted)
+	 * @param count number of events in the array
+	 */
+	void addFutureEvents(const TimedEvent<VALUE, TIME>* events, std::size_t count)
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			if (this->mLastTime > events[i].time) {
+				throw std::runtime_error("Unable to add event that violates causality.");
+			}
+		}
+
+		std::size_t first = this->mEvents.size();
+		for (std::size_t i = 0; i < count; ++i) {
+			appendOrPutAside(events[i].time, events[i].value);
+		}
+		this->updateTimeIndex(first);
+
+		if (!mDeferredMerge) {
+			mergeEvents();
+		}
+	}
+
+	void addFutureEvents(const std::vector<TimedEvent<VALUE, TIME>>& events)
+	{
+		addFutureEvents(events.data(), events.size());
+	}
+
+	/**
+	 * Remove the events which have already been emitted, so only the pending (future) events are kept
+	 * (e.g., when the series is used just as a queue of inputs which are fed continuously).
+	 */
+	void discardConsumed()
+	{
+		if (mLastConsumed > 0) {
+			this->mEvents.erase(this->mEvents.begin(), this->mEvents.begin() + mLastConsumed);
+			mLastConsumed = 0;
+			this->updateTimeIndex(0);
 		}
 	}
 
@@ -854,6 +1687,275 @@ public:
 		for (auto&& e : this->mEvents) {
 			e.time += skew;
 		}
+		for (auto&& e : mUnmerged) {
+			e.time += skew;
+		}
+		if (!mUnmerged.empty()) {
+			mUnmergedMin += skew;
+		}
+		this->updateTimeIndex(0);
+	}
+};
+
+
+/**
+ * Time series with bounded memory. The events are kept in a ring buffer and only the most recent ones are retained
+ * (limited by the number of events and/or by the time span). Older events are evicted in chunks and handed over
+ * to an eviction sink (e.g., a writer or an analyzer), so long simulations may run in constant memory.
+ * Indices of the held events start at 0 (the oldest retained event), evictedCount() tells how many were evicted before.
+ */
+template<typename VALUE, typename TIME = logtime_t>
+class BoundedTimeSeries : public TimeSeriesBase<TIME>, public EventConsumer<VALUE, TIME>
+{
+public:
+	using Range = typename TimeSeriesBase<TIME>::Range;
+	using Event = TimedEvent<VALUE, TIME>;
+
+private:
+	std::vector<Event> mBuffer;	///< ring buffer (its size is the current capacity)
+	std::size_t mHead;			///< index of the oldest event in the buffer
+	std::size_t mSize;			///< number of held events
+
+	std::size_t mMaxEvents;		///< the most recent mMaxEvents events are retained (0 = no limit)
+	TIME mMaxSpan;				///< events younger than mMaxSpan (relative to the last event) are retained (0 = no limit)
+	std::size_t mChunk;			///< how many events are evicted at once (over the count limit)
+	std::size_t mEvicted;		///< total number of evicted events
+
+	EventConsumer<VALUE, TIME>* mEvictionSink;
+
+	std::size_t position(std::size_t idx) const
+	{
+		idx += mHead;
+		return idx < mBuffer.size() ? idx : idx - mBuffer.size();
+	}
+
+	/**
+	 * Remove given number of the oldest events and pass them to the sink (as one or two batches).
+	 */
+	void evict(std::size_t count)
+	{
+		if (count == 0) {
+			return;
+		}
+
+		if (mEvictionSink != nullptr) {
+			std::size_t first = std::min(count, mBuffer.size() - mHead);
+			mEvictionSink->addEvents(&mBuffer[mHead], first);
+			if (first < count) {
+				mEvictionSink->addEvents(&mBuffer[0], count - first);
+			}
+		}
+
+		mHead = position(count);
+		mSize -= count;
+		mEvicted += count;
+	}
+
+	/**
+	 * Number of the oldest events which are outside of the time span relative to given time.
+	 */
+	std::size_t countExpired(TIME time) const
+	{
+		if (mMaxSpan == 0 || time < mMaxSpan) {
+			return 0;
+		}
+
+		std::size_t low = 0, high = mSize;
+		while (low < high) {
+			std::size_t mid = low + (high - low) / 2;
+			if (mBuffer[position(mid)].time < time - mMaxSpan) {
+				low = mid + 1;
+			}
+			else {
+				high = mid;
+			}
+		}
+		return low;
+	}
+
+	/**
+	 * Reallocate the ring buffer (the events are moved to the beginning).
+	 */
+	void resize(std::size_t capacity)
+	{
+		std::vector<Event> buffer;
+		buffer.reserve(capacity);
+		for (std::size_t i = 0; i < mSize; ++i) {
+			buffer.push_back(std::move(mBuffer[position(i)]));
+		}
+		buffer.resize(capacity, Event(TIME(), VALUE()));
+		mBuffer.swap(buffer);
+		mHead = 0;
+	}
+
+	/**
+	 * Make room for one more event (which has given time). Expired events are evicted lazily (when the buffer is full),
+	 * the buffer grows while the count limit allows it.
+	 */
+	void makeRoom(TIME time)
+	{
+		if (mSize < mBuffer.size()) {
+			return;
+		}
+
+		evict(countExpired(time));
+		if (mSize < mBuffer.size()) {
+			return;
+		}
+
+		std::size_t limit = mMaxEvents > 0 ? mMaxEvents + mChunk : std::numeric_limits<std::size_t>::max();
+		if (mBuffer.size() < limit) {
+			resize(std::min(limit, std::max<std::size_t>(16, mBuffer.size() * 2)));
+		}
+		else {
+			evict(mSize - mMaxEvents);
+		}
+	}
+
+	void pushEvent(TIME time, const VALUE& value)
+	{
+		makeRoom(time);
+		mBuffer[position(mSize)] = Event(time, value);
+		++mSize;
+	}
+
+protected:
+	void doAddEvent(TIME time, VALUE value) override
+	{
+		pushEvent(time, value);
+		EventConsumer<VALUE, TIME>::doAddEvent(time, value);
+	}
+
+	void doAddEvents(const Event* events, std::size_t count) override
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			pushEvent(events[i].time, events[i].value);
+		}
+		this->nextAddEvents(events, count);
+	}
+
+	void doClear() override
+	{
+		mHead = mSize = 0;
+		mEvicted = 0;
+		EventConsumer<VALUE, TIME>::doClear();
+	}
+
+public:
+	/**
+	 * @param maxEvents how many of the most recent events are retained (0 = no limit)
+	 * @param maxSpan time span (before the last event) of retained events (0 = no limit)
+	 * @param chunk how many events are evicted at once when the count limit is reached (0 = an eighth of maxEvents)
+	 */
+	BoundedTimeSeries(std::size_t maxEvents = 0, TIME maxSpan = 0, std::size_t chunk = 0)
+		: mHead(0), mSize(0), mMaxEvents(maxEvents), mMaxSpan(maxSpan), mEvicted(0), mEvictionSink(nullptr)
+	{
+		if (maxEvents == 0 && maxSpan == 0) {
+			throw std::runtime_error("Bounded time series requires limited number of events or time span.");
+		}
+		mChunk = chunk > 0 ? chunk : std::max<std::size_t>(1, maxEvents / 8);
+	}
+
+	/**
+	 * Set the consumer which receives the evicted events (in chunks, in the order of their time).
+	 */
+	void attachEvictionSink(EventConsumer<VALUE, TIME>& sink)
+	{
+		if (mEvictionSink != nullptr) {
+			throw std::runtime_error("Eviction sink is already attached.");
+		}
+		mEvictionSink = &sink;
+	}
+
+	void detachEvictionSink()
+	{
+		if (mEvictionSink == nullptr) {
+			throw std::runtime_error("No eviction sink is attached.");
+		}
+		mEvictionSink = nullptr;
+	}
+
+	/**
+	 * Evict all events which are beyond the retention limits now (otherwise, they are evicted lazily).
+	 */
+	void trim()
+	{
+		if (mSize > 0) {
+			evict(countExpired(back().time));
+		}
+		if (mMaxEvents > 0 && mSize > mMaxEvents) {
+			evict(mSize - mMaxEvents);
+		}
+	}
+
+	/**
+	 * Hand over all held events to the eviction sink (e.g., at the end of the simulation).
+	 */
+	void flush()
+	{
+		evict(mSize);
+	}
+
+	/**
+	 * Total number of events that were evicted (index of the oldest held event in the whole history).
+	 */
+	std::size_t evictedCount() const
+	{
+		return mEvicted;
+	}
+
+	std::size_t size() const override
+	{
+		return mSize;
+	}
+
+	bool empty() const override
+	{
+		return mSize == 0;
+	}
+
+	TIME getEventTime(std::size_t idx) const override
+	{
+		return mBuffer[position(idx)].time;
+	}
+
+	std::string getEventAsString(std::size_t idx) const override
+	{
+		return TimeSeriesBase<TIME>::convert(mBuffer[position(idx)].value);
+	}
+
+	void appendEventAsString(std::size_t idx, std::string& buffer) const override
+	{
+		TimeSeriesBase<TIME>::appendConverted(mBuffer[position(idx)].value, buffer);
+	}
+
+	const Event& operator[](std::size_t idx) const
+	{
+		return mBuffer[position(idx)];
+	}
+
+	const Event& at(std::size_t idx) const
+	{
+		if (idx >= mSize) {
+			throw std::runtime_error("Index out of range of the time series.");
+		}
+		return mBuffer[position(idx)];
+	}
+
+	const Event& front() const
+	{
+		if (empty()) {
+			throw std::runtime_error("The time series is empty. Unable to reach first item.");
+		}
+		return mBuffer[mHead];
+	}
+
+	const Event& back() const
+	{
+		if (empty()) {
+			throw std::runtime_error("The time series is empty. Unable to reach last item.");
+		}
+		return mBuffer[position(mSize - 1)];
 	}
 };
 
@@ -0,0 +1,147 @@
+#ifndef MOCCARDUINO_SHARED_TIME_STATISTICS_HPP
+#define MOCCARDUINO_SHARED_TIME_STATISTICS_HPP
+
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/*
+ * The AVX2 kernel is compiled even if the whole build does not target AVX2 (GCC and Clang on x86 allow that
+ * per function) and it is used only if the CPU supports it (the check is cached by the compiler runtime).
+ */
+#if defined(__AVX2__)
+#define MOCCARDUINO_AVX2_TARGET
+#define MOCCARDUINO_AVX2_SUPPORTED() true
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MOCCARDUINO_AVX2_TARGET __attribute__((target("avx2")))
+#define MOCCARDUINO_AVX2_SUPPORTED() __builtin_cpu_supports("avx2")
+#endif
+
+#if defined(MOCCARDUINO_AVX2_TARGET)
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Summary of delays between subsequent events (deltas) of a time series.
+ */
+template<typename TIME>
+struct DeltaStatistics
+{
+	std::size_t count = 0;	///< number of deltas (one less than the number of events)
+	TIME min = 0;			///< the shortest delta
+	TIME max = 0;			///< the longest delta
+	double mean = 0.0;		///< mean delta
+	double deviation = 0.0;	///< standard deviation of deltas
+};
+
+
+namespace internal
+{
+	/**
+	 * Accumulators of one pass over deltas. The mean is known before the pass (the deltas telescope, so their sum
+	 * is simply the difference between the last and the first time stamp), so the squared differences from the mean
+	 * may be summed directly -- unlike the sum of squared deltas, this neither overflows nor loses precision.
+	 */
+	template<typename TIME>
+	struct DeltaAccumulator
+	{
+		double mean;
+		TIME min = std::numeric_limits<TIME>::max();
+		TIME max = std::numeric_limits<TIME>::min();
+		double squares = 0.0;
+
+		DeltaAccumulator(double m) : mean(m) {}
+
+		/**
+		 * Process deltas between time stamps time(start-1) .. time(end-1) (portable version).
+		 * @param time accessor which returns the time stamp of given index
+		 */
+		template<typename ACCESSOR>
+		void accumulate(const ACCESSOR& time, std::size_t start, std::size_t end)
+		{
+			// independent partial sums shorten the dependency chain of the floating point additions
+			double partial[4] = { 0.0, 0.0, 0.0, 0.0 };
+			for (std::size_t i = start; i < end; ++i) {
+				TIME dt = time(i) - time(i - 1);
+				min = std::min(min, dt);
+				max = std::max(max, dt);
+				double d = (double)dt - mean;
+				partial[i % 4] += d * d;
+			}
+			squares += (partial[0] + partial[1]) + (partial[2] + partial[3]);
+		}
+
+#if defined(MOCCARDUINO_AVX2_TARGET)
+		/**
+		 * Process deltas of a dense array of 64-bit time stamps using AVX2 (four deltas at once).
+		 * Deltas are converted to doubles by mantissa injection, which is exact only for values below 2^52;
+		 * if a longer delta is encountered, nothing is accumulated and the caller has to use the portable version.
+		 * @return index where the vectorized processing stopped (the rest needs to be processed by the portable version)
+		 */
+		MOCCARDUINO_AVX2_TARGET std::size_t accumulateAvx2(const std::uint64_t* times, std::size_t start, std::size_t end)
+		{
+			const __m256i magicBits = _mm256_set1_epi64x(0x4330000000000000ll); // 2^52 as double
+			const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+			const __m256i limit = _mm256_set1_epi64x((1ll << 52) - 1);
+			const __m256d vmean = _mm256_set1_pd(mean);
+
+			__m256i vmin = _mm256_set1_epi64x(std::numeric_limits<std::int64_t>::max());
+			__m256i vmax = _mm256_setzero_si256();
+			__m256i tooLong = _mm256_setzero_si256();
+			__m256d vsquares = _mm256_setzero_pd();
+
+			std::size_t i = start;
+			for (; i + 4 <= end; i += 4) {
+				__m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(times + i));
+				__m256i previous = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(times + i - 1));
+				__m256i dt = _mm256_sub_epi64(current, previous); // non-negative (the series is sorted)
+
+				tooLong = _mm256_or_si256(tooLong, _mm256_cmpgt_epi64(dt, limit));
+				vmin = _mm256_blendv_epi8(vmin, dt, _mm256_cmpgt_epi64(vmin, dt));
+				vmax = _mm256_blendv_epi8(vmax, dt, _mm256_cmpgt_epi64(dt, vmax));
+
+				__m256d d = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(dt, magicBits)), magic);
+				d = _mm256_sub_pd(d, vmean);
+				vsquares = _mm256_add_pd(vsquares, _mm256_mul_pd(d, d));
+			}
+
+			if (!_mm256_testz_si256(tooLong, tooLong)) {
+				return start;
+			}
+
+			alignas(32) std::int64_t mins[4], maxs[4];
+			alignas(32) double sq[4];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(mins), vmin);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+			_mm256_store_pd(sq, vsquares);
+			for (std::size_t j = 0; j < 4 && start + j < i; ++j) {
+				min = std::min<std::uint64_t>(min, mins[j]);
+				max = std::max<std::uint64_t>(max, maxs[j]);
+			}
+			squares += (sq[0] + sq[1]) + (sq[2] + sq[3]);
+			return i;
+		}
+#endif
+
+		/**
+		 * Process deltas of a dense array of time stamps (vectorized if the CPU supports it).
+		 */
+		void accumulate(const TIME* times, std::size_t start, std::size_t end)
+		{
+#if defined(MOCCARDUINO_AVX2_TARGET)
+			if constexpr (std::is_same_v<TIME, std::uint64_t>) {
+				if (MOCCARDUINO_AVX2_SUPPORTED()) {
+					start = accumulateAvx2(times, start, end);
+				}
+			}
+#endif
+			accumulate([times](std::size_t i) { return times[i]; }, start, end);
+		}
+	};
+}
+
+
+#endif